@@ -0,0 +1,113 @@
+/*
+* mtstress.c -- several OS threads sharing one state
+* each thread resumes its own coroutine of one state; the coroutines
+* allocate, call C functions that call back into Lua, resume coroutines of
+* their own that yield inside the state, yield back to the host, and now and
+* then run a full collection. The lock must keep the shared counter exact.
+* Lua itself must be built with LUA_USE_THREADS too; this program refers to
+* the lock so that it does not link with a library built without it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#if !defined(LUA_USE_THREADS)
+#error "build Lua and this program with LUA_USE_THREADS (see etc/README)"
+#endif
+
+/* from lstate.c; only there when liblua.a was built with LUA_USE_THREADS,
+   so the link fails against a library without the lock */
+extern void luaE_lock (lua_State *L);
+void (*mtstress_lock) (lua_State *L) = luaE_lock;
+
+#define NT	4		/* OS threads */
+#define N	20000		/* iterations of each coroutine */
+
+static lua_State *co[NT];
+
+static const char *code =
+ "total = 0\n"
+ "function job(id, n)\n"
+ "  local acc = {}\n"
+ "  local gen = coroutine.wrap(function()\n"
+ "    for i = 1, n do coroutine.yield(i) end\n"
+ "  end)\n"
+ "  for i = 1, n do\n"
+ "    local v = gen()\n"
+ "    total = total + 1\n"
+ "    acc[#acc+1] = string.format('%d:%d', id, v)\n"
+ "    if #acc > 64 then table.sort(acc); acc = {} end\n"
+ "    assert(twice(function(x) return x + 1 end, v) == v + 2)\n"
+ "    if i % 100 == 0 then coroutine.yield() end\n"
+ "    if i % 5000 == 0 then collectgarbage() end\n"
+ "  end\n"
+ "  local function rec(k) if k == 0 then return 0 end return 1 + rec(k-1) end\n"
+ "  assert(rec(100) == 100)\n"
+ "  return id\n"
+ "end\n";
+
+/* twice(f, x): f(f(x)), a C function calling back into Lua */
+static int twice (lua_State *L)
+{
+ lua_pushvalue(L,1);
+ lua_pushvalue(L,1);
+ lua_pushvalue(L,2);
+ lua_call(L,1,1);
+ lua_call(L,1,1);
+ return 1;
+}
+
+static void fail (lua_State *L, const char *what)
+{
+ fprintf(stderr,"mtstress: %s: %s\n",what,lua_isstring(L,-1) ? lua_tostring(L,-1) : "?");
+ exit(1);
+}
+
+static void *run (void *ud)
+{
+ long id=(long)ud;
+ lua_State *L1=co[id];
+ int status;
+ int narg=2;
+ lua_getglobal(L1,"job");
+ lua_pushinteger(L1,id);
+ lua_pushinteger(L1,N);
+ while ((status=lua_resume(L1,narg))==LUA_YIELD)	/* yields to the host */
+ {
+  lua_settop(L1,0);
+  narg=0;
+ }
+ if (status!=0) fail(L1,"error in coroutine");
+ if (lua_tointeger(L1,-1)!=id) fail(L1,"bad result");
+ lua_settop(L1,0);
+ return NULL;
+}
+
+int main(void)
+{
+ lua_State *L=luaL_newstate();
+ pthread_t th[NT];
+ long i;
+ if (L==NULL) return 1;
+ luaL_openlibs(L);
+ lua_register(L,"twice",twice);
+ if (luaL_dostring(L,code)) fail(L,"cannot load");
+ for (i=0; i<NT; i++)
+ {
+  co[i]=lua_newthread(L);
+  luaL_ref(L,LUA_REGISTRYINDEX);	/* keep it alive */
+ }
+ for (i=0; i<NT; i++)
+  if (pthread_create(&th[i],NULL,run,(void *)i)!=0) fail(L,"cannot create thread");
+ for (i=0; i<NT; i++) pthread_join(th[i],NULL);
+ lua_getglobal(L,"total");
+ i=(long)lua_tointeger(L,-1);
+ lua_close(L);
+ printf("mtstress: total %ld (expected %ld)\n",i,(long)NT*N);
+ return i==(long)NT*N ? 0 : 1;
+}
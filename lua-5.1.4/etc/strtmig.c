@@ -0,0 +1,202 @@
+/*
+* strtmig.c -- the string table while it migrates
+* grows and shrinks `strt', interns and looks up strings while buckets are
+* still moving from the old array to the new one, and runs the sweep-string
+* phase of the collector in the middle of a migration, both in incremental
+* and in generational mode. Uses the core headers, so link it statically.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LUA_CORE
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+
+#define N	(1 << 15)	/* strings kept in the anchor table */
+
+static TString *ts[N];		/* anchored strings (NULL when released) */
+static unsigned long seed = 1;
+static int lookups;		/* lookups done while `strt.old' != NULL */
+
+static void check (int c, const char *what)
+{
+ if (!c)
+ {
+  fprintf(stderr,"strtmig: %s\n",what);
+  exit(1);
+ }
+}
+
+static int rnd (int n)
+{
+ seed = seed*1103515245 + 12345;
+ return (int)((seed >> 16) % (unsigned long)n);
+}
+
+static TString *intern (lua_State *L, const char *prefix, int i)
+{
+ char buff[32];
+ sprintf(buff,"%s%d",prefix,i);
+ return luaS_new(L,buff);
+}
+
+/* every string sits in its own bucket and `nuse' counts them all */
+static void checkstrt (lua_State *L)
+{
+ stringtable *tb=&G(L)->strt;
+ lu_int32 n=0;
+ GCObject *o;
+ int i;
+ for (i=0; i<tb->size; i++)
+  for (o=tb->hash[i]; o!=NULL; o=o->gch.next, n++)
+   check(lmod(gco2ts(o)->hash,tb->size)==i,"string in a wrong new bucket");
+ for (i=0; i<tb->oldsize; i++)
+ {
+  check(tb->old[i]==NULL || i>=tb->moved,"string left in a moved bucket");
+  for (o=tb->old[i]; o!=NULL; o=o->gch.next, n++)
+   check(lmod(gco2ts(o)->hash,tb->oldsize)==i,"string in a wrong old bucket");
+ }
+ check(n==tb->nuse,"`nuse' does not match the strings in the table");
+}
+
+/* interning an anchored string again must find the same object */
+static void lookup (lua_State *L, int k)
+{
+ int i;
+ for (i=0; i<k; i++)
+ {
+  int j=rnd(N);
+  if (ts[j]!=NULL) check(intern(L,"s",j)==ts[j],"lookup missed a string");
+ }
+ if (G(L)->strt.old!=NULL) lookups+=k;
+}
+
+static void anchor (lua_State *L, int i)
+{
+ lua_pushfstring(L,"s%d",i);
+ ts[i]=rawtsvalue(L->top-1);
+ lua_rawseti(L,1,i);
+}
+
+static void release (lua_State *L, int every)
+{
+ int i;
+ for (i=0; i<N; i++)
+  if (ts[i]!=NULL && i%every!=0)
+  {
+   lua_pushnil(L);
+   lua_rawseti(L,1,i);
+   ts[i]=NULL;
+  }
+}
+
+/* grows from the minimum size while interning; lookups between the steps */
+static void grow (lua_State *L)
+{
+ int i;
+ for (i=0; i<N; i++)
+ {
+  anchor(L,i);
+  if (G(L)->strt.old!=NULL)
+  {
+   lookup(L,4);
+   intern(L,"t",i);		/* garbage, created mid migration */
+  }
+  if (i%4096==0) checkstrt(L);
+ }
+ check(lookups>0,"no lookup during a growth");
+ checkstrt(L);
+}
+
+/* the sweep-string phase walks both arrays while no bucket moves */
+static void sweepinc (lua_State *L)
+{
+ global_State *g=G(L);
+ int i;
+ release(L,2);
+ luaS_resize(L,g->strt.size*2);
+ lua_gc(L,LUA_GCSETSTEPMUL,100000);
+ while (g->gcstate!=GCSsweepstring) lua_gc(L,LUA_GCSTEP,0);
+ check(g->strt.old!=NULL,"migration finished before the sweep-string phase");
+ lua_gc(L,LUA_GCSETSTEPMUL,100);
+ for (i=0; g->gcstate==GCSsweepstring; i++)
+ {
+  lookup(L,16);
+  intern(L,"u",i);
+  lua_gc(L,LUA_GCSTEP,0);
+ }
+ checkstrt(L);
+ lua_gc(L,LUA_GCCOLLECT,0);
+ lookup(L,N);
+ checkstrt(L);
+}
+
+/* a shrink starts at the end of a sweep; lookups while it runs */
+static void shrink (lua_State *L)
+{
+ global_State *g=G(L);
+ int size=g->strt.size;
+ int i;
+ while (g->strt.old!=NULL) luaS_resizestep(L,MAX_INT);
+ release(L,64);
+ lua_gc(L,LUA_GCCOLLECT,0);
+ lua_gc(L,LUA_GCSTOP,0);
+ check(g->strt.size<size,"table did not shrink");
+ check(g->strt.old!=NULL,"shrink finished at once");
+ for (i=0; g->strt.old!=NULL; i++)
+ {
+  lookup(L,4);
+  intern(L,"v",i);
+  if (i%1024==0) checkstrt(L);
+ }
+ lookup(L,N);
+ checkstrt(L);
+ lua_gc(L,LUA_GCRESTART,0);
+}
+
+/* a minor collection sweeps young strings still in old buckets */
+static void sweepgen (lua_State *L)
+{
+ global_State *g=G(L);
+ int i;
+ lua_gc(L,LUA_GCGEN,0);
+ for (i=0; i<N; i++)
+  if (ts[i]==NULL) anchor(L,i);		/* young strings */
+ luaS_resize(L,g->strt.size*2);
+ release(L,3);
+ lua_gc(L,LUA_GCSTEP,0);
+ check(g->strt.old!=NULL,"migration finished in the first step");
+ for (i=0; g->strt.old!=NULL; i++)
+ {
+  lookup(L,16);
+  intern(L,"w",i);
+  if (i%16==0) lua_gc(L,LUA_GCSTEP,0);
+  if (i%256==0) checkstrt(L);
+ }
+ lookup(L,N);
+ checkstrt(L);
+}
+
+int main(void)
+{
+ lua_State *L=luaL_newstate();
+ check(L!=NULL,"cannot create state");
+ lua_gc(L,LUA_GCSTOP,0);
+ lua_createtable(L,N,0);		/* anchor table at index 1 */
+ grow(L);
+ lua_gc(L,LUA_GCRESTART,0);
+ sweepinc(L);
+ shrink(L);
+ sweepgen(L);
+ lua_close(L);
+ printf("strtmig: %d lookups during migrations, all found\n",lookups);
+ return 0;
+}
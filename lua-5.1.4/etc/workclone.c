@@ -0,0 +1,72 @@
+/*
+* workclone.c -- handles of the worker library in cloned states
+* a pool copied by lua_clone is closed in the copy, while the original keeps
+* its workers; a copied future still gives the results of its job; copied
+* channels and blobs are the same objects in both states. Either state may
+* be closed first. Build with -fsanitize=address to see misuse.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+static void run (lua_State *L, const char *what, const char *code)
+{
+ if (luaL_dostring(L,code))
+ {
+  fprintf(stderr,"workclone: %s: %s\n",what,lua_tostring(L,-1));
+  exit(1);
+ }
+}
+
+static lua_State *clone (lua_State *L)
+{
+ lua_State *C=luaL_clonestate(L);
+ if (C==NULL)
+ {
+  fprintf(stderr,"workclone: cannot clone\n");
+  exit(1);
+ }
+ return C;
+}
+
+int main(void)
+{
+ lua_State *L=luaL_newstate();
+ lua_State *C;
+ if (L==NULL) return 1;
+ luaL_openlibs(L);
+ run(L,"setup",
+  "P = worker.pool(2)\n"
+  "F = P:submit(function (x) return x * 2 end, 21)\n"
+  "CH = worker.channel()\n"
+  "B = worker.buffer('hello')\n"
+  "assert(CH:send(B))\n");
+ /* the copy is closed first */
+ C=clone(L);
+ run(C,"copy",
+  "assert(tostring(P) == 'pool (closed)')\n"
+  "assert(not pcall(P.submit, P, function () end))\n"
+  "assert(F:get() == 42)\n"
+  "assert(tostring(CH:receive()) == tostring(B))\n"
+  "assert(CH:send('from copy'))\n");
+ lua_close(C);
+ run(L,"original after copy",
+  "assert(P:submit(function () return 1 end):get() == 1)\n"
+  "assert(F:get() == 42)\n"
+  "assert(CH:receive() == 'from copy' and B:sub(1) == 'hello')\n"
+  "assert(CH:send(B))\n");
+ /* the original is closed first */
+ C=clone(L);
+ lua_close(L);
+ run(C,"copy after original",
+  "assert(F:ready() and F:get() == 42)\n"
+  "assert(CH:receive(false):sub(1) == 'hello' and B:sub(1) == 'hello')\n"
+  "collectgarbage()\n");
+ lua_close(C);
+ printf("workclone: OK\n");
+ return 0;
+}
@@ -288,7 +288,20 @@ LUA_API int lua_iscfunction (lua_State *L, int idx) {
 LUA_API int lua_isnumber (lua_State *L, int idx) {
   TValue n;
   const TValue *o = index2adr(L, idx);
-  return tonumber(o, &n);
+  int res;
+  lua_lock(L);  /* a long rope numeral is copied to `G(L)->buff' */
+  res = tonumber(L, o, &n);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** 是否为整数子类型的数值(不做字符串转换)
+ */
+LUA_API int lua_isinteger (lua_State *L, int idx) {
+  const TValue *o = index2adr(L, idx);
+  return ttisint(o);
 }
 
 
@@ -346,7 +359,11 @@ LUA_API int lua_lessthan (lua_State *L, int index1, int index2) {
 LUA_API lua_Number lua_tonumber (lua_State *L, int idx) {
   TValue n;
   const TValue *o = index2adr(L, idx);
-  if (tonumber(o, &n))
+  int isnum;
+  lua_lock(L);
+  isnum = tonumber(L, o, &n);
+  lua_unlock(L);
+  if (isnum)
     return nvalue(o);
   else
     return 0;
@@ -356,9 +373,16 @@ LUA_API lua_Number lua_tonumber (lua_State *L, int idx) {
 LUA_API lua_Integer lua_tointeger (lua_State *L, int idx) {
   TValue n;
   const TValue *o = index2adr(L, idx);
-  if (tonumber(o, &n)) {
+  int isnum;
+  lua_lock(L);
+  isnum = tonumber(L, o, &n);
+  lua_unlock(L);
+  if (isnum) {
     lua_Integer res;
-    lua_Number num = nvalue(o);
+    lua_Number num;
+    if (ttisint(o))
+      return cast(lua_Integer, ivalue(o));
+    num = nvalue(o);
     lua_number2integer(res, num);
     return res;
   }
@@ -393,6 +417,15 @@ LUA_API const char *lua_tolstring (lua_State *L, int idx, size_t *len) {
   }
   /* 直接读取字符串长度 */
   if (len != NULL) *len = tsvalue(o)->len;
+#if defined(LUA_ROPES)
+  if (isrope(rawtsvalue(o))) {
+    const char *s;
+    lua_lock(L);  /* `luaS_flatten' may copy the string */
+    s = luaS_flatten(L, rawtsvalue(o));
+    lua_unlock(L);
+    return s;
+  }
+#endif
   return svalue(o);
 }
 
@@ -467,6 +500,7 @@ LUA_API void lua_pushnil (lua_State *L) {
 
 LUA_API void lua_pushnumber (lua_State *L, lua_Number n) {
   lua_lock(L);
+  canonnan(n);
   setnvalue(L->top, n);
   api_incr_top(L);
   lua_unlock(L);
@@ -475,7 +509,7 @@ LUA_API void lua_pushnumber (lua_State *L, lua_Number n) {
 
 LUA_API void lua_pushinteger (lua_State *L, lua_Integer n) {
   lua_lock(L);
-  setnvalue(L->top, cast_num(n));
+  setivalue(L->top, n);
   api_incr_top(L);
   lua_unlock(L);
 }
@@ -1119,6 +1153,34 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       g->gcstepmul = data;
       break;
     }
+    case LUA_GCGEN: {  /* 切换到分代模式, `data`非0时设置新生代大小. 返回原模式 */
+      res = isgenerational(g) ? LUA_GCGEN : LUA_GCINC;
+      if (data != 0) g->genminormul = data;
+      luaC_changemode(L, KGC_GEN);
+      break;
+    }
+    case LUA_GCINC: {  /* 切换到增量模式. 返回原模式 */
+      res = isgenerational(g) ? LUA_GCGEN : LUA_GCINC;
+      luaC_changemode(L, KGC_NORMAL);
+      break;
+    }
+    case LUA_GCSETWORKERS: {  /* 设置并行标记的线程数. 返回原值 */
+      res = luaC_setworkers(L, data);
+      break;
+    }
+    case LUA_GCSETBGSWEEP: {  /* 开启/关闭后台清除. 返回原状态 */
+      res = luaC_setbgsweep(L, data);
+      break;
+    }
+    case LUA_GCSTEPTIME: {  /* 做最多`data`微秒的回收工作, 一轮回收结束时返回1 */
+      res = luaC_steptime(L, cast(lu_mem, data > 0 ? data : 0));
+      break;
+    }
+    case LUA_GCSETMAXPAUSE: {  /* 设置自动回收每一步的最长时间(微秒), 0表示不限. 返回原值 */
+      res = g->gcmaxpause;
+      g->gcmaxpause = (data > 0) ? data : 0;
+      break;
+    }
     default: res = -1;  /* `what`为非法选项 */ /* invalid option */
   }
   lua_unlock(L);
@@ -1126,6 +1188,43 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 }
 
 
+/*
+** 读取回收统计. `total`为0时返回上一个完整周期的统计, 否则返回累计值
+ */
+LUA_API void lua_gcstats (lua_State *L, int total, lua_GCStats *s) {
+  lua_lock(L);
+  *s = total ? G(L)->gctotal : G(L)->gclast;
+  lua_unlock(L);
+}
+
+
+
+/*
+** JIT compiler control
+*/
+
+/*
+** 控制当前线程是否使用JIT编译器. 新建的协程继承创建者的设置.
+** 返回操作之后的状态(1开启/0关闭); 编译时未开启LUA_USE_JIT则返回-1
+ */
+LUA_API int lua_jit (lua_State *L, int what) {
+  int res;
+  lua_lock(L);
+#if defined(LUA_USE_JIT)
+  switch (what) {
+    case LUA_JITOFF: L->jitmode = 0; break;
+    case LUA_JITON: L->jitmode = 1; break;
+    default: break;  /* LUA_JITSTATUS */
+  }
+  res = L->jitmode;
+#else
+  UNUSED(what);
+  res = -1;  /* not available */
+#endif
+  lua_unlock(L);
+  return res;
+}
+
 
 /*
 ** miscellaneous functions
@@ -1198,6 +1297,17 @@ LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
 }
 
 
+/*
+** 声明分配器在释放状态本身时回收该状态的所有内存. `lua_close`仍然
+** 调用所有的`__gc`元方法, 但不再逐个释放对象
+ */
+LUA_API void lua_setarena (lua_State *L, int on) {
+  lua_lock(L);
+  G(L)->arena = cast_byte(on != 0);
+  lua_unlock(L);
+}
+
+
 LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
   Udata *u;
   lua_lock(L);
@@ -1210,6 +1320,57 @@ LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
 }
 
 
+/*
+** 可增长的字节缓冲. 调用者持有一个引用并自己记录内容长度; 内容可以
+** 不复制就成为字符串(`lua_pushrope`), 之后缓冲的写入不影响这些字符串
+ */
+LUA_API char *lua_ropeprep (lua_State *L, lua_Rope **r, size_t len,
+                            size_t n) {
+  char *p;
+  lua_lock(L);
+  p = luaS_ropeprep(L, r, len, n);
+  lua_unlock(L);
+  return p;
+}
+
+
+LUA_API void lua_ropeadd (lua_Rope *r, size_t n) {
+  api_check(NULL, r->refs > 0 && r->size - r->used >= n);
+  r->used += n;
+  ropebytes(r)[r->used] = '\0';
+}
+
+
+LUA_API const char *lua_ropedata (lua_Rope *r) {
+  return (r == NULL) ? "" : ropebytes(r);
+}
+
+
+/*
+** 返回字符串的字节: 字符串在栈上时前`len`个字节不变, 但后面不一定是'\0'
+** (需要C字符串时用`lua_tolstring`)
+ */
+LUA_API const char *lua_pushrope (lua_State *L, lua_Rope *r, size_t len) {
+  TString *ts;
+  lua_lock(L);
+  api_check(L, len <= r->used);
+  luaC_checkGC(L);
+  ts = luaS_ropestr(L, r, len);
+  setsvalue2s(L, L->top, ts);
+  api_incr_top(L);
+  lua_unlock(L);
+  return getstr(ts);
+}
+
+
+LUA_API void lua_freerope (lua_State *L, lua_Rope *r) {
+  lua_lock(L);
+  if (r != NULL)
+    luaS_releaserope(L, r);
+  lua_unlock(L);
+}
+
+
 
 
 static const char *aux_upvalue (StkId fi, int n, TValue **val) {
@@ -664,3 +664,266 @@ LUALIB_API lua_State *luaL_newstate (void) {
   return L;
 }
 
+
+/*
+** 复制一个已经初始化好的状态(见`lua_clone`), 新状态使用默认的内存管理函数
+ */
+LUALIB_API lua_State *luaL_clonestate (lua_State *L) {
+  lua_State *L1 = lua_clone(L, l_alloc, NULL);
+  if (L1) lua_atpanic(L1, &panic);
+  return L1;
+}
+
+
+/*
+** 创建一个挂接共享段`S`的状态(见`lua_newsharedstate`)
+ */
+LUALIB_API lua_State *luaL_newsharedstate (lua_Shared *S) {
+  lua_State *L = lua_newsharedstate(l_alloc, NULL, S);
+  if (L) lua_atpanic(L, &panic);
+  return L;
+}
+
+
+
+/*
+** {======================================================
+** Size-class pooled allocator
+** =======================================================
+*/
+
+/*
+** 按大小分级的内存池. 不超过`LUAL_POOLMAX`的块按8字节对齐分级, 每级
+** 一个空闲链表; 新块从`LUAL_POOLCHUNK`大小的内存块中顺序切出. 释放的
+** 块只回到所属级别的空闲链表, 内存块在状态关闭时才归还系统. 更大的
+** 块用malloc分配并串在一个双链表中, 以便一次性释放.
+** 每个状态一个内存池, 没有加锁: 不能与后台清除(LUA_BGSWEEP)一起使用
+ */
+
+#define POOLALIGN	8
+#define NPOOLS		(LUAL_POOLMAX / POOLALIGN)
+
+#define poolclass(sz)	(((sz) + POOLALIGN - 1) / POOLALIGN - 1)
+#define classsize(c)	(((c) + 1) * POOLALIGN)
+
+
+typedef union PoolBlock {
+  union PoolBlock *next;  /* when free */
+  LUAI_USER_ALIGNMENT_T dummy;  /* ensures maximum alignment for blocks */
+} PoolBlock;
+
+
+typedef struct PoolChunk {
+  struct PoolChunk *next;
+  LUAI_USER_ALIGNMENT_T dummy;  /* ensures alignment of the chunk body */
+} PoolChunk;
+
+
+typedef union PoolLarge {  /* header of a block larger than LUAL_POOLMAX */
+  struct {
+    union PoolLarge *prev;
+    union PoolLarge *next;
+  } l;
+  LUAI_USER_ALIGNMENT_T dummy;  /* ensures maximum alignment for blocks */
+} PoolLarge;
+
+
+typedef struct Pool {
+  PoolBlock *free[NPOOLS];  /* free blocks of each size class */
+  PoolChunk *chunks;  /* all chunks, to release them at the end */
+  char *top;  /* next unused byte in the current chunk */
+  char *limit;  /* end of the current chunk */
+  PoolLarge large;  /* head of the list of large blocks */
+  void *state;  /* first block allocated: the state itself */
+  luaL_PoolStats stats;
+} Pool;
+
+
+static void pool_destroy (Pool *p) {
+  PoolChunk *c = p->chunks;
+  PoolLarge *lb = p->large.l.next;
+  while (c != NULL) {
+    PoolChunk *next = c->next;
+    free(c);
+    c = next;
+  }
+  while (lb != &p->large) {
+    PoolLarge *next = lb->l.next;
+    free(lb);
+    lb = next;
+  }
+  free(p);
+}
+
+
+static void *pool_get (Pool *p, size_t size) {
+  int c = poolclass(size);
+  PoolBlock *b = p->free[c];
+  size_t csize = classsize(c);
+  if (b != NULL) {  /* reuse a free block */
+    p->free[c] = b->next;
+    p->stats.pooled -= csize;
+  }
+  else {
+    if ((size_t)(p->limit - p->top) < csize) {  /* chunk exhausted? */
+      PoolChunk *ch = (PoolChunk *)malloc(LUAL_POOLCHUNK);
+      if (ch == NULL) return NULL;
+      ch->next = p->chunks;
+      p->chunks = ch;
+      p->stats.reserved += LUAL_POOLCHUNK;
+      /* (the tail of the old chunk is lost) */
+      p->top = (char *)(ch + 1);
+      p->limit = (char *)ch + LUAL_POOLCHUNK;
+    }
+    b = (PoolBlock *)p->top;
+    p->top += csize;
+  }
+  p->stats.nsmall++;
+  p->stats.inuse += csize;
+  return b;
+}
+
+
+static void pool_put (Pool *p, void *ptr, size_t size) {
+  int c = poolclass(size);
+  PoolBlock *b = (PoolBlock *)ptr;
+  b->next = p->free[c];
+  p->free[c] = b;
+  p->stats.nsmall--;
+  p->stats.inuse -= classsize(c);
+  p->stats.pooled += classsize(c);
+}
+
+
+static void large_link (Pool *p, PoolLarge *lb) {
+  lb->l.prev = &p->large;
+  lb->l.next = p->large.l.next;
+  lb->l.next->l.prev = lb;
+  p->large.l.next = lb;
+}
+
+
+static void large_unlink (PoolLarge *lb) {
+  lb->l.prev->l.next = lb->l.next;
+  lb->l.next->l.prev = lb->l.prev;
+}
+
+
+/* `ptr' is NULL for a new block; `nsize' is 0 to free `ptr' */
+static void *large_realloc (Pool *p, void *ptr, size_t osize, size_t nsize) {
+  PoolLarge *lb = (ptr == NULL) ? NULL : (PoolLarge *)ptr - 1;
+  if (lb != NULL) large_unlink(lb);
+  if (nsize == 0) {
+    free(lb);
+    p->stats.nlarge--;
+  }
+  else {
+    PoolLarge *nlb = (PoolLarge *)realloc(lb, sizeof(PoolLarge) + nsize);
+    if (nlb == NULL) {
+      if (lb != NULL) large_link(p, lb);
+      return NULL;
+    }
+    large_link(p, nlb);
+    if (lb == NULL) p->stats.nlarge++;
+    lb = nlb + 1;
+  }
+  p->stats.reserved += nsize - osize;
+  p->stats.inuse += nsize - osize;
+  return (nsize == 0) ? NULL : (void *)lb;
+}
+
+
+/*
+** `osize`为0的请求是新分配. 同一级别内的大小变化不需要移动数据.
+** 释放状态本身(第一个分配的块)时销毁整个内存池, 包括还没有释放的
+** 块(arena模式下`lua_close`不再逐个释放对象); 第一次分配就失败说明
+** 状态没有创建成功, 同样销毁
+ */
+static void *pool_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Pool *p = (Pool *)ud;
+  void *np;
+  if (ptr == NULL) osize = 0;
+  else if (nsize == 0 && ptr == p->state) {
+    pool_destroy(p);  /* the state is closed */
+    return NULL;
+  }
+  if (osize > LUAL_POOLMAX && nsize > LUAL_POOLMAX)  /* large to large */
+    np = large_realloc(p, ptr, osize, nsize);
+  else if (osize != 0 && nsize != 0 && poolclass(osize) == poolclass(nsize))
+    np = ptr;  /* same size class */
+  else {
+    if (nsize == 0)
+      np = NULL;
+    else if (nsize <= LUAL_POOLMAX)
+      np = pool_get(p, nsize);
+    else
+      np = large_realloc(p, NULL, 0, nsize);
+    if (np == NULL && nsize != 0) {
+      if (p->state == NULL)
+        pool_destroy(p);  /* could not even create the state */
+      return NULL;
+    }
+    if (osize != 0) {
+      if (np != NULL)
+        memcpy(np, ptr, (osize < nsize) ? osize : nsize);
+      if (osize <= LUAL_POOLMAX)
+        pool_put(p, ptr, osize);
+      else
+        large_realloc(p, ptr, osize, 0);
+    }
+  }
+  if (np == NULL && nsize != 0)
+    return NULL;
+  p->stats.requested += nsize - osize;
+  if (p->state == NULL) p->state = np;
+  return np;
+}
+
+
+static lua_State *newpoolstate (int arena) {
+  Pool *p = (Pool *)malloc(sizeof(Pool));
+  lua_State *L;
+  if (p == NULL) return NULL;
+  memset(p, 0, sizeof(Pool));
+  p->large.l.prev = p->large.l.next = &p->large;
+  L = lua_newstate(pool_alloc, p);  /* (frees `p' if it fails) */
+  if (L) {
+    lua_atpanic(L, &panic);
+    lua_gc(L, LUA_GCSETBGSWEEP, 0);  /* the pool has no locks */
+    lua_setarena(L, arena);
+  }
+  return L;
+}
+
+
+/*
+** 与`luaL_newstate`相同, 但使用按大小分级的内存池分配内存
+ */
+LUALIB_API lua_State *luaL_newpoolstate (void) {
+  return newpoolstate(0);
+}
+
+
+/*
+** 用完即弃的状态: 与`luaL_newpoolstate`相同, 但`lua_close`在调用
+** 完`__gc`元方法后一次性释放整个内存池, 不再逐个释放对象
+ */
+LUALIB_API lua_State *luaL_newarenastate (void) {
+  return newpoolstate(1);
+}
+
+
+/*
+** 读取内存池统计. `L`不使用内存池时返回0.
+** 碎片率可以由 1 - requested/reserved 估算
+ */
+LUALIB_API int luaL_poolstats (lua_State *L, luaL_PoolStats *s) {
+  void *ud;
+  if (lua_getallocf(L, &ud) != pool_alloc)
+    return 0;
+  *s = ((Pool *)ud)->stats;
+  return 1;
+}
+
+/* }====================================================== */
+
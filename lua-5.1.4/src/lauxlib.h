@@ -80,6 +80,23 @@ LUALIB_API int (luaL_loadbuffer) (lua_State *L, const char *buff, size_t sz,
 LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
+LUALIB_API lua_State *(luaL_clonestate) (lua_State *L);
+LUALIB_API lua_State *(luaL_newsharedstate) (lua_Shared *S);
+
+
+/* statistics of the allocator used by luaL_newpoolstate */
+typedef struct luaL_PoolStats {
+  size_t requested;  /* bytes requested by live blocks */
+  size_t inuse;  /* bytes of live blocks, rounded up to their size class */
+  size_t pooled;  /* bytes of free blocks kept in the pools for reuse */
+  size_t reserved;  /* bytes obtained from the system */
+  size_t nsmall;  /* live blocks served by the pools */
+  size_t nlarge;  /* live blocks served by realloc */
+} luaL_PoolStats;
+
+LUALIB_API lua_State *(luaL_newpoolstate) (void);
+LUALIB_API lua_State *(luaL_newarenastate) (void);
+LUALIB_API int (luaL_poolstats) (lua_State *L, luaL_PoolStats *s);
 
 
 LUALIB_API const char *(luaL_gsub) (lua_State *L, const char *s, const char *p,
@@ -54,6 +54,10 @@ static int luaB_tonumber (lua_State *L) {
   int base = luaL_optint(L, 2, 10);
   if (base == 10) {  /* standard conversion */
     luaL_checkany(L, 1);
+    if (lua_type(L, 1) == LUA_TNUMBER) {  /* keep integers as they are */
+      lua_settop(L, 1);
+      return 1;
+    }
     if (lua_isnumber(L, 1)) {
       lua_pushnumber(L, lua_tonumber(L, 1));
       return 1;
@@ -68,7 +72,10 @@ static int luaB_tonumber (lua_State *L) {
     if (s1 != s2) {  /* at least one valid digit? */
       while (isspace((unsigned char)(*s2))) s2++;  /* skip trailing spaces */
       if (*s2 == '\0') {  /* no invalid trailing characters? */
-        lua_pushnumber(L, (lua_Number)n);
+        if ((lua_Integer)n >= 0)  /* fits in an integer? */
+          lua_pushinteger(L, (lua_Integer)n);
+        else
+          lua_pushnumber(L, (lua_Number)n);
         return 1;
       }
     }
@@ -190,24 +197,70 @@ static int luaB_gcinfo (lua_State *L) {
 }
 
 
+/*
+** 把回收统计转换为表: 各阶段时间(微秒), 按类型名索引的标记/释放对象数
+ */
+static void pushgcstats (lua_State *L, int total) {
+  static const char *const phases[LUA_GCPHASES] = {"propagate", "atomic",
+    "sweepstring", "sweep", "finalize"};
+  lua_GCStats s;
+  int i;
+  lua_gcstats(L, total, &s);
+  lua_createtable(L, 0, LUA_GCPHASES + 5);
+  lua_pushnumber(L, (lua_Number)s.cycles);
+  lua_setfield(L, -2, "cycles");
+  for (i = 0; i < LUA_GCPHASES; i++) {
+    lua_pushnumber(L, s.phasetime[i]);
+    lua_setfield(L, -2, phases[i]);
+  }
+  lua_pushnumber(L, s.maxstep);
+  lua_setfield(L, -2, "maxstep");
+  lua_pushnumber(L, (lua_Number)s.traversed);
+  lua_setfield(L, -2, "traversed");
+  lua_createtable(L, 0, LUA_GCTYPES - LUA_TSTRING);
+  lua_createtable(L, 0, LUA_GCTYPES - LUA_TSTRING);
+  for (i = LUA_TSTRING; i < LUA_GCTYPES; i++) {
+    lua_pushnumber(L, (lua_Number)s.marked[i]);
+    lua_setfield(L, -3, lua_typename(L, i));
+    lua_pushnumber(L, (lua_Number)s.freed[i]);
+    lua_setfield(L, -2, lua_typename(L, i));
+  }
+  lua_setfield(L, -3, "freed");
+  lua_setfield(L, -2, "marked");
+}
+
+
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
-    "count", "step", "setpause", "setstepmul", NULL};
+    "count", "step", "setpause", "setstepmul", "generational",
+    "incremental", "setworkers", "setbgsweep", "steptime", "setmaxpause",
+    "stats", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
-    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL};
+    LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL, LUA_GCGEN,
+    LUA_GCINC, LUA_GCSETWORKERS, LUA_GCSETBGSWEEP, LUA_GCSTEPTIME,
+    LUA_GCSETMAXPAUSE, -1};
   int o = luaL_checkoption(L, 1, "collect", opts);
   int ex = luaL_optint(L, 2, 0);
-  int res = lua_gc(L, optsnum[o], ex);
+  int res;
+  if (optsnum[o] == -1) {  /* "stats": last cycle, or totals if `ex' != 0 */
+    pushgcstats(L, ex);
+    return 1;
+  }
+  res = lua_gc(L, optsnum[o], ex);
   switch (optsnum[o]) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
       lua_pushnumber(L, res + ((lua_Number)b/1024));
       return 1;
     }
-    case LUA_GCSTEP: {
+    case LUA_GCSTEP: case LUA_GCSTEPTIME: {
       lua_pushboolean(L, res);
       return 1;
     }
+    case LUA_GCGEN: case LUA_GCINC: {  /* previous mode */
+      lua_pushstring(L, (res == LUA_GCGEN) ? "generational" : "incremental");
+      return 1;
+    }
     default: {
       lua_pushnumber(L, res);
       return 1;
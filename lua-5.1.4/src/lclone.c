@@ -0,0 +1,382 @@
+/*
+** $Id: lclone.c $
+** Cloning of a whole Lua state
+** See Copyright Notice in lua.h
+*/
+
+/*
+** 复制整个状态: 从注册表, 全局表和基本类型的元表出发, 把源状态中
+** 可以到达的所有对象复制到一个新的独立状态中. 字符串在新状态中重新
+** 内部化, 函数原型连同其指令数组一起复制, 因此新状态不需要重新编译.
+** 源状态挂接了共享段(见lshared.c)时新状态挂接同一个段, 段内对象不复制.
+*/
+
+#include <string.h>
+
+#define lclone_c
+#define LUA_CORE
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+
+
+typedef struct CloneState {
+  lua_State *from;  /* main thread of the source state */
+  lua_State *L;  /* main thread of the new state */
+  GCObject **keys;  /* map from source objects to their copies */
+  GCObject **vals;  /* (in the same block as `keys') */
+  int sizemap;  /* (a power of 2) */
+  int nmap;
+  GCObject **work;  /* source objects whose copies are still empty */
+  int sizework;
+  int nwork;
+} CloneState;
+
+
+/*
+** {======================================================
+** Object map (open addressing, keyed by address)
+** =======================================================
+*/
+
+#define hashobj(cs,o) \
+	lmod(cast(unsigned int, cast(size_t, o) >> 3) * 2654435769u, (cs)->sizemap)
+
+
+static GCObject *lookup (CloneState *cs, GCObject *o) {
+  int i;
+  if (cs->sizemap == 0) return NULL;
+  for (i = hashobj(cs, o); cs->keys[i] != NULL; i = lmod(i + 1, cs->sizemap))
+    if (cs->keys[i] == o) return cs->vals[i];
+  return NULL;
+}
+
+
+static void rawinsert (CloneState *cs, GCObject *o, GCObject *c) {
+  int i = hashobj(cs, o);
+  while (cs->keys[i] != NULL)
+    i = lmod(i + 1, cs->sizemap);
+  cs->keys[i] = o;
+  cs->vals[i] = c;
+  cs->nmap++;
+}
+
+
+static void insert (CloneState *cs, GCObject *o, GCObject *c) {
+  if (4 * (cs->nmap + 1) > 3 * cs->sizemap) {  /* map too full? */
+    GCObject **okeys = cs->keys, **ovals = cs->vals;
+    int osize = cs->sizemap;
+    int size = (osize == 0) ? 256 : 2 * osize;
+    int i;
+    /* keys and values share one block */
+    cs->keys = luaM_newvector(cs->L, 2 * size, GCObject *);
+    cs->vals = cs->keys + size;
+    for (i = 0; i < size; i++) cs->keys[i] = NULL;
+    cs->sizemap = size;
+    cs->nmap = 0;
+    for (i = 0; i < osize; i++)
+      if (okeys[i] != NULL) rawinsert(cs, okeys[i], ovals[i]);
+    luaM_freearray(cs->L, okeys, 2 * osize, GCObject *);
+  }
+  rawinsert(cs, o, c);
+}
+
+/* }====================================================== */
+
+
+/* source objects are copied in two steps: an empty copy now, its
+   contents when the object is taken from the work list */
+static GCObject *cloneobj (CloneState *cs, GCObject *o);
+
+
+static void clonevalue (CloneState *cs, TValue *to, const TValue *v) {
+  if (iscollectable(v)) {
+    GCObject *c = cloneobj(cs, gcvalue(v));
+    setgcvalue(cs->L, to, c, ttype(v));
+  }
+  else
+    setobj(cs->L, to, v);
+}
+
+
+static TString *clonestr (CloneState *cs, TString *s) {
+  return (s == NULL) ? NULL : luaS_newlstr(cs->L, getstr(s), s->tsv.len);
+}
+
+
+static Table *clonetable (CloneState *cs, Table *h) {
+  return (h == NULL) ? NULL : gco2h(cloneobj(cs, obj2gco(h)));
+}
+
+
+/* number of entries outside the array part of `h' */
+static int hashsize (Table *h) {
+  int i, n = 0;
+#if defined(LUA_SHAPES)
+  if (isshaped(h)) return h->shape->nkeys;
+#endif
+  if (luaH_isdummy(h->node)) return 0;
+  for (i = 0; i < sizenode(h); i++)
+    if (!ttisnil(gval(gnode(h, i)))) n++;
+  return n;
+}
+
+
+static GCObject *cloneobj (CloneState *cs, GCObject *o) {
+  lua_State *L = cs->L;
+  Table *e = hvalue(gt(L));  /* placeholder environment */
+  GCObject *c;
+  switch (o->gch.tt) {
+    case LUA_TSTRING:  /* short strings are interned, not mapped */
+      if (isshortstr(rawgco2ts(o)))
+        return obj2gco(clonestr(cs, rawgco2ts(o)));
+      break;
+    case LUA_TTHREAD: {
+      if (o == obj2gco(cs->from))
+        return obj2gco(L);
+      luaG_runerror(L, "cannot clone a coroutine");
+      return NULL;  /* to avoid warnings */
+    }
+    case LUA_TPROTO: {  /* prototypes of the shared segment are not copied */
+      if (isshared(o)) return o;
+      break;
+    }
+    default: break;
+  }
+  c = lookup(cs, o);
+  if (c != NULL) return c;
+  switch (o->gch.tt) {
+    case LUA_TSTRING: {  /* a long string is copied once; nothing to fill */
+      c = obj2gco(clonestr(cs, rawgco2ts(o)));
+      insert(cs, o, c);
+      return c;
+    }
+    case LUA_TTABLE: {
+      Table *h = gco2h(o);
+      c = obj2gco(luaH_new(L, h->sizearray, hashsize(h)));
+      break;
+    }
+    case LUA_TFUNCTION: {
+      Closure *cl = gco2cl(o);
+      if (cl->c.isC) {
+        Closure *ncl = luaF_newCclosure(L, cl->c.nupvalues, e);
+        ncl->c.f = cl->c.f;
+        c = obj2gco(ncl);
+      }
+      else
+        c = obj2gco(luaF_newLclosure(L, cl->l.nupvalues, e));
+      break;
+    }
+    case LUA_TUSERDATA: {
+      Udata *u = rawgco2u(o);
+      Udata *nu = luaS_newudata(L, u->uv.len, e);
+      memcpy(nu + 1, u + 1, u->uv.len);
+      c = obj2gco(nu);
+      break;
+    }
+    case LUA_TPROTO: c = obj2gco(luaF_newproto(L)); break;
+    case LUA_TUPVAL: c = obj2gco(luaF_newupval(L)); break;
+    default: lua_assert(0); return NULL;
+  }
+  insert(cs, o, c);
+  if (cs->nwork >= cs->sizework)
+    luaM_growvector(L, cs->work, cs->nwork, cs->sizework, GCObject *,
+                    MAX_INT, "");
+  cs->work[cs->nwork++] = o;
+  return c;
+}
+
+
+static void fillproto (CloneState *cs, Proto *f, Proto *nf) {
+  lua_State *L = cs->L;
+  int i;
+  nf->code = luaM_newvector(L, f->sizecode, Instruction);
+  memcpy(nf->code, f->code, f->sizecode * sizeof(Instruction));
+  nf->sizecode = f->sizecode;
+  if (f->icache != NULL) {
+    nf->icache = luaM_newvector(L, f->sizecode, int);
+    memcpy(nf->icache, f->icache, f->sizecode * sizeof(int));
+  }
+  nf->lineinfo = luaM_newvector(L, f->sizelineinfo, int);
+  memcpy(nf->lineinfo, f->lineinfo, f->sizelineinfo * sizeof(int));
+  nf->sizelineinfo = f->sizelineinfo;
+  nf->k = luaM_newvector(L, f->sizek, TValue);
+  for (i = 0; i < f->sizek; i++) setnilvalue(&nf->k[i]);
+  nf->sizek = f->sizek;
+  for (i = 0; i < f->sizek; i++) clonevalue(cs, &nf->k[i], &f->k[i]);
+  nf->p = luaM_newvector(L, f->sizep, Proto *);
+  for (i = 0; i < f->sizep; i++) nf->p[i] = NULL;
+  nf->sizep = f->sizep;
+  for (i = 0; i < f->sizep; i++)
+    nf->p[i] = gco2p(cloneobj(cs, obj2gco(f->p[i])));
+  nf->locvars = luaM_newvector(L, f->sizelocvars, LocVar);
+  for (i = 0; i < f->sizelocvars; i++) nf->locvars[i].varname = NULL;
+  nf->sizelocvars = f->sizelocvars;
+  for (i = 0; i < f->sizelocvars; i++) {
+    nf->locvars[i].varname = clonestr(cs, f->locvars[i].varname);
+    nf->locvars[i].startpc = f->locvars[i].startpc;
+    nf->locvars[i].endpc = f->locvars[i].endpc;
+  }
+  nf->upvalues = luaM_newvector(L, f->sizeupvalues, TString *);
+  for (i = 0; i < f->sizeupvalues; i++) nf->upvalues[i] = NULL;
+  nf->sizeupvalues = f->sizeupvalues;
+  for (i = 0; i < f->sizeupvalues; i++)
+    nf->upvalues[i] = clonestr(cs, f->upvalues[i]);
+  nf->source = clonestr(cs, f->source);
+  nf->linedefined = f->linedefined;
+  nf->lastlinedefined = f->lastlinedefined;
+  nf->nups = f->nups;
+  nf->numparams = f->numparams;
+  nf->is_vararg = f->is_vararg;
+  nf->maxstacksize = f->maxstacksize;
+}
+
+
+/* copy the contents of `o' into its (empty) copy `c' */
+static void fill (CloneState *cs, GCObject *o, GCObject *c) {
+  lua_State *L = cs->L;
+  int i;
+  switch (o->gch.tt) {
+    case LUA_TTABLE: {
+      Table *h = gco2h(o), *t = gco2h(c);
+      TValue kv[2];  /* key and value, as `luaH_next' wants them */
+      t->metatable = clonetable(cs, h->metatable);
+      setnilvalue(&kv[0]);
+      while (luaH_next(cs->from, h, kv)) {
+        TValue k, v;
+        clonevalue(cs, &k, &kv[0]);
+        clonevalue(cs, &v, &kv[1]);
+        setobj2t(L, luaH_set(L, t, &k), &v);
+        luaC_barriert(L, t, &v);
+      }
+      t->flags = 0;  /* metamethod cache is not valid yet */
+      break;
+    }
+    case LUA_TFUNCTION: {
+      Closure *cl = gco2cl(o), *ncl = gco2cl(c);
+      ncl->c.env = clonetable(cs, cl->c.env);
+      if (cl->c.isC) {
+        for (i = 0; i < cl->c.nupvalues; i++)
+          clonevalue(cs, &ncl->c.upvalue[i], &cl->c.upvalue[i]);
+      }
+      else {
+        ncl->l.p = gco2p(cloneobj(cs, obj2gco(cl->l.p)));
+        for (i = 0; i < cl->l.nupvalues; i++)
+          ncl->l.upvals[i] = gco2uv(cloneobj(cs, obj2gco(cl->l.upvals[i])));
+      }
+      break;
+    }
+    case LUA_TUSERDATA: {
+      Udata *u = rawgco2u(o), *nu = rawgco2u(c);
+      nu->uv.metatable = clonetable(cs, u->uv.metatable);
+      nu->uv.env = clonetable(cs, u->uv.env);
+      break;
+    }
+    case LUA_TPROTO: fillproto(cs, gco2p(o), gco2p(c)); break;
+    case LUA_TUPVAL: {  /* open upvalues are copied closed */
+      clonevalue(cs, gco2uv(c)->v, gco2uv(o)->v);
+      break;
+    }
+    default: lua_assert(0);
+  }
+}
+
+
+/*
+** 给复制出的userdata一个机会修正自己的内容(例如不再拥有的文件句柄):
+** 元表中有`__clone`函数时以新的userdata为参数调用它
+ */
+static void callclonehooks (CloneState *cs) {
+  lua_State *L = cs->L;
+  TString *name = luaS_newliteral(L, "__clone");
+  int i;
+  for (i = 0; i < cs->sizemap; i++) {
+    GCObject *c;
+    if (cs->keys[i] == NULL) continue;
+    c = cs->vals[i];
+    if (c->gch.tt == LUA_TUSERDATA && rawgco2u(c)->uv.metatable != NULL) {
+      const TValue *hook = luaH_getstr(rawgco2u(c)->uv.metatable, name);
+      if (ttisfunction(hook)) {
+        luaD_checkstack(L, 2);
+        setobj2s(L, L->top, hook);
+        setuvalue(L, L->top + 1, c);
+        L->top += 2;
+        luaD_call(L, L->top - 2, 0);
+      }
+    }
+  }
+}
+
+
+static void f_clone (lua_State *L, void *ud) {
+  CloneState *cs = cast(CloneState *, ud);
+  global_State *g = G(L);
+  global_State *fg = G(cs->from);
+  Table *reg, *gtab;
+  int i;
+  g->GCthreshold = MAX_LUMEM;  /* copies are incomplete until the end */
+  if (g->strt.size < fg->strt.size)
+    luaS_resize(L, fg->strt.size);
+  reg = clonetable(cs, hvalue(registry(cs->from)));
+  sethvalue(L, registry(L), reg);
+  gtab = clonetable(cs, hvalue(gt(cs->from)));
+  sethvalue(L, gt(L), gtab);
+  for (i = 0; i < NUM_TAGS; i++)
+    g->mt[i] = clonetable(cs, fg->mt[i]);
+  while (cs->nwork > 0) {
+    GCObject *o = cs->work[--cs->nwork];
+    fill(cs, o, lookup(cs, o));
+  }
+  callclonehooks(cs);
+  L->jitmode = cs->from->jitmode;
+  g->gcpause = fg->gcpause;
+  g->gcstepmul = fg->gcstepmul;
+  g->gcmaxpause = fg->gcmaxpause;
+  g->genminormul = fg->genminormul;
+  g->estimate = g->totalbytes;
+  g->GCthreshold = (g->estimate/100) * g->gcpause;
+  if (fg->gckind != g->gckind)
+    luaC_changemode(L, fg->gckind);
+}
+
+
+/*
+** 复制`from`所在的整个状态到一个用`f`和`ud`分配内存的新状态.
+** 不能复制协程; 失败时返回NULL. 新状态与`from`挂接同一个共享段
+ */
+LUA_API lua_State *lua_clone (lua_State *from, lua_Alloc f, void *ud) {
+  lua_State *L = lua_newsharedstate(f, ud, G(from)->shared);
+  CloneState cs;
+  int status;
+  if (L == NULL) return NULL;
+  lua_lock(from);
+  lua_lock(L);  /* `__clone' metamethods run in the new state */
+  memset(&cs, 0, sizeof(cs));
+  cs.from = G(from)->mainthread;
+  cs.L = L;
+  status = luaD_rawrunprotected(L, f_clone, &cs);
+  lua_unlock(L);
+  lua_unlock(from);
+  if (status != 0) {  /* do not finalize incomplete copies */
+    int i;
+    for (i = 0; i < cs.sizemap; i++)
+      if (cs.keys[i] != NULL && cs.vals[i]->gch.tt == LUA_TUSERDATA)
+        rawgco2u(cs.vals[i])->uv.metatable = NULL;
+  }
+  luaM_freearray(L, cs.keys, 2 * cs.sizemap, GCObject *);
+  luaM_freearray(L, cs.work, cs.sizework, GCObject *);
+  if (status != 0) {
+    lua_close(L);
+    return NULL;
+  }
+  return L;
+}
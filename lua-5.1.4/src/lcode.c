@@ -28,10 +28,15 @@
 
 
 static int isnumeral(expdesc *e) {
-  return (e->k == VKNUM && e->t == NO_JUMP && e->f == NO_JUMP);
+  return ((e->k == VKNUM || e->k == VKINT) &&
+          e->t == NO_JUMP && e->f == NO_JUMP);
 }
 
 
+/* value of a numeral as a lua_Number */
+#define numeralval(e)	((e)->k == VKINT ? cast_num((e)->u.ival) : (e)->u.nval)
+
+
 void luaK_nil (FuncState *fs, int from, int n) {
   Instruction *previous;
   if (fs->pc > fs->lasttarget) {  /* no jumps to current position? */
@@ -71,6 +76,10 @@ void luaK_ret (FuncState *fs, int first, int nret) {
 }
 
 
+/*
+** 条件测试指令后总是紧跟一条JMP. 虚拟机执行测试指令时直接读取这条JMP的
+** 偏移量完成跳转, 本身已相当于"测试+JMP"超级指令, 无需另行合并
+ */
 static int condjump (FuncState *fs, OpCode op, int A, int B, int C) {
   luaK_codeABC(fs, op, A, B, C);
   return luaK_jump(fs);
@@ -234,15 +243,15 @@ static void freeexp (FuncState *fs, expdesc *e) {
 
 static int addk (FuncState *fs, TValue *k, TValue *v) {
   lua_State *L = fs->L;
-  TValue *idx = luaH_set(L, fs->h, k);
+  TValue *idx = luaH_set(L, ttisflt(k) ? fs->hf : fs->h, k);
   Proto *f = fs->f;
   int oldsize = f->sizek;
   if (ttisnumber(idx)) {
-    lua_assert(luaO_rawequalObj(&fs->f->k[cast_int(nvalue(idx))], v));
-    return cast_int(nvalue(idx));
+    lua_assert(luaO_rawequalObj(&fs->f->k[cast_int(ivalue(idx))], v));
+    return cast_int(ivalue(idx));
   }
   else {  /* constant not found; create a new entry */
-    setnvalue(idx, cast_num(fs->nk));
+    setivalue(idx, fs->nk);
     luaM_growvector(L, f->k, fs->nk, f->sizek, TValue,
                     MAXARG_Bx, "constant table overflow");
     while (oldsize < f->sizek) setnilvalue(&f->k[oldsize++]);
@@ -267,6 +276,13 @@ int luaK_numberK (FuncState *fs, lua_Number r) {
 }
 
 
+int luaK_intK (FuncState *fs, l_int i) {
+  TValue o;
+  setivalue(&o, i);
+  return addk(fs, &o, &o);
+}
+
+
 static int boolK (FuncState *fs, int b) {
   TValue o;
   setbvalue(&o, b);
@@ -370,6 +386,10 @@ static void discharge2reg (FuncState *fs, expdesc *e, int reg) {
       luaK_codeABx(fs, OP_LOADK, reg, luaK_numberK(fs, e->u.nval));
       break;
     }
+    case VKINT: {
+      luaK_codeABx(fs, OP_LOADK, reg, luaK_intK(fs, e->u.ival));
+      break;
+    }
     case VRELOCABLE: {
       /* 若表达式是需要重定位(VRELOCABLE类型), 则取出原指令, 修改对应的寄存器位置 */
       Instruction *pc = &getcode(fs, e);
@@ -460,12 +480,14 @@ int luaK_exp2RK (FuncState *fs, expdesc *e) {
   luaK_exp2val(fs, e);
   switch (e->k) {
     case VKNUM:
+    case VKINT:
     case VTRUE:
     case VFALSE:
     case VNIL: {
       if (fs->nk <= MAXINDEXRK) {  /* constant fit in RK operand? */
         e->u.s.info = (e->k == VNIL)  ? nilK(fs) :
                       (e->k == VKNUM) ? luaK_numberK(fs, e->u.nval) :
+                      (e->k == VKINT) ? luaK_intK(fs, e->u.ival) :
                                         boolK(fs, (e->k == VTRUE));
         e->k = VK;
         return RKASK(e->u.s.info);
@@ -558,7 +580,7 @@ void luaK_goiftrue (FuncState *fs, expdesc *e) {
   int pc;  /* pc of last jump */
   luaK_dischargevars(fs, e);
   switch (e->k) {
-    case VK: case VKNUM: case VTRUE: {
+    case VK: case VKNUM: case VKINT: case VTRUE: {
       pc = NO_JUMP;  /* always true; do nothing */
       break;
     }
@@ -616,7 +638,7 @@ static void codenot (FuncState *fs, expdesc *e) {
       e->k = VTRUE;
       break;
     }
-    case VK: case VKNUM: case VTRUE: {
+    case VK: case VKNUM: case VKINT: case VTRUE: {
       e->k = VFALSE;
       break;
     }
@@ -650,11 +672,35 @@ void luaK_indexed (FuncState *fs, expdesc *t, expdesc *k) {
 }
 
 
+/*
+** 两个整数常量按整数折叠(结果可表示为整数时), 否则按lua_Number折叠
+ */
+static int intfolding (OpCode op, l_int v1, l_int v2, l_int *r) {
+  switch (op) {
+    case OP_ADD: return luai_intadd(v1, v2, r);
+    case OP_SUB: return luai_intsub(v1, v2, r);
+    case OP_MUL: return luai_intmul(v1, v2, r);
+    case OP_MOD: return luai_intmod(v1, v2, r);
+    case OP_UNM:
+      if (v1 == LUAI_INTMIN) return 0;
+      *r = -v1;
+      return 1;
+    default: return 0;
+  }
+}
+
+
 static int constfolding (OpCode op, expdesc *e1, expdesc *e2) {
   lua_Number v1, v2, r;
+  l_int ir;
   if (!isnumeral(e1) || !isnumeral(e2)) return 0;
-  v1 = e1->u.nval;
-  v2 = e2->u.nval;
+  if (e1->k == VKINT && e2->k == VKINT &&
+      intfolding(op, e1->u.ival, e2->u.ival, &ir)) {
+    e1->u.ival = ir;
+    return 1;
+  }
+  v1 = numeralval(e1);
+  v2 = numeralval(e2);
   switch (op) {
     case OP_ADD: r = luai_numadd(v1, v2); break;
     case OP_SUB: r = luai_numsub(v1, v2); break;
@@ -671,6 +717,7 @@ static int constfolding (OpCode op, expdesc *e1, expdesc *e2) {
     default: lua_assert(0); r = 0; break;
   }
   if (luai_numisnan(r)) return 0;  /* do not attempt to produce NaN */
+  e1->k = VKNUM;
   e1->u.nval = r;
   return 1;
 }
@@ -714,7 +761,7 @@ static void codecomp (FuncState *fs, OpCode op, int cond, expdesc *e1,
 
 void luaK_prefix (FuncState *fs, UnOpr op, expdesc *e) {
   expdesc e2;
-  e2.t = e2.f = NO_JUMP; e2.k = VKNUM; e2.u.nval = 0;
+  e2.t = e2.f = NO_JUMP; e2.k = VKINT; e2.u.ival = 0;
   switch (op) {
     case OPR_MINUS: {
       if (!isnumeral(e))
@@ -858,3 +905,31 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+/*
+** 窥孔优化: 函数编译结束后把相邻的常见指令对合并为超级指令(只改写第一条
+** 的操作码, 参见lopcodes.h). 此时所有跳转都已确定, 也不会再有指令被改写
+** (例如CALL改为TAILCALL). OP_CLOSURE之后的伪指令和OP_SETLIST的额外参数
+** 不是真正的指令, 需要跳过.
+ */
+void luaK_fuse (FuncState *fs) {
+  Proto *f = fs->f;
+  int pc;
+  for (pc = 0; pc < fs->pc - 1; pc++) {
+    OpCode op = GET_OPCODE(f->code[pc]);
+    OpCode next = GET_OPCODE(f->code[pc+1]);
+    int j;
+    if (op == OP_CLOSURE)
+      pc += f->p[GETARG_Bx(f->code[pc])]->nups;  /* skip pseudo-instructions */
+    else if (op == OP_SETLIST && GETARG_C(f->code[pc]) == 0)
+      pc++;  /* skip extra argument */
+    else {
+      for (j = 0; j < NUM_FUSEDOPS; j++) {
+        if (luaP_fusedops[j][0] == op && luaP_fusedops[j][1] == next) {
+          SET_OPCODE(f->code[pc], OP_LOADKCALL + j);
+          break;
+        }
+      }
+    }
+  }
+}
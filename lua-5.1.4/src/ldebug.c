@@ -332,6 +332,11 @@ static Instruction symbexec (const Proto *pt, int lastpc, int reg) {
     int b = 0;
     int c = 0;
     check(op < NUM_OPCODES);
+    if (isfusedop(op)) {  /* superinstruction: check its second half */
+      check(pc+1 < pt->sizecode);
+      check(GET_OPCODE(pt->code[pc+1]) == fusedsecond(op));
+      op = fusedfirst(op);
+    }
     checkreg(pt, a);
     switch (getOpMode(op)) {
       case iABC: {
@@ -488,6 +493,11 @@ static Instruction symbexec (const Proto *pt, int lastpc, int reg) {
 
 
 int luaG_checkcode (const Proto *pt) {
+  int pc;
+  for (pc = 0; pc < pt->sizecode; pc++) {  /* quickened opcodes are runtime-only */
+    if (isquickop(GET_OPCODE(pt->code[pc])))
+      return 0;
+  }
   return (symbexec(pt, pt->sizecode, NO_REG) != 0);
 }
 
@@ -511,7 +521,7 @@ static const char *getobjname (lua_State *L, CallInfo *ci, int stackpos,
       return "local";
     i = symbexec(p, pc, stackpos);  /* try symbolic execution */
     lua_assert(pc != -1);
-    switch (GET_OPCODE(i)) {
+    switch (fusedfirst(GET_OPCODE(i))) {
       case OP_GETGLOBAL: {
         int g = GETARG_Bx(i);  /* global index */
         lua_assert(ttisstring(&p->k[g]));
@@ -593,7 +603,7 @@ void luaG_concaterror (lua_State *L, StkId p1, StkId p2) {
 
 void luaG_aritherror (lua_State *L, const TValue *p1, const TValue *p2) {
   TValue temp;
-  if (luaV_tonumber(p1, &temp) == NULL)
+  if (luaV_tonumber(L, p1, &temp) == NULL)
     p2 = p1;  /* first operand is wrong */
   luaG_typeerror(L, p2, "perform arithmetic on");
 }
@@ -12,6 +12,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -73,7 +74,27 @@ static void DumpString(const TString* s, DumpState* D)
  }
 }
 
-#define DumpCode(f,D)	 DumpVector(f->code,f->sizecode,sizeof(Instruction),D)
+/*
+** 写入指令列表. 运行期被快速化的指令还原为原指令后写出
+ */
+static void DumpCode(const Proto* f, DumpState* D)
+{
+ int i,n=f->sizecode;
+ for (i=0; i<n; i++)
+  if (isquickop(GET_OPCODE(f->code[i]))) break;
+ if (i==n)
+ {
+  DumpVector(f->code,n,sizeof(Instruction),D);
+  return;
+ }
+ DumpInt(n,D);
+ for (i=0; i<n; i++)
+ {
+  Instruction c=f->code[i];
+  SET_OPCODE(c,quickbase(GET_OPCODE(c)));
+  DumpVar(c,D);
+ }
+}
 
 static void DumpFunction(const Proto* f, const TString* p, DumpState* D);
 
@@ -84,8 +105,8 @@ static void DumpConstants(const Proto* f, DumpState* D)
  for (i=0; i<n; i++)
  {
   const TValue* o=&f->k[i];
-  DumpChar(ttype(o),D);
-  switch (ttype(o))
+  DumpChar(rawtt(o),D);
+  switch (rawtt(o))
   {
    case LUA_TNIL:
 	break;
@@ -95,6 +116,12 @@ static void DumpConstants(const Proto* f, DumpState* D)
    case LUA_TNUMBER:
 	DumpNumber(nvalue(o),D);
 	break;
+   case LUA_TNUMINT:
+	{
+	 l_int x=ivalue(o);
+	 DumpVar(x,D);
+	}
+	break;
    case LUA_TSTRING:
 	DumpString(rawtsvalue(o),D);
 	break;
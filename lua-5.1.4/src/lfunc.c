@@ -14,6 +14,7 @@
 
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -132,6 +133,10 @@ Proto *luaF_newproto (lua_State *L) {
   f->is_vararg = 0;
   f->maxstacksize = 0;
   f->lineinfo = NULL;
+  f->icache = NULL;
+  f->jit = NULL;
+  f->hotcount = 0;
+  f->icbase = 0;
   f->sizelocvars = 0;
   f->locvars = NULL;
   f->linedefined = 0;
@@ -141,6 +146,17 @@ Proto *luaF_newproto (lua_State *L) {
 }
 
 
+/*
+** 为原型分配内联缓存. 首次执行时才分配, 未执行过的函数不占用这部分内存
+ */
+void luaF_newicache (lua_State *L, Proto *f) {
+  int i;
+  int *ic = luaM_newvector(L, f->sizecode, int);
+  for (i=0; i<f->sizecode; i++) ic[i] = 0;
+  f->icache = ic;
+}
+
+
 /*
 ** 释放原型对象
  */
@@ -149,6 +165,10 @@ void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->p, f->sizep, Proto *);
   luaM_freearray(L, f->k, f->sizek, TValue);
   luaM_freearray(L, f->lineinfo, f->sizelineinfo, int);
+  if (f->icache)
+    luaM_freearray(L, f->icache, f->sizecode, int);
+  if (f->jit)
+    luaJ_free(L, f);
   luaM_freearray(L, f->locvars, f->sizelocvars, struct LocVar);
   luaM_freearray(L, f->upvalues, f->sizeupvalues, TString *);
   luaM_free(L, f);
@@ -5,6 +5,11 @@
 */
 
 #include <string.h>
+#include <time.h>
+
+#if defined(LUA_PARALLELGC) || defined(LUA_BGSWEEP)
+#include <pthread.h>
+#endif
 
 #define lgc_c
 #define LUA_CORE
@@ -27,17 +32,18 @@
 #define GCSWEEPMAX	40
 #define GCSWEEPCOST	10
 #define GCFINALIZECOST	100
+#define GCCLOCKWORK	1024u  /* work done between two reads of the clock */
+#define GCSTRTMOVE	64  /* buckets of `strt' migrated per step */
 
 
-#define maskmarks	cast_byte(~(bitmask(BLACKBIT)|WHITEBITS))
+#define maskmarks	cast_byte(~(bitmask(BLACKBIT)|WHITEBITS|bitmask(OLDBIT)))
 
 #define makewhite(g,x)	\
    ((x)->gch.marked = cast_byte(((x)->gch.marked & maskmarks) | luaC_white(g)))
 
 #define white2gray(x)	reset2bits((x)->gch.marked, WHITE0BIT, WHITE1BIT)
-#define black2gray(x)	resetbit((x)->gch.marked, BLACKBIT)
+#define black2gray(x)	resetmarks((x)->gch.marked, bitmask(BLACKBIT))
 
-#define stringmark(s)	reset2bits((s)->tsv.marked, WHITE0BIT, WHITE1BIT)
 
 
 #define isfinalized(u)		testbit((u)->marked, FINALIZEDBIT)
@@ -50,13 +56,193 @@
 
 
 #define markvalue(g,o) { checkconsistency(o); \
-  if (iscollectable(o) && iswhite(gcvalue(o))) reallymarkobject(g,gcvalue(o)); }
+  if (iscollectable(o) && (getmarked(gcvalue(o)->gch.marked) & WHITEBITS)) \
+    reallymarkobject(g,gcvalue(o)); }
 
-#define markobject(g,t) { if (iswhite(obj2gco(t))) \
+#define markobject(g,t) { if (getmarked(obj2gco(t)->gch.marked) & WHITEBITS) \
 		reallymarkobject(g, obj2gco(t)); }
 
 
-#define setthreshold(g)  (g->GCthreshold = (g->estimate/100) * g->gcpause)
+#if defined(LUA_PARALLELGC)
+
+/*
+** 并行标记. 每个标记线程有自己的灰色链表; 有线程空闲时, 忙碌的线程
+** 把自己的灰色链表分出一段放入共享池, 空闲的线程从中取走. 所有线程都
+** 空闲且共享池为空时标记结束. 对象由白变灰用CAS完成, 保证每个对象只被
+** 一个线程遍历; 此后只有该线程修改它的`marked`
+ */
+typedef struct GCMarker {
+  GCObject *gray;  /* 私有的灰色链表 */
+  GCObject *grayagain;  /* 本线程遍历过的线程对象 */
+  GCObject *weak;  /* 本线程找到的弱表 */
+  size_t traversed;
+  size_t marked[LUA_GCTYPES];  /* 本线程标记的对象数 */
+  global_State *g;
+  struct GCPool *pool;
+  pthread_t thread;
+} GCMarker;
+
+typedef struct GCPool {
+  pthread_mutex_t lock;
+  pthread_cond_t start;  /* 工作线程等待新的标记阶段 */
+  pthread_cond_t work;  /* 空闲的标记线程等待共享池 */
+  pthread_cond_t done;  /* 回收线程等待工作线程离开标记阶段 */
+  GCObject *shared;  /* 共享池 */
+  int hungry;  /* 空闲的标记线程数 */
+  int busy;  /* 还没离开标记阶段的工作线程数 */
+  unsigned int phase;  /* 标记阶段计数 */
+  int quit;
+  int n;  /* 标记线程数, 包括执行回收的线程(`markers[0]`) */
+  int size;  /* `markers`的大小 */
+  GCMarker markers[1];
+} GCPool;
+
+#define sizepool(n)	(sizeof(GCPool) + ((n)-1) * sizeof(GCMarker))
+
+/*
+** 遍历者之外的线程仍会读取`marked`并试图用CAS把白色对象变灰, 所以
+** 标记时对`marked`的读写都是原子的 (relaxed即可, 只需每次读写完整)
+*/
+#define getmarked(x)	__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define setmarks(x,m)	((void)__atomic_fetch_or(&(x), cast_byte(m), \
+				__ATOMIC_RELAXED))
+#define resetmarks(x,m)	((void)__atomic_fetch_and(&(x), cast_byte(~(m)), \
+				__ATOMIC_RELAXED))
+
+/* 当前线程的标记状态; 串行标记时为NULL */
+static __thread GCMarker *curmarker;
+
+#define inparallel()	(curmarker != NULL)
+#define graylist(g)	(*(curmarker ? &curmarker->gray : &(g)->gray))
+#define grayagainlist(g) \
+	(*(curmarker ? &curmarker->grayagain : &(g)->grayagain))
+#define weaklist(g)	(*(curmarker ? &curmarker->weak : &(g)->weak))
+#define claimgray(o)	(curmarker ? claimobject(o) : (white2gray(o), 1))
+
+#define countmarked(g,t) \
+	(curmarker ? curmarker->marked[t]++ : (g)->gcstats.marked[t]++)
+
+#define stringmark(g,s) { \
+  if ((__atomic_load_n(&(s)->tsv.marked, __ATOMIC_RELAXED) & WHITEBITS) && \
+      (__atomic_fetch_and(&(s)->tsv.marked, cast_byte(~WHITEBITS), \
+                          __ATOMIC_RELAXED) & WHITEBITS)) \
+    countmarked(g, LUA_TSTRING); }
+
+/* 原子地把白色对象变灰. 对象已被其他线程标记时返回0 */
+static int claimobject (GCObject *o) {
+  lu_byte m = __atomic_load_n(&o->gch.marked, __ATOMIC_RELAXED);
+  while (m & WHITEBITS) {
+    if (__atomic_compare_exchange_n(&o->gch.marked, &m,
+            cast_byte(m & ~WHITEBITS), 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return 1;
+  }
+  return 0;
+}
+
+#else
+
+#define getmarked(x)	(x)
+#define setmarks(x,m)	setbits(x, m)
+#define resetmarks(x,m)	resetbits(x, m)
+
+#define inparallel()	0
+#define graylist(g)	((g)->gray)
+#define grayagainlist(g)	((g)->grayagain)
+#define weaklist(g)	((g)->weak)
+#define claimgray(o)	(white2gray(o), 1)
+
+#define countmarked(g,t)	((g)->gcstats.marked[t]++)
+
+#define stringmark(g,s) { if (iswhite(obj2gco(s))) { \
+  reset2bits((s)->tsv.marked, WHITE0BIT, WHITE1BIT); \
+  countmarked(g, LUA_TSTRING); } }
+
+#endif
+
+
+/*
+** 下一次回收的阈值. 分代模式下程序再分配上次回收后内存用量的
+** `genminormul`%时做一次次要回收
+ */
+static void setthreshold (global_State *g) {
+  if (isgenerational(g)) {
+    lu_mem young = (g->estimate/100) * g->genminormul;
+    g->GCthreshold = g->totalbytes + (young > GCSTEPSIZE ? young : GCSTEPSIZE);
+  }
+  else
+    g->GCthreshold = (g->estimate/100) * g->gcpause;
+}
+
+
+/*
+** 单调时钟, 单位为微秒. 用于限制每一步回收的时间
+ */
+static lu_mem gcclock (void) {
+#if defined(LUA_USE_POSIX)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(lu_mem, ts.tv_sec) * 1000000 + cast(lu_mem, ts.tv_nsec / 1000);
+#else
+  return cast(lu_mem, cast(double, clock()) * 1e6 / CLOCKS_PER_SEC);
+#endif
+}
+
+
+/*
+** 回收统计. 只在每一步的开始和结束以及阶段切换时读取时钟
+ */
+static const lu_byte gcphase[] = {  /* `gcstate' -> phase index */
+  0, LUA_GCPPROPAGATE, LUA_GCPSWEEPSTRING, LUA_GCPSWEEP, LUA_GCPFINALIZE
+};
+
+
+static void beginstep (global_State *g) {
+  g->gcclockmark = g->gcstepstart = gcclock();
+}
+
+
+/* charge the time since the last mark to phase `p' */
+static lu_mem chargephase (global_State *g, int p) {
+  lu_mem now = gcclock();
+  g->gcstats.phasetime[p] += cast(double, now - g->gcclockmark);
+  g->gcclockmark = now;
+  return now;
+}
+
+
+static void updatemaxstep (global_State *g, lu_mem now) {
+  double step = cast(double, now - g->gcstepstart);
+  if (step > g->gcstats.maxstep)
+    g->gcstats.maxstep = step;
+}
+
+
+/* 一轮回收结束: 保存本轮统计并累加到总计 */
+static void endcycle (global_State *g, lu_mem now) {
+  lua_GCStats *s = &g->gcstats;
+  lua_GCStats *t = &g->gctotal;
+  int i;
+  updatemaxstep(g, now);
+  s->cycles = ++t->cycles;
+  for (i = 0; i < LUA_GCPHASES; i++)
+    t->phasetime[i] += s->phasetime[i];
+  for (i = 0; i < LUA_GCTYPES; i++) {
+    t->marked[i] += s->marked[i];
+    t->freed[i] += s->freed[i];
+  }
+  t->traversed += s->traversed;
+  if (s->maxstep > t->maxstep)
+    t->maxstep = s->maxstep;
+  g->gclast = *s;
+  memset(s, 0, sizeof(*s));
+}
+
+
+/* a step that ended inside a cycle charges its current phase */
+static void endstep (global_State *g) {
+  if (g->gcstate != GCSpause)
+    updatemaxstep(g, chargephase(g, gcphase[g->gcstate]));
+}
 
 
 static void removeentry (Node *n) {
@@ -67,8 +253,10 @@ static void removeentry (Node *n) {
 
 
 static void reallymarkobject (global_State *g, GCObject *o) {
-  lua_assert(iswhite(o) && !isdead(g, o));
-  white2gray(o);
+  lua_assert((inparallel() || iswhite(o)) && !isdead(g, o));
+  if (!claimgray(o))
+    return;  /* marked by another thread */
+  countmarked(g, o->gch.tt);
   switch (o->gch.tt) {
     case LUA_TSTRING: {
       return;
@@ -88,23 +276,23 @@ static void reallymarkobject (global_State *g, GCObject *o) {
       return;
     }
     case LUA_TFUNCTION: {
-      gco2cl(o)->c.gclist = g->gray;
-      g->gray = o;
+      gco2cl(o)->c.gclist = graylist(g);
+      graylist(g) = o;
       break;
     }
     case LUA_TTABLE: {
-      gco2h(o)->gclist = g->gray;
-      g->gray = o;
+      gco2h(o)->gclist = graylist(g);
+      graylist(g) = o;
       break;
     }
     case LUA_TTHREAD: {
-      gco2th(o)->gclist = g->gray;
-      g->gray = o;
+      gco2th(o)->gclist = graylist(g);
+      graylist(g) = o;
       break;
     }
     case LUA_TPROTO: {
-      gco2p(o)->gclist = g->gray;
-      g->gray = o;
+      gco2p(o)->gclist = graylist(g);
+      graylist(g) = o;
       break;
     }
     default: lua_assert(0);
@@ -131,6 +319,8 @@ size_t luaC_separateudata (lua_State *L, int all) {
   GCObject **p = &g->mainthread->next;
   GCObject *curr;
   while ((curr = *p) != NULL) {
+    if (isgenerational(g) && isold(curr) && !all)
+      break;  /* old udata are black: none of the rest is dead */
     if (!(iswhite(curr) || all) || isfinalized(gco2u(curr)))
       p = &curr->gch.next;  /* don't bother with them */
     else if (fasttm(L, gco2u(curr)->metatable, TM_GC) == NULL) {
@@ -155,6 +345,27 @@ size_t luaC_separateudata (lua_State *L, int all) {
 }
 
 
+#if defined(LUA_SHAPES)
+#define sizeslotsof(h) \
+	(isshaped(h) ? sizeof(TValue) * sizeslots((h)->shape->nkeys) : 0)
+
+/*
+** 形状的键在形状存在期间(即直到状态机关闭)保持存活. 每个形状只标记
+** 它新增的键, 其余的键由父形状标记
+ */
+static void markshapes (global_State *g) {
+  int i;
+  for (i = 0; i < g->sizeshapes; i++) {
+    Shape *s;
+    for (s = g->shapes[i]; s != NULL; s = s->hnext)
+      stringmark(g, lastkey(s));
+  }
+}
+#else
+#define sizeslotsof(h)	0
+#endif
+
+
 static int traversetable (global_State *g, Table *h) {
   int i;
   int weakkey = 0;
@@ -162,16 +373,21 @@ static int traversetable (global_State *g, Table *h) {
   const TValue *mode;
   if (h->metatable)
     markobject(g, h->metatable);
-  mode = gfasttm(g, h->metatable, TM_MODE);
+  if (inparallel())  /* must not write the `flags' cache of the metatable */
+    mode = (h->metatable == NULL) ? NULL :
+           luaH_getstr(h->metatable, g->tmname[TM_MODE]);
+  else
+    mode = gfasttm(g, h->metatable, TM_MODE);
   if (mode && ttisstring(mode)) {  /* is there a weak mode? */
-    weakkey = (strchr(svalue(mode), 'k') != NULL);
-    weakvalue = (strchr(svalue(mode), 'v') != NULL);
+    /* (a rope string may be followed by other bytes instead of '\0') */
+    weakkey = (memchr(svalue(mode), 'k', tsvalue(mode)->len) != NULL);
+    weakvalue = (memchr(svalue(mode), 'v', tsvalue(mode)->len) != NULL);
     if (weakkey || weakvalue) {  /* is really weak? */
-      h->marked &= ~(KEYWEAK | VALUEWEAK);  /* clear bits */
-      h->marked |= cast_byte((weakkey << KEYWEAKBIT) |
-                             (weakvalue << VALUEWEAKBIT));
-      h->gclist = g->weak;  /* must be cleared after GC, ... */
-      g->weak = obj2gco(h);  /* ... so put in the appropriate list */
+      resetmarks(h->marked, KEYWEAK | VALUEWEAK);  /* clear bits */
+      setmarks(h->marked, (weakkey << KEYWEAKBIT) |
+                          (weakvalue << VALUEWEAKBIT));
+      h->gclist = weaklist(g);  /* must be cleared after GC, ... */
+      weaklist(g) = obj2gco(h);  /* ... so put in the appropriate list */
     }
   }
   if (weakkey && weakvalue) return 1;
@@ -180,6 +396,16 @@ static int traversetable (global_State *g, Table *h) {
     while (i--)
       markvalue(g, &h->array[i]);
   }
+#if defined(LUA_SHAPES)
+  if (isshaped(h)) {  /* keys are marked with their shapes */
+    if (!weakvalue) {
+      i = h->shape->nkeys;
+      while (i--)
+        markvalue(g, &h->slots[i]);
+    }
+    return weakkey || weakvalue;
+  }
+#endif
   i = sizenode(h);
   while (i--) {
     Node *n = gnode(h, i);
@@ -202,12 +428,12 @@ static int traversetable (global_State *g, Table *h) {
 */
 static void traverseproto (global_State *g, Proto *f) {
   int i;
-  if (f->source) stringmark(f->source);
+  if (f->source) stringmark(g, f->source);
   for (i=0; i<f->sizek; i++)  /* mark literals */
     markvalue(g, &f->k[i]);
   for (i=0; i<f->sizeupvalues; i++) {  /* mark upvalue names */
     if (f->upvalues[i])
-      stringmark(f->upvalues[i]);
+      stringmark(g, f->upvalues[i]);
   }
   for (i=0; i<f->sizep; i++) {  /* mark nested protos */
     if (f->p[i])
@@ -215,7 +441,7 @@ static void traverseproto (global_State *g, Proto *f) {
   }
   for (i=0; i<f->sizelocvars; i++) {  /* mark local-variable names */
     if (f->locvars[i].varname)
-      stringmark(f->locvars[i].varname);
+      stringmark(g, f->locvars[i].varname);
   }
 }
 
@@ -253,20 +479,62 @@ static void checkstacksizes (lua_State *L, StkId max) {
 }
 
 
-static void traversestack (global_State *g, lua_State *l) {
-  StkId o, lim;
+static StkId stacklimit (lua_State *l) {
+  StkId lim = l->top;
   CallInfo *ci;
-  markvalue(g, gt(l));
-  lim = l->top;
   for (ci = l->base_ci; ci <= l->ci; ci++) {
     lua_assert(ci->top <= l->stack_last);
     if (lim < ci->top) lim = ci->top;
   }
+  return lim;
+}
+
+
+static void traversestack (global_State *g, lua_State *l) {
+  StkId o, lim;
+  markvalue(g, gt(l));
+  lim = stacklimit(l);
   for (o = l->stack; o < l->top; o++)
     markvalue(g, o);
   for (; o <= lim; o++)
     setnilvalue(o);
-  checkstacksizes(l, lim);
+  if (!inparallel())  /* marking threads cannot reallocate; see `markparallel' */
+    checkstacksizes(l, lim);
+}
+
+
+/* (approximate) memory used by an object */
+static lu_mem objsize (GCObject *o) {
+  switch (o->gch.tt) {
+    case LUA_TSTRING: return sizestring(gco2ts(o));
+    case LUA_TUSERDATA: return sizeudata(gco2u(o));
+    case LUA_TUPVAL: return sizeof(UpVal);
+    case LUA_TTABLE: {
+      Table *h = gco2h(o);
+      return sizeof(Table) + sizeof(TValue) * h->sizearray + sizeslotsof(h) +
+             (luaH_isdummy(h->node) ? 0 : sizeof(Node) * sizenode(h));
+    }
+    case LUA_TFUNCTION: {
+      Closure *cl = gco2cl(o);
+      return (cl->c.isC) ? sizeCclosure(cl->c.nupvalues) :
+                           sizeLclosure(cl->l.nupvalues);
+    }
+    case LUA_TTHREAD: {
+      lua_State *th = gco2th(o);
+      return sizeof(lua_State) + sizeof(TValue) * th->stacksize +
+                                 sizeof(CallInfo) * th->size_ci;
+    }
+    case LUA_TPROTO: {
+      Proto *p = gco2p(o);
+      return sizeof(Proto) + sizeof(Instruction) * p->sizecode +
+                             sizeof(Proto *) * p->sizep +
+                             sizeof(TValue) * p->sizek + 
+                             sizeof(int) * p->sizelineinfo +
+                             sizeof(LocVar) * p->sizelocvars +
+                             sizeof(TString *) * p->sizeupvalues;
+    }
+    default: lua_assert(0); return 0;
+  }
 }
 
 
@@ -275,54 +543,253 @@ static void traversestack (global_State *g, lua_State *l) {
 ** Returns `quantity' traversed.
 */
 static l_mem propagatemark (global_State *g) {
-  GCObject *o = g->gray;
+  GCObject *o = graylist(g);
   lua_assert(isgray(o));
   gray2black(o);
   switch (o->gch.tt) {
     case LUA_TTABLE: {
       Table *h = gco2h(o);
-      g->gray = h->gclist;
+      graylist(g) = h->gclist;
       if (traversetable(g, h))  /* table is weak? */
         black2gray(o);  /* keep it gray */
-      return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                             sizeof(Node) * sizenode(h);
+      return objsize(o);
     }
     case LUA_TFUNCTION: {
       Closure *cl = gco2cl(o);
-      g->gray = cl->c.gclist;
+      graylist(g) = cl->c.gclist;
       traverseclosure(g, cl);
-      return (cl->c.isC) ? sizeCclosure(cl->c.nupvalues) :
-                           sizeLclosure(cl->l.nupvalues);
+      return objsize(o);
     }
     case LUA_TTHREAD: {
       lua_State *th = gco2th(o);
-      g->gray = th->gclist;
-      th->gclist = g->grayagain;
-      g->grayagain = o;
+      graylist(g) = th->gclist;
+      th->gclist = grayagainlist(g);
+      grayagainlist(g) = o;
       black2gray(o);
       traversestack(g, th);
-      return sizeof(lua_State) + sizeof(TValue) * th->stacksize +
-                                 sizeof(CallInfo) * th->size_ci;
+      return objsize(o);
     }
     case LUA_TPROTO: {
       Proto *p = gco2p(o);
-      g->gray = p->gclist;
+      graylist(g) = p->gclist;
       traverseproto(g, p);
-      return sizeof(Proto) + sizeof(Instruction) * p->sizecode +
-                             sizeof(Proto *) * p->sizep +
-                             sizeof(TValue) * p->sizek + 
-                             sizeof(int) * p->sizelineinfo +
-                             sizeof(LocVar) * p->sizelocvars +
-                             sizeof(TString *) * p->sizeupvalues;
+      return objsize(o);
     }
     default: lua_assert(0); return 0;
   }
 }
 
 
+#if defined(LUA_PARALLELGC)
+
+#define GCKEEP	16  /* gray objects a marker keeps when sharing its list */
+
+static GCObject **gclistof (GCObject *o) {
+  switch (o->gch.tt) {
+    case LUA_TTABLE: return &gco2h(o)->gclist;
+    case LUA_TFUNCTION: return &gco2cl(o)->c.gclist;
+    case LUA_TTHREAD: return &gco2th(o)->gclist;
+    case LUA_TPROTO: return &gco2p(o)->gclist;
+    default: lua_assert(0); return NULL;
+  }
+}
+
+
+/* link list `l' in front of list `rest' */
+static GCObject *appendlist (GCObject *l, GCObject *rest) {
+  GCObject *o;
+  if (l == NULL) return rest;
+  for (o = l; *gclistof(o) != NULL; o = *gclistof(o)) ;
+  *gclistof(o) = rest;
+  return l;
+}
+
+
+/* 保留灰色链表的前`GCKEEP`个对象, 其余的放入共享池 */
+static void sharegray (GCPool *p, GCMarker *m) {
+  GCObject *o = m->gray;
+  int i;
+  for (i = 1; i < GCKEEP; i++) {
+    o = *gclistof(o);
+    if (o == NULL) return;  /* too few to share */
+  }
+  if (*gclistof(o) == NULL) return;
+  pthread_mutex_lock(&p->lock);
+  if (p->shared == NULL) {
+    p->shared = *gclistof(o);
+    *gclistof(o) = NULL;
+    pthread_cond_signal(&p->work);
+  }
+  pthread_mutex_unlock(&p->lock);
+}
+
+
+static void markloop (GCPool *p, GCMarker *m) {
+  global_State *g = m->g;
+  curmarker = m;
+  for (;;) {
+    while (m->gray) {
+      m->traversed += propagatemark(g);
+      if (m->gray && __atomic_load_n(&p->hungry, __ATOMIC_RELAXED) > 0)
+        sharegray(p, m);
+    }
+    pthread_mutex_lock(&p->lock);
+    __atomic_add_fetch(&p->hungry, 1, __ATOMIC_RELAXED);
+    while (p->shared == NULL && p->hungry < p->n)
+      pthread_cond_wait(&p->work, &p->lock);
+    if (p->shared == NULL) {  /* everybody is idle: marking is over */
+      pthread_cond_broadcast(&p->work);
+      pthread_mutex_unlock(&p->lock);
+      break;
+    }
+    m->gray = p->shared;  /* take the shared objects */
+    p->shared = NULL;
+    __atomic_sub_fetch(&p->hungry, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&p->lock);
+  }
+  curmarker = NULL;
+}
+
+
+static void *markerthread (void *ud) {
+  GCMarker *m = cast(GCMarker *, ud);
+  GCPool *p = m->pool;
+  unsigned int phase = 0;
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (p->phase == phase && !p->quit)
+      pthread_cond_wait(&p->start, &p->lock);
+    if (p->quit) break;
+    phase = p->phase;
+    pthread_mutex_unlock(&p->lock);
+    markloop(p, m);
+    pthread_mutex_lock(&p->lock);
+    if (--p->busy == 0)
+      pthread_cond_signal(&p->done);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+
+/*
+** 用线程池并行标记`g->gray`中的对象. 其余的虚拟机处于暂停状态.
+** 结束后把各线程的`grayagain`与`weak`合并到全局链表, 并收缩遍历过的
+** 线程的栈(标记线程不能重新分配内存)
+ */
+static size_t markparallel (global_State *g) {
+  GCPool *p = g->gcpool;
+  size_t traversed = 0;
+  int i;
+  for (i = 0; i < p->n; i++) {
+    GCMarker *m = &p->markers[i];
+    m->gray = m->grayagain = m->weak = NULL;
+    m->traversed = 0;
+    memset(m->marked, 0, sizeof(m->marked));
+  }
+  p->markers[0].gray = g->gray;
+  g->gray = NULL;
+  pthread_mutex_lock(&p->lock);
+  p->shared = NULL;
+  p->hungry = 0;
+  p->busy = p->n - 1;
+  p->phase++;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+  markloop(p, &p->markers[0]);
+  pthread_mutex_lock(&p->lock);
+  while (p->busy > 0)
+    pthread_cond_wait(&p->done, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+  for (i = 0; i < p->n; i++) {
+    GCMarker *m = &p->markers[i];
+    GCObject *o;
+    int t;
+    traversed += m->traversed;
+    for (t = 0; t < LUA_GCTYPES; t++)
+      g->gcstats.marked[t] += m->marked[t];
+    for (o = m->grayagain; o != NULL; o = gco2th(o)->gclist)
+      checkstacksizes(gco2th(o), stacklimit(gco2th(o)));
+    g->grayagain = appendlist(m->grayagain, g->grayagain);
+    g->weak = appendlist(m->weak, g->weak);
+  }
+  return traversed;
+}
+
+
+static void stopworkers (lua_State *L) {
+  global_State *g = G(L);
+  GCPool *p = g->gcpool;
+  int i;
+  g->gcpool = NULL;
+  pthread_mutex_lock(&p->lock);
+  p->quit = 1;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+  for (i = 1; i < p->n; i++)
+    pthread_join(p->markers[i].thread, NULL);
+  pthread_cond_destroy(&p->done);
+  pthread_cond_destroy(&p->work);
+  pthread_cond_destroy(&p->start);
+  pthread_mutex_destroy(&p->lock);
+  luaM_freemem(L, p, sizepool(p->size));
+}
+
+
+/*
+** 设置标记线程数(包括执行回收的线程). `n`小于1时只返回当前值.
+** 不能创建足够的线程时使用已创建的那些
+ */
+int luaC_setworkers (lua_State *L, int n) {
+  global_State *g = G(L);
+  GCPool *p = g->gcpool;
+  int old = p ? p->n : 1;
+  if (n < 1 || n == old) return old;
+  if (p) stopworkers(L);
+  if (n > 1) {
+    int i;
+    p = cast(GCPool *, luaM_malloc(L, sizepool(n)));
+    memset(p, 0, sizepool(n));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+    p->size = n;
+    for (i = 0; i < n; i++) {
+      p->markers[i].g = g;
+      p->markers[i].pool = p;
+    }
+    for (i = 1; i < n; i++) {
+      if (pthread_create(&p->markers[i].thread, NULL, markerthread,
+                         &p->markers[i]) != 0)
+        break;
+    }
+    p->n = i;
+    g->gcpool = p;
+    if (p->n == 1) stopworkers(L);  /* no thread at all */
+  }
+  return old;
+}
+
+#else
+
+int luaC_setworkers (lua_State *L, int n) {
+  UNUSED(L); UNUSED(n);
+  return 1;
+}
+
+#endif
+
+
 static size_t propagateall (global_State *g) {
   size_t m = 0;
+#if defined(LUA_PARALLELGC)
+  if (g->gcpool && g->gray)
+    m = markparallel(g);
+  else
+#endif
   while (g->gray) m += propagatemark(g);
+  g->gcstats.traversed += m;
   return m;
 }
 
@@ -334,10 +801,10 @@ static size_t propagateall (global_State *g) {
 ** other objects: if really collected, cannot keep them; for userdata
 ** being finalized, keep them in keys, but not in values
 */
-static int iscleared (const TValue *o, int iskey) {
+static int iscleared (global_State *g, const TValue *o, int iskey) {
   if (!iscollectable(o)) return 0;
   if (ttisstring(o)) {
-    stringmark(rawtsvalue(o));  /* strings are `values', so are never weak */
+    stringmark(g, rawtsvalue(o));  /* strings are `values', so are never weak */
     return 0;
   }
   return iswhite(gcvalue(o)) ||
@@ -348,7 +815,7 @@ static int iscleared (const TValue *o, int iskey) {
 /*
 ** clear collected entries from weaktables
 */
-static void cleartable (GCObject *l) {
+static void cleartable (global_State *g, GCObject *l) {
   while (l) {
     Table *h = gco2h(l);
     int i = h->sizearray;
@@ -357,7 +824,7 @@ static void cleartable (GCObject *l) {
     if (testbit(h->marked, VALUEWEAKBIT)) {
       while (i--) {
         TValue *o = &h->array[i];
-        if (iscleared(o, 0))  /* value was collected? */
+        if (iscleared(g, o, 0))  /* value was collected? */
           setnilvalue(o);  /* remove value */
       }
     }
@@ -365,11 +832,21 @@ static void cleartable (GCObject *l) {
     while (i--) {
       Node *n = gnode(h, i);
       if (!ttisnil(gval(n)) &&  /* non-empty entry? */
-          (iscleared(key2tval(n), 1) || iscleared(gval(n), 0))) {
+          (iscleared(g, key2tval(n), 1) || iscleared(g, gval(n), 0))) {
         setnilvalue(gval(n));  /* remove value ... */
         removeentry(n);  /* remove entry from table */
       }
     }
+#if defined(LUA_SHAPES)
+    if (isshaped(h) && testbit(h->marked, VALUEWEAKBIT)) {
+      i = h->shape->nkeys;
+      while (i--) {  /* shape keys are strings: only values may go */
+        TValue *o = &h->slots[i];
+        if (iscleared(g, o, 0))
+          setnilvalue(o);
+      }
+    }
+#endif
     l = h->gclist;
   }
 }
@@ -387,7 +864,10 @@ static void freeobj (lua_State *L, GCObject *o) {
       break;
     }
     case LUA_TSTRING: {
-      G(L)->strt.nuse--;
+      if (isshortstr(rawgco2ts(o)))  /* long strings are not in `strt' */
+        G(L)->strt.nuse--;
+      else if (isrope(rawgco2ts(o)))
+        luaS_freerope(L, rawgco2ts(o));  /* drop its reference to the buffer */
       luaM_freemem(L, o, sizestring(gco2ts(o)));
       break;
     }
@@ -404,27 +884,230 @@ static void freeobj (lua_State *L, GCObject *o) {
 #define sweepwholelist(L,p)	sweeplist(L,p,MAX_LUMEM)
 
 
+#if defined(LUA_BGSWEEP)
+
+/*
+** 后台清除. 清除阶段只把死对象从链表中摘下(同时从`estimate`中扣除它们
+** 的大小), 交给后台线程释放. 后台线程通过一个影子状态机调用普通的释放
+** 函数, 释放的字节数记在影子状态机中, 由回收线程在`luaC_step`等处从
+** `totalbytes`中扣除. 线程对象和打开的upvalue会修改全局链表, 仍由回收
+** 线程直接释放
+ */
+typedef struct GCSweeper {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;  /* 后台线程等待死对象 */
+  pthread_cond_t idle;  /* 回收线程等待后台线程释放完所有对象 */
+  GCObject *pending;  /* 等待释放的对象, 以`next`链接 */
+  lua_Alloc frealloc;  /* 释放`pending`用的内存管理函数 */
+  void *ud;
+  lu_mem freed;  /* 已释放但还没从`totalbytes`中扣除的字节数 */
+  lu_mem backlog;  /* 还没释放的对象的大小(按`objsize`计) */
+  int busy;
+  int quit;
+  pthread_t thread;
+  global_State shadowg;  /* 只用于`frealloc`和内存计数 */
+  lua_State shadowL;
+} GCSweeper;
+
+
+static void *sweeperthread (void *ud) {
+  GCSweeper *sw = cast(GCSweeper *, ud);
+  lua_State *L = &sw->shadowL;
+  pthread_mutex_lock(&sw->lock);
+  for (;;) {
+    GCObject *o;
+    lu_mem before, size;
+    while (sw->pending == NULL && !sw->quit)
+      pthread_cond_wait(&sw->wake, &sw->lock);
+    if (sw->pending == NULL) break;  /* quit */
+    o = sw->pending;
+    sw->pending = NULL;
+    sw->busy = 1;
+    sw->shadowg.frealloc = sw->frealloc;
+    sw->shadowg.ud = sw->ud;
+    pthread_mutex_unlock(&sw->lock);
+    before = sw->shadowg.totalbytes;
+    size = 0;
+    while (o != NULL) {
+      GCObject *next = o->gch.next;
+      size += objsize(o);
+      freeobj(L, o);
+      o = next;
+    }
+    pthread_mutex_lock(&sw->lock);
+    sw->freed += before - sw->shadowg.totalbytes;
+    __atomic_sub_fetch(&sw->backlog, size, __ATOMIC_RELAXED);
+    sw->busy = 0;
+    if (sw->pending == NULL)
+      pthread_cond_broadcast(&sw->idle);
+  }
+  pthread_mutex_unlock(&sw->lock);
+  return NULL;
+}
+
+
+/*
+** 后台线程落后超过存活内存的一半时, 回收线程自己释放死对象, 以限制
+** 等待释放的内存
+ */
+#define sweeperbehind(g) \
+  (__atomic_load_n(&(g)->sweeper->backlog, __ATOMIC_RELAXED) > (g)->estimate/2)
+
+
+/* can `o' be freed by the sweeper thread? */
+static int freelater (GCObject *o) {
+  switch (o->gch.tt) {
+    case LUA_TTHREAD: return 0;
+    case LUA_TUPVAL: return gco2uv(o)->v == &gco2uv(o)->u.value;  /* closed? */
+    case LUA_TSTRING: return !isrope(rawgco2ts(o));  /* buffers are shared */
+    default: return 1;
+  }
+}
+
+
+static void handoff (global_State *g, GCObject *dead, GCObject **tail,
+                     lu_mem size) {
+  GCSweeper *sw = g->sweeper;
+  pthread_mutex_lock(&sw->lock);
+  __atomic_add_fetch(&sw->backlog, size, __ATOMIC_RELAXED);
+  *tail = sw->pending;
+  sw->pending = dead;
+  sw->frealloc = g->frealloc;
+  sw->ud = g->ud;
+  pthread_cond_signal(&sw->wake);
+  pthread_mutex_unlock(&sw->lock);
+}
+
+
+/* 扣除后台线程已释放的内存. `wait`非0时先等待它释放完所有对象 */
+static void collectfreed (global_State *g, int wait) {
+  GCSweeper *sw = g->sweeper;
+  lu_mem freed;
+  pthread_mutex_lock(&sw->lock);
+  if (wait) {
+    while (sw->pending != NULL || sw->busy)
+      pthread_cond_wait(&sw->idle, &sw->lock);
+  }
+  freed = sw->freed;
+  sw->freed = 0;
+  pthread_mutex_unlock(&sw->lock);
+  if (freed == 0) return;
+  lua_assert(g->totalbytes >= freed);
+  g->totalbytes -= freed;
+  if (g->estimate > g->totalbytes)  /* `objsize' is approximate */
+    g->estimate = g->totalbytes;
+  if (g->gcstate != GCSpause || isgenerational(g))  /* relative threshold? */
+    g->GCthreshold = (g->GCthreshold > freed) ? g->GCthreshold - freed : 0;
+}
+
+
+/*
+** 开启或关闭后台清除, 返回原来的状态. 关闭时等待后台线程释放完所有
+** 对象. 不能创建线程时不开启
+ */
+int luaC_setbgsweep (lua_State *L, int on) {
+  global_State *g = G(L);
+  GCSweeper *sw = g->sweeper;
+  int old = (sw != NULL);
+  if (on && !sw) {
+    sw = luaM_new(L, GCSweeper);
+    memset(sw, 0, sizeof(GCSweeper));
+    sw->shadowL.l_G = &sw->shadowg;
+    pthread_mutex_init(&sw->lock, NULL);
+    pthread_cond_init(&sw->wake, NULL);
+    pthread_cond_init(&sw->idle, NULL);
+    if (pthread_create(&sw->thread, NULL, sweeperthread, sw) == 0)
+      g->sweeper = sw;
+    else
+      on = 0;
+  }
+  if (!on && sw) {
+    if (g->sweeper) {
+      collectfreed(g, 1);
+      pthread_mutex_lock(&sw->lock);
+      sw->quit = 1;
+      pthread_cond_signal(&sw->wake);
+      pthread_mutex_unlock(&sw->lock);
+      pthread_join(sw->thread, NULL);
+      g->sweeper = NULL;
+    }
+    pthread_cond_destroy(&sw->idle);
+    pthread_cond_destroy(&sw->wake);
+    pthread_mutex_destroy(&sw->lock);
+    luaM_free(L, sw);
+  }
+  return old;
+}
+
+#else
+
+int luaC_setbgsweep (lua_State *L, int on) {
+  UNUSED(L); UNUSED(on);
+  return 0;
+}
+
+#endif
+
+
+/*
+** 清除链表中的死对象, 返回继续清除的位置, 链表结束时返回NULL.
+** 新对象总是插入在链表头部, 所以分代模式下遇到第一个老对象就可以
+** 停止: 之后都是老对象, 次要回收不会回收它们. 存活的对象变老并保持
+** 原来的颜色
+ */
 static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
   GCObject *curr;
   global_State *g = G(L);
   int deadmask = otherwhite(g);
+  int gen = isgenerational(g);
+#if defined(LUA_BGSWEEP)
+  GCObject *dead = NULL;  /* objects left to the sweeper thread */
+  GCObject **deadtail = &dead;
+  lu_mem deadsize = 0;
+  int later = (g->sweeper != NULL && !sweeperbehind(g));
+#endif
   while ((curr = *p) != NULL && count-- > 0) {
+    if (gen && isold(curr)) {
+      p = NULL;  /* the rest of the list is old */
+      break;
+    }
     if (curr->gch.tt == LUA_TTHREAD)  /* sweep open upvalues of each thread */
       sweepwholelist(L, &gco2th(curr)->openupval);
     if ((curr->gch.marked ^ WHITEBITS) & deadmask) {  /* not dead? */
       lua_assert(!isdead(g, curr) || testbit(curr->gch.marked, FIXEDBIT));
-      makewhite(g, curr);  /* make it white (for next cycle) */
+      if (gen)
+        l_setbit(curr->gch.marked, OLDBIT);  /* survived: now it is old */
+      else
+        makewhite(g, curr);  /* make it white (for next cycle) */
       p = &curr->gch.next;
     }
     else {  /* must erase `curr' */
       lua_assert(isdead(g, curr) || deadmask == bitmask(SFIXEDBIT));
+      g->gcstats.freed[curr->gch.tt]++;
       *p = curr->gch.next;
       if (curr == g->rootgc)  /* is the first element of the list? */
         g->rootgc = curr->gch.next;  /* adjust first */
+#if defined(LUA_BGSWEEP)
+      if (later && freelater(curr)) {
+        if (curr->gch.tt == LUA_TSTRING && isshortstr(rawgco2ts(curr)))
+          g->strt.nuse--;  /* (the sweeper counts it in its shadow state) */
+        deadsize += objsize(curr);
+        *deadtail = curr;
+        deadtail = &curr->gch.next;
+        continue;
+      }
+#endif
       freeobj(L, curr);
     }
   }
-  return p;
+#if defined(LUA_BGSWEEP)
+  if (dead != NULL) {
+    handoff(g, dead, deadtail, deadsize);
+    /* `totalbytes' drops when the sweeper is done; `estimate' drops now */
+    g->estimate = (g->estimate > deadsize) ? g->estimate - deadsize : 0;
+  }
+#endif
+  return (p == NULL || *p == NULL) ? NULL : p;
 }
 
 
@@ -432,7 +1115,8 @@ static void checkSizes (lua_State *L) {
   global_State *g = G(L);
   /* check size of string hash */
   /* 元素个数小于 `strt.size/4`, 全局字符串表 `strt` 过于稀疏则精简为原大小的一半 */
-  if (g->strt.nuse < cast(lu_int32, g->strt.size/4) &&
+  if (g->strt.old == NULL &&  /* not migrating yet? */
+      g->strt.nuse < cast(lu_int32, g->strt.size/4) &&
       g->strt.size > MINSTRTABSIZE*2)
     luaS_resize(L, g->strt.size/2);  /* table is too big */
   /* check size of buffer */
@@ -485,9 +1169,12 @@ void luaC_freeall (lua_State *L) {
   global_State *g = G(L);
   int i;
   g->currentwhite = WHITEBITS | bitmask(SFIXEDBIT);  /* mask to collect all elements */
+  g->gckind = KGC_NORMAL;  /* sweep whole lists */
   sweepwholelist(L, &g->rootgc);
   for (i = 0; i < g->strt.size; i++)  /* free all string lists */
     sweepwholelist(L, &g->strt.hash[i]);
+  for (i = 0; i < g->strt.oldsize; i++)  /* and those not migrated yet */
+    sweepwholelist(L, &g->strt.old[i]);
 }
 
 
@@ -501,8 +1188,10 @@ static void markmt (global_State *g) {
 /* mark root set */
 static void markroot (lua_State *L) {
   global_State *g = G(L);
-  g->gray = NULL;
-  g->grayagain = NULL;
+  if (!isgenerational(g)) {  /* generational mode keeps its remembered set */
+    g->gray = NULL;
+    g->grayagain = NULL;
+  }
   g->weak = NULL;
   markobject(g, g->mainthread);
   /* make global table be traversed before main stack */
@@ -523,6 +1212,23 @@ static void remarkupvals (global_State *g) {
 }
 
 
+/*
+** 分代模式下弱表保持灰色, 加入`grayagain`(记忆集)以便每次回收都重新
+** 遍历和清理
+ */
+static void rememberweak (global_State *g) {
+  GCObject *o = g->weak;
+  while (o) {
+    Table *h = gco2h(o);
+    GCObject *next = h->gclist;
+    h->gclist = g->grayagain;
+    g->grayagain = o;
+    o = next;
+  }
+  g->weak = NULL;
+}
+
+
 static void atomic (lua_State *L) {
   global_State *g = G(L);
   size_t udsize;  /* total size of userdata to be finalized */
@@ -536,6 +1242,9 @@ static void atomic (lua_State *L) {
   lua_assert(!iswhite(obj2gco(g->mainthread)));
   markobject(g, L);  /* mark running thread */
   markmt(g);  /* mark basic metatables (again) */
+#if defined(LUA_SHAPES)
+  markshapes(g);
+#endif
   propagateall(g);
   /* remark gray again */
   g->gray = g->grayagain;
@@ -544,13 +1253,21 @@ static void atomic (lua_State *L) {
   udsize = luaC_separateudata(L, 0);  /* separate userdata to be finalized */
   marktmu(g);  /* mark `preserved' userdata */
   udsize += propagateall(g);  /* remark, to propagate `preserveness' */
-  cleartable(g->weak);  /* remove collected objects from weak tables */
+  cleartable(g, g->weak);  /* remove collected objects from weak tables */
+  if (isgenerational(g))
+    rememberweak(g);
   /* flip current white */
   g->currentwhite = cast_byte(otherwhite(g));
   g->sweepstrgc = 0;
   g->sweepgc = &g->rootgc;
   g->gcstate = GCSsweepstring;
   g->estimate = g->totalbytes - udsize;  /* first estimate */
+#if defined(LUA_BGSWEEP)
+  if (g->sweeper) {  /* what the sweeper did not free yet is not in use */
+    lu_mem backlog = __atomic_load_n(&g->sweeper->backlog, __ATOMIC_RELAXED);
+    g->estimate = (g->estimate > backlog) ? g->estimate - backlog : 0;
+  }
+#endif
 }
 
 
@@ -563,18 +1280,31 @@ static l_mem singlestep (lua_State *L) {
       return 0;
     }
     case GCSpropagate: {
-      if (g->gray)
-        return propagatemark(g);
+      if (g->gray) {
+        l_mem m = propagatemark(g);
+        g->gcstats.traversed += m;
+        return m;
+      }
       else {  /* no more `gray' objects */
+        chargephase(g, LUA_GCPPROPAGATE);
         atomic(L);  /* finish mark phase */
+        chargephase(g, LUA_GCPATOMIC);
         return 0;
       }
     }
     case GCSsweepstring: {
+      /* 迁移暂停, 先扫描新表的桶, 再扫描旧表的桶 */
+      stringtable *tb = &g->strt;  /* (no migration during this phase) */
+      int i = g->sweepstrgc++;
       lu_mem old = g->totalbytes;
-      sweepwholelist(L, &g->strt.hash[g->sweepstrgc++]);
-      if (g->sweepstrgc >= g->strt.size)  /* nothing more to sweep? */
+      sweepwholelist(L, (i < tb->size) ? &tb->hash[i]
+                                       : &tb->old[i - tb->size]);
+      if (g->sweepstrgc >= tb->size + tb->oldsize) {  /* nothing more? */
+        if (isgenerational(g))  /* `rootgc' sweep stops before udata */
+          sweepwholelist(L, &g->mainthread->next);
         g->gcstate = GCSsweep;  /* end sweep-string phase */
+        chargephase(g, LUA_GCPSWEEPSTRING);
+      }
       lua_assert(old >= g->totalbytes);
       g->estimate -= old - g->totalbytes;
       return GCSWEEPCOST;
@@ -582,12 +1312,14 @@ static l_mem singlestep (lua_State *L) {
     case GCSsweep: {
       lu_mem old = g->totalbytes;
       g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
-      if (*g->sweepgc == NULL) {  /* nothing more to sweep? */
-        checkSizes(L);
-        g->gcstate = GCSfinalize;  /* end sweep phase */
-      }
       lua_assert(old >= g->totalbytes);
       g->estimate -= old - g->totalbytes;
+      if (g->sweepgc == NULL) {  /* nothing more to sweep? */
+        /* 缩小`strt`会先分配新的桶数组, 所以放在统计之后 */
+        checkSizes(L);  /* (may allocate the new array of `strt') */
+        g->gcstate = GCSfinalize;  /* end sweep phase */
+        chargephase(g, LUA_GCPSWEEP);
+      }
       return GCSWEEPMAX*GCSWEEPCOST;
     }
     case GCSfinalize: {
@@ -600,6 +1332,7 @@ static l_mem singlestep (lua_State *L) {
       else {
         g->gcstate = GCSpause;  /* end collection */
         g->gcdept = 0;
+        endcycle(g, chargephase(g, LUA_GCPFINALIZE));
         return 0;
       }
     }
@@ -608,17 +1341,72 @@ static l_mem singlestep (lua_State *L) {
 }
 
 
+static void fullgc (lua_State *L);
+
+
+/*
+** 分代模式: 每次执行一次完整的次要回收, 只遍历年轻对象和记忆集
+** (`gray`与`grayagain`); 老对象增长过多时改做一次完整回收
+ */
+static void genstep (lua_State *L) {
+  global_State *g = G(L);
+  if (g->estimate > (g->majorbase/100) * (100 + LUAI_GENMAJORMUL))
+    fullgc(L);
+  else {
+    lua_assert(g->gcstate == GCSpause);
+    markroot(L);
+    propagateall(g);  /* mark all at once (maybe in parallel) */
+    do {
+      singlestep(L);
+    } while (g->gcstate != GCSpause);
+    setthreshold(g);
+  }
+}
+
+
+/*
+** 执行回收工作, 直到做完`lim`个单位的工作, 或者一轮回收结束, 或者
+** 时钟超过`deadline`(为0时不限时间). 原子阶段不能中断, 可能超时
+ */
+static void stepwork (lua_State *L, l_mem lim, lu_mem deadline) {
+  global_State *g = G(L);
+  l_mem work = 0;
+  do {
+    l_mem w = singlestep(L);
+    lim -= w;
+    if (g->gcstate == GCSpause)
+      break;
+    if (deadline != 0 && (work += w) >= cast(l_mem, GCCLOCKWORK)) {
+      work = 0;
+      if (gcclock() >= deadline)
+        break;
+    }
+  } while (lim > 0);
+}
+
+
 void luaC_step (lua_State *L) {
   global_State *g = G(L);
   l_mem lim = (GCSTEPSIZE/100) * g->gcstepmul;
+#if defined(LUA_BGSWEEP)
+  if (g->sweeper) {
+    collectfreed(g, 0);
+    if (g->totalbytes < g->GCthreshold)
+      return;  /* what was really in use did not reach the threshold */
+  }
+#endif
+  beginstep(g);
+  luaS_resizestep(L, GCSTRTMOVE);  /* string table may be migrating */
+  if (isgenerational(g)) {
+    genstep(L);
+    endstep(g);
+    return;
+  }
   if (lim == 0)
     lim = (MAX_LUMEM-1)/2;  /* no limit */
   g->gcdept += g->totalbytes - g->GCthreshold;
-  do {
-    lim -= singlestep(L);
-    if (g->gcstate == GCSpause)
-      break;
-  } while (lim > 0);
+  stepwork(L, lim, g->gcmaxpause ? g->gcstepstart + g->gcmaxpause : 0);
+  endstep(g);
   if (g->gcstate != GCSpause) {
     if (g->gcdept < GCSTEPSIZE)
       g->GCthreshold = g->totalbytes + GCSTEPSIZE;  /* - lim/g->gcstepmul;*/
@@ -634,8 +1422,40 @@ void luaC_step (lua_State *L) {
 }
 
 
-void luaC_fullgc (lua_State *L) {
+/*
+** 做最多`us`微秒的回收工作, 一轮回收结束时返回1. 分代模式下的次要
+** 回收不能中断, 总是做完一次. 不改变自动回收的节奏, 除非一轮回收结束
+** 并且自动回收没有停止
+ */
+int luaC_steptime (lua_State *L, lu_mem us) {
   global_State *g = G(L);
+  beginstep(g);
+  luaS_resizestep(L, GCSTRTMOVE);
+  if (isgenerational(g)) {
+    lu_mem threshold = g->GCthreshold;
+    genstep(L);
+    endstep(g);
+    if (threshold == MAX_LUMEM) g->GCthreshold = MAX_LUMEM;  /* stopped */
+    return 1;
+  }
+  stepwork(L, (MAX_LUMEM-1)/2, g->gcstepstart + us);
+  endstep(g);
+  if (g->gcstate != GCSpause)
+    return 0;
+  if (g->GCthreshold != MAX_LUMEM)  /* not stopped? */
+    setthreshold(g);
+  return 1;
+}
+
+
+/*
+** 完整回收. 分代模式下这是主要回收: 先按增量模式清除一遍, 使所有对象
+** 变白并且不再是老对象, 再做一轮分代回收, 存活的对象全部变老
+ */
+static void fullgc (lua_State *L) {
+  global_State *g = G(L);
+  int kind = g->gckind;
+  g->gckind = KGC_NORMAL;
   if (g->gcstate <= GCSpropagate) {
     /* reset sweep marks to sweep all elements (returning them to white) */
     g->sweepstrgc = 0;
@@ -652,21 +1472,53 @@ void luaC_fullgc (lua_State *L) {
     lua_assert(g->gcstate == GCSsweepstring || g->gcstate == GCSsweep);
     singlestep(L);
   }
+  /* everything is white now: lists left by an interrupted cycle are stale */
+  g->gray = NULL;
+  g->grayagain = NULL;
+  g->weak = NULL;
+  g->gckind = cast_byte(kind);
   markroot(L);
+  propagateall(g);  /* mark all at once (maybe in parallel) */
   while (g->gcstate != GCSpause) {
     singlestep(L);
   }
+#if defined(LUA_BGSWEEP)
+  if (g->sweeper)
+    collectfreed(g, 1);  /* memory is really free when a full GC returns */
+#endif
+  g->majorbase = g->estimate;
   setthreshold(g);
 }
 
 
+void luaC_fullgc (lua_State *L) {
+  global_State *g = G(L);
+  beginstep(g);
+  fullgc(L);
+  endstep(g);
+}
+
+
+/*
+** 切换增量/分代模式. 通过一次完整回收建立新模式需要的对象状态
+ */
+void luaC_changemode (lua_State *L, int kind) {
+  global_State *g = G(L);
+  if (kind != g->gckind) {
+    g->gckind = cast_byte(kind);
+    luaC_fullgc(L);
+  }
+}
+
+
 void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v) {
   global_State *g = G(L);
   lua_assert(isblack(o) && iswhite(v) && !isdead(g, v) && !isdead(g, o));
-  lua_assert(g->gcstate != GCSfinalize && g->gcstate != GCSpause);
-  lua_assert(ttype(&o->gch) != LUA_TTABLE);
+  lua_assert(isgenerational(g) ||
+             (g->gcstate != GCSfinalize && g->gcstate != GCSpause));
+  lua_assert(o->gch.tt != LUA_TTABLE);
   /* must keep invariant? */
-  if (g->gcstate == GCSpropagate)
+  if (keepinvariant(g))
     reallymarkobject(g, v);  /* restore invariant */
   else  /* don't mind */
     makewhite(g, o);  /* mark as white just to avoid other barriers */
@@ -677,7 +1529,8 @@ void luaC_barrierback (lua_State *L, Table *t) {
   global_State *g = G(L);
   GCObject *o = obj2gco(t);
   lua_assert(isblack(o) && !isdead(g, o));
-  lua_assert(g->gcstate != GCSfinalize && g->gcstate != GCSpause);
+  lua_assert(isgenerational(g) ||
+             (g->gcstate != GCSfinalize && g->gcstate != GCSpause));
   black2gray(o);  /* make table gray (again) */
   t->gclist = g->grayagain;
   g->grayagain = o;
@@ -698,8 +1551,9 @@ void luaC_linkupval (lua_State *L, UpVal *uv) {
   GCObject *o = obj2gco(uv);
   o->gch.next = g->rootgc;  /* link upvalue into `rootgc' list */
   g->rootgc = o;
+  resetbit(o->gch.marked, OLDBIT);  /* it is now among the young objects */
   if (isgray(o)) { 
-    if (g->gcstate == GCSpropagate) {
+    if (keepinvariant(g)) {
       gray2black(o);  /* closed upvalues need barrier */
       luaC_barrier(L, uv, uv->v);
     }
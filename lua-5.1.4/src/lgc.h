@@ -21,6 +21,22 @@
 #define GCSfinalize	4
 
 
+/*
+** Kinds of collection
+*/
+#define KGC_NORMAL	0	/* incremental */
+#define KGC_GEN		1	/* generational */
+
+#define isgenerational(g)	((g)->gckind == KGC_GEN)
+
+/*
+** must the invariant "no black object points to a white one" hold?
+** In generational mode it holds all the time: old objects stay black
+** between collections and are not traversed again.
+*/
+#define keepinvariant(g)	(isgenerational(g) || (g)->gcstate == GCSpropagate)
+
+
 /*
 ** some userful bit tricks
 */
@@ -45,9 +61,11 @@
 ** bit 2 - object is black
 ** bit 3 - for userdata: has been finalized
 ** bit 3 - for tables: has weak keys
+** bit 3 - for strings and prototypes: belongs to a shared segment
 ** bit 4 - for tables: has weak values
 ** bit 5 - object is fixed (should not be collected)
 ** bit 6 - object is "super" fixed (only the main thread)
+** bit 7 - object is old (generational mode)
 */
 
 
@@ -56,21 +74,32 @@
 #define BLACKBIT	2
 #define FINALIZEDBIT	3
 #define KEYWEAKBIT	3
+#define SHAREDBIT	3
 #define VALUEWEAKBIT	4
 #define FIXEDBIT	5
 #define SFIXEDBIT	6
+#define OLDBIT		7
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
 
 
 #define iswhite(x)      test2bits((x)->gch.marked, WHITE0BIT, WHITE1BIT)
 #define isblack(x)      testbit((x)->gch.marked, BLACKBIT)
 #define isgray(x)	(!isblack(x) && !iswhite(x))
+#define isold(x)	testbit((x)->gch.marked, OLDBIT)
+/* only meaningful for strings and prototypes */
+#define isshared(x)	testbit((x)->gch.marked, SHAREDBIT)
 
 #define otherwhite(g)	(g->currentwhite ^ WHITEBITS)
 #define isdead(g,v)	((v)->gch.marked & otherwhite(g) & WHITEBITS)
 
 #define changewhite(x)	((x)->gch.marked ^= WHITEBITS)
+#if defined(LUA_PARALLELGC)
+/* 其他标记线程可能同时用CAS读写同一个`marked` (见lgc.c的claimobject) */
+#define gray2black(x)	((void)__atomic_fetch_or(&(x)->gch.marked, \
+				cast_byte(bitmask(BLACKBIT)), __ATOMIC_RELAXED))
+#else
 #define gray2black(x)	l_setbit((x)->gch.marked, BLACKBIT)
+#endif
 
 #define valiswhite(x)	(iscollectable(x) && iswhite(gcvalue(x)))
 
@@ -101,6 +130,10 @@ LUAI_FUNC void luaC_callGCTM (lua_State *L);
 LUAI_FUNC void luaC_freeall (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_fullgc (lua_State *L);
+LUAI_FUNC void luaC_changemode (lua_State *L, int kind);
+LUAI_FUNC int luaC_setworkers (lua_State *L, int n);
+LUAI_FUNC int luaC_setbgsweep (lua_State *L, int on);
+LUAI_FUNC int luaC_steptime (lua_State *L, lu_mem us);
 LUAI_FUNC void luaC_link (lua_State *L, GCObject *o, lu_byte tt);
 LUAI_FUNC void luaC_linkupval (lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v);
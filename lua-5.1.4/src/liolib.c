@@ -124,6 +124,20 @@ static int io_fclose (lua_State *L) {
 }
 
 
+/*
+** __clone tag method: a copy of a file handle in a cloned state does
+** not own the file; only the standard files stay usable
+*/
+static int io_clone (lua_State *L) {
+  FILE **p = tofilep(L);
+  lua_getfenv(L, 1);
+  lua_getfield(L, -1, "__close");
+  if (lua_tocfunction(L, -1) != io_noclose)
+    *p = NULL;  /* mark file as closed */
+  return 0;
+}
+
+
 static int aux_close (lua_State *L) {
   lua_getfenv(L, 1);
   lua_getfield(L, -1, "__close");
@@ -411,7 +425,11 @@ static int g_write (lua_State *L, FILE *f, int arg) {
   int nargs = lua_gettop(L) - 1;
   int status = 1;
   for (; nargs--; arg++) {
-    if (lua_type(L, arg) == LUA_TNUMBER) {
+    if (lua_isinteger(L, arg)) {
+      status = status && fprintf(f, "%" LUA_INTFRMLEN "d",
+                                 (LUA_INTFRM_T)lua_tointeger(L, arg)) > 0;
+    }
+    else if (lua_type(L, arg) == LUA_TNUMBER) {
       /* optimization: could be done exactly as for strings */
       status = status &&
           fprintf(f, LUA_NUMBER_FMT, lua_tonumber(L, arg)) > 0;
@@ -498,6 +516,7 @@ static const luaL_Reg flib[] = {
   {"seek", f_seek},
   {"setvbuf", f_setvbuf},
   {"write", f_write},
+  {"__clone", io_clone},
   {"__gc", io_gc},
   {"__tostring", io_tostring},
   {NULL, NULL}
@@ -0,0 +1,1072 @@
+/*
+** $Id: ljit.c $
+** Baseline JIT compiler for x86-64
+** See Copyright Notice in lua.h
+*/
+
+/*
+** 基线(模板)JIT编译器.
+** 对热点函数的每条指令套用一段固定的机器码模板, 不做寄存器分配和跨指令优化:
+**  - MOVE/LOADK/GETUPVAL/数值算术/比较/条件测试/FORLOOP/JMP 等直接生成内联
+**    机器码, 操作数不是数值时转入慢速路径;
+**  - 读写表、连接、闭包等复杂指令调用本文件中的辅助函数(与解释器同样的语义,
+**    最终落到luaV_gettable/luaV_arith/luaD_call等);
+**  - CALL/TAILCALL/RETURN 退出机器码, 交给解释器完成帧的切换, 返回后解释器
+**    再从下一条指令重新进入机器码.
+** 机器码直接读写Lua栈, 不缓存任何值, 因此debug库看到的状态与解释器一致.
+** 开启行/计数钩子时不进入机器码; 机器码在循环回跳处检查钩子并退回解释器.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#define ljit_c
+#define LUA_CORE
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "ljit.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+#if defined(LUA_USE_JIT)
+
+#include <sys/mman.h>
+
+
+/*
+** {======================================================
+** Slow-path helpers called from machine code
+** =======================================================
+*/
+
+/*
+** 辅助函数统一签名: `ip`为当前指令地址. 与解释器的`Protect`一致, 先把
+** `savedpc`指向下一条指令, 以便出错信息和debug库得到正确的行号.
+ */
+#define hbegin(L,ip)	((L)->savedpc = (ip) + 1)
+
+#define RA(i)	(base+GETARG_A(i))
+#define RB(i)	(base+GETARG_B(i))
+#define RKB(i)	(ISK(GETARG_B(i)) ? k+INDEXK(GETARG_B(i)) : base+GETARG_B(i))
+#define RKC(i)	(ISK(GETARG_C(i)) ? k+INDEXK(GETARG_C(i)) : base+GETARG_C(i))
+#define KBx(i)	(k+GETARG_Bx(i))
+
+#define curr_lfunc(L)	(&curr_func(L)->l)
+
+
+/*
+** 读表, 常量字符串键使用该指令的内联缓存(与解释器共用)
+ */
+static void gettable (lua_State *L, const TValue *t, TValue *key, StkId ra,
+                      int *cache) {
+  if (cache != NULL && ttistable(t)) {
+    Table *h = hvalue(t);
+    const TValue *res = luaH_getstrcached(h, rawtsvalue(key), cache);
+    if (!ttisnil(res) || fasttm(L, h->metatable, TM_INDEX) == NULL) {
+      setobj2s(L, ra, res);
+      return;
+    }
+  }
+  luaV_gettable(L, t, key, ra);
+}
+
+
+/* inline cache of instruction `ip' when its key `x' is a constant string */
+static int *keycache (Proto *p, const Instruction *ip, int x) {
+  if (ISK(x) && ttisstring(&p->k[INDEXK(x)]))
+    return p->icache + (ip - p->code);
+  return NULL;
+}
+
+
+static void h_getglobal (lua_State *L, const Instruction *ip) {
+  LClosure *cl = curr_lfunc(L);
+  TValue *k = cl->p->k;
+  Instruction i = *ip;
+  TValue g;
+  hbegin(L, ip);
+  sethvalue(L, &g, cl->env);
+  gettable(L, &g, KBx(i), L->base + GETARG_A(i),
+           cl->p->icache + (ip - cl->p->code));
+}
+
+
+static void h_gettable (lua_State *L, const Instruction *ip) {
+  LClosure *cl = curr_lfunc(L);
+  StkId base = L->base;
+  TValue *k = cl->p->k;
+  Instruction i = *ip;
+  hbegin(L, ip);
+  gettable(L, RB(i), RKC(i), RA(i), keycache(cl->p, ip, GETARG_C(i)));
+}
+
+
+static void h_self (lua_State *L, const Instruction *ip) {
+  LClosure *cl = curr_lfunc(L);
+  StkId base = L->base;
+  TValue *k = cl->p->k;
+  Instruction i = *ip;
+  StkId ra = RA(i);
+  StkId rb = RB(i);
+  hbegin(L, ip);
+  setobjs2s(L, ra+1, rb);
+  gettable(L, rb, RKC(i), ra, keycache(cl->p, ip, GETARG_C(i)));
+}
+
+
+static void h_setglobal (lua_State *L, const Instruction *ip) {
+  LClosure *cl = curr_lfunc(L);
+  TValue *k = cl->p->k;
+  Instruction i = *ip;
+  TValue g;
+  hbegin(L, ip);
+  sethvalue(L, &g, cl->env);
+  luaV_settable(L, &g, KBx(i), L->base + GETARG_A(i));
+}
+
+
+static void h_setupval (lua_State *L, const Instruction *ip) {
+  UpVal *uv = curr_lfunc(L)->upvals[GETARG_B(*ip)];
+  StkId ra = L->base + GETARG_A(*ip);
+  hbegin(L, ip);
+  setobj(L, uv->v, ra);
+  luaC_barrier(L, uv, ra);
+}
+
+
+static void h_settable (lua_State *L, const Instruction *ip) {
+  StkId base = L->base;
+  TValue *k = curr_lfunc(L)->p->k;
+  Instruction i = *ip;
+  hbegin(L, ip);
+  luaV_settable(L, RA(i), RKB(i), RKC(i));
+}
+
+
+static void h_newtable (lua_State *L, const Instruction *ip) {
+  Instruction i = *ip;
+  hbegin(L, ip);
+  sethvalue(L, L->base + GETARG_A(i),
+            luaH_new(L, luaO_fb2int(GETARG_B(i)), luaO_fb2int(GETARG_C(i))));
+  luaC_checkGC(L);
+}
+
+
+/*
+** 算术慢速路径(含MOD/POW/UNM), 快速化指令按其原指令处理
+ */
+static void h_arith (lua_State *L, const Instruction *ip) {
+  StkId base = L->base;
+  TValue *k = curr_lfunc(L)->p->k;
+  Instruction i = *ip;
+  OpCode op = quickbase(GET_OPCODE(i));
+  TValue *rb = RKB(i);
+  hbegin(L, ip);
+  luaV_arith(L, RA(i), rb, (op == OP_UNM) ? rb : RKC(i),
+             cast(TMS, TM_ADD + (op - OP_ADD)));
+}
+
+
+static void h_len (lua_State *L, const Instruction *ip) {
+  StkId base = L->base;
+  Instruction i = *ip;
+  hbegin(L, ip);
+  luaV_objlen(L, RA(i), RB(i));
+}
+
+
+static void h_concat (lua_State *L, const Instruction *ip) {
+  Instruction i = *ip;
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  hbegin(L, ip);
+  luaV_concat(L, c-b+1, c);
+  luaC_checkGC(L);
+  setobjs2s(L, L->base + GETARG_A(i), L->base + b);
+}
+
+
+/*
+** 比较慢速路径, 返回比较结果
+ */
+static int h_compare (lua_State *L, const Instruction *ip) {
+  StkId base = L->base;
+  TValue *k = curr_lfunc(L)->p->k;
+  Instruction i = *ip;
+  TValue *rb = RKB(i);
+  TValue *rc = RKC(i);
+  hbegin(L, ip);
+  switch (quickbase(GET_OPCODE(i))) {
+    case OP_EQ: return equalobj(L, rb, rc);
+    case OP_LT: return luaV_lessthan(L, rb, rc);
+    default: return luaV_lessequal(L, rb, rc);
+  }
+}
+
+
+static void h_forprep (lua_State *L, const Instruction *ip) {
+  hbegin(L, ip);
+  luaV_forprep(L, L->base + GETARG_A(*ip));
+}
+
+
+/*
+** 调用迭代函数, 返回是否继续循环
+ */
+static int h_tforloop (lua_State *L, const Instruction *ip) {
+  StkId cb = L->base + GETARG_A(*ip) + 3;  /* call base */
+  hbegin(L, ip);
+  setobjs2s(L, cb+2, cb-1);
+  setobjs2s(L, cb+1, cb-2);
+  setobjs2s(L, cb, cb-3);
+  L->top = cb+3;  /* func. + 2 args (state and index) */
+  luaD_call(L, cb, GETARG_C(*ip));
+  L->top = L->ci->top;
+  cb = L->base + GETARG_A(*ip) + 3;  /* previous call may change the stack */
+  if (!ttisnil(cb)) {  /* continue loop? */
+    setobjs2s(L, cb-1, cb);  /* save control variable */
+    return 1;
+  }
+  return 0;
+}
+
+
+static void h_setlist (lua_State *L, const Instruction *ip) {
+  StkId ra = L->base + GETARG_A(*ip);
+  int n = GETARG_B(*ip);
+  int c = GETARG_C(*ip);
+  int last;
+  Table *h;
+  hbegin(L, ip);
+  if (n == 0) {
+    n = cast_int(L->top - ra) - 1;
+    L->top = L->ci->top;
+  }
+  if (c == 0) c = cast_int(*(ip + 1));
+  if (!ttistable(ra)) return;  /* runtime_check */
+  h = hvalue(ra);
+  last = ((c-1)*LFIELDS_PER_FLUSH) + n;
+  if (last > h->sizearray)  /* needs more space? */
+    luaH_resizearray(L, h, last);  /* pre-alloc it at once */
+  for (; n > 0; n--) {
+    TValue *val = ra+n;
+    setobj2t(L, luaH_setnum(L, h, last--), val);
+    luaC_barriert(L, h, val);
+  }
+}
+
+
+static void h_close (lua_State *L, const Instruction *ip) {
+  hbegin(L, ip);
+  luaF_close(L, L->base + GETARG_A(*ip));
+}
+
+
+static void h_closure (lua_State *L, const Instruction *ip) {
+  LClosure *cl = curr_lfunc(L);
+  StkId base = L->base;
+  Proto *p = cl->p->p[GETARG_Bx(*ip)];
+  int nup = p->nups;
+  const Instruction *pc = ip + 1;
+  Closure *ncl;
+  int j;
+  hbegin(L, ip);
+  ncl = luaF_newLclosure(L, nup, cl->env);
+  ncl->l.p = p;
+  for (j=0; j<nup; j++, pc++) {
+    if (GET_OPCODE(*pc) == OP_GETUPVAL)
+      ncl->l.upvals[j] = cl->upvals[GETARG_B(*pc)];
+    else {
+      lua_assert(GET_OPCODE(*pc) == OP_MOVE);
+      ncl->l.upvals[j] = luaF_findupval(L, base + GETARG_B(*pc));
+    }
+  }
+  setclvalue(L, base + GETARG_A(*ip), ncl);
+  L->savedpc = pc;
+  luaC_checkGC(L);
+}
+
+
+static void h_vararg (lua_State *L, const Instruction *ip) {
+  StkId ra = L->base + GETARG_A(*ip);
+  int b = GETARG_B(*ip) - 1;
+  int j;
+  CallInfo *ci = L->ci;
+  int n = cast_int(ci->base - ci->func) - curr_lfunc(L)->p->numparams - 1;
+  hbegin(L, ip);
+  if (b == LUA_MULTRET) {
+    luaD_checkstack(L, n);
+    ra = L->base + GETARG_A(*ip);  /* previous call may change the stack */
+    b = n;
+    L->top = ra + n;
+  }
+  for (j = 0; j < b; j++) {
+    if (j < n) {
+      setobjs2s(L, ra + j, ci->base - n + j);
+    }
+    else {
+      setnilvalue(ra + j);
+    }
+  }
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** x86-64 code emitter
+** =======================================================
+*/
+
+/* general purpose registers */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+       R8, R9, R10, R11, R12, R13, R14, R15 };
+
+/*
+** 机器码中固定使用的寄存器(均为callee-saved, 调用辅助函数后无需恢复;
+** 只有`base`可能因栈重新分配而改变, 每次调用后从L->base重新加载)
+ */
+#define JR_BASE	RBX	/* L->base */
+#define JR_K	R12	/* constants of the function */
+#define JR_L	R13	/* lua_State */
+#define JR_CL	R14	/* running LClosure */
+
+/* condition codes */
+#define CC_O	0x0
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_S	0x8
+#define CC_P	0xA
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+
+#define TVSIZE	cast_int(sizeof(TValue))
+#define TTOFF	cast_int(offsetof(TValue, tt))
+
+#define LOFF(f)	cast_int(offsetof(lua_State, f))
+
+/* room reserved before emitting each instruction (worst case is LOADNIL) */
+#define MAXINSTSIZE	(MAXSTACK*12 + 512)
+
+
+typedef void (*JitHelper) (void);
+
+/* templates copy TValues as 16-byte blocks */
+typedef char jit_checklayout[(sizeof(TValue) == 16 &&
+                              offsetof(TValue, tt) == 8) ? 1 : -1];
+
+
+typedef struct JitState {
+  lua_State *L;
+  Proto *p;
+  unsigned char *buf;  /* code being emitted */
+  int size;  /* size of `buf' */
+  int pos;  /* current position in `buf' */
+  int *pcoff;  /* offset of each instruction */
+  int *fixpos;  /* pending jumps to instructions: position of rel32... */
+  int *fixpc;  /* ...and target instruction */
+  int nfix;
+  int epilogue;  /* offset of common exit code */
+} JitState;
+
+
+/*
+** 编译期间的临时内存直接使用分配函数, 失败时放弃编译而不是抛出错误
+ */
+static void *jit_realloc (JitState *J, void *block, size_t osize,
+                          size_t nsize) {
+  global_State *g = G(J->L);
+  return (*g->frealloc)(g->ud, block, osize, nsize);
+}
+
+
+static int ensure (JitState *J, int n) {
+  if (J->pos + n > J->size) {
+    int newsize = J->size * 2;
+    unsigned char *newbuf;
+    if (newsize < J->pos + n) newsize = J->pos + n;
+    newbuf = cast(unsigned char *, jit_realloc(J, J->buf, J->size, newsize));
+    if (newbuf == NULL) return 0;
+    J->buf = newbuf;
+    J->size = newsize;
+  }
+  return 1;
+}
+
+
+static void e8 (JitState *J, int b) {
+  J->buf[J->pos++] = cast(unsigned char, b);
+}
+
+
+static void e32 (JitState *J, int v) {
+  memcpy(J->buf + J->pos, &v, 4);
+  J->pos += 4;
+}
+
+
+/* [prefix] [REX] opcode ModRM(reg, [base+disp32]) */
+static void emit_mem (JitState *J, int pfx, int w, int op1, int op2,
+                      int reg, int base, int disp) {
+  int rex = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((base & 8) >> 3);
+  if (pfx) e8(J, pfx);
+  if (rex != 0x40) e8(J, rex);
+  e8(J, op1);
+  if (op2 >= 0) e8(J, op2);
+  e8(J, 0x80 | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP) e8(J, 0x24);  /* SIB for rsp/r12 */
+  e32(J, disp);
+}
+
+
+/* [prefix] [REX] opcode ModRM(reg, rm) */
+static void emit_rr (JitState *J, int pfx, int w, int op1, int op2,
+                     int reg, int rm) {
+  int rex = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+  if (pfx) e8(J, pfx);
+  if (rex != 0x40) e8(J, rex);
+  e8(J, op1);
+  if (op2 >= 0) e8(J, op2);
+  e8(J, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+/* mov reg, imm64 */
+static void emit_loadimm (JitState *J, int reg, const void *v, size_t n) {
+  e8(J, 0x48 | ((reg & 8) >> 3));
+  e8(J, 0xB8 + (reg & 7));
+  memset(J->buf + J->pos, 0, 8);
+  memcpy(J->buf + J->pos, v, n);
+  J->pos += 8;
+}
+
+#define emit_loadptr(J,r,p)	{ const void *p_ = (p); \
+	emit_loadimm(J, r, &p_, sizeof(p_)); }
+#define emit_loadfn(J,r,f)	{ JitHelper f_ = cast(JitHelper, f); \
+	emit_loadimm(J, r, &f_, sizeof(f_)); }
+
+#define emit_push(J,r)	{ if ((r) & 8) e8(J, 0x41); e8(J, 0x50 + ((r) & 7)); }
+#define emit_pop(J,r)	{ if ((r) & 8) e8(J, 0x41); e8(J, 0x58 + ((r) & 7)); }
+
+/* 64-bit load/store */
+#define emit_ldq(J,r,b,d)	emit_mem(J, 0, 1, 0x8B, -1, r, b, d)
+#define emit_stq(J,b,d,r)	emit_mem(J, 0, 1, 0x89, -1, r, b, d)
+/* 32-bit load/store */
+#define emit_ldd(J,r,b,d)	emit_mem(J, 0, 0, 0x8B, -1, r, b, d)
+#define emit_std(J,b,d,r)	emit_mem(J, 0, 0, 0x89, -1, r, b, d)
+/* mov dword [b+d], imm32 */
+#define emit_stimm(J,b,d,v)	{ emit_mem(J, 0, 0, 0xC7, -1, 0, b, d); e32(J, v); }
+/* cmp dword [b+d], imm32 */
+#define emit_cmpimm(J,b,d,v)	{ emit_mem(J, 0, 0, 0x81, -1, 7, b, d); e32(J, v); }
+/* SSE2 scalar double: movsd load/store, arithmetic, ucomisd */
+#define emit_movsd(J,x,b,d)	emit_mem(J, 0xF2, 0, 0x0F, 0x10, x, b, d)
+#define emit_stsd(J,b,d,x)	emit_mem(J, 0xF2, 0, 0x0F, 0x11, x, b, d)
+#define emit_sse(J,op,x,b,d)	emit_mem(J, 0xF2, 0, 0x0F, op, x, b, d)
+#define emit_ucomi(J,x,b,d)	emit_mem(J, 0x66, 0, 0x0F, 0x2E, x, b, d)
+#define emit_ucomirr(J,x,y)	emit_rr(J, 0x66, 0, 0x0F, 0x2E, x, y)
+
+#define SSE_ADD	0x58
+#define SSE_MUL	0x59
+#define SSE_SUB	0x5C
+#define SSE_DIV	0x5E
+
+/* integer arithmetic: op r64, r/m64 (INT_MUL is 0F AF) */
+#define INT_NONE	(-1)
+#define INT_ADD	0x03
+#define INT_SUB	0x2B
+#define INT_MUL	0xAF
+
+
+/* copy a whole TValue through xmm0 */
+static void emit_copy (JitState *J, int db, int dd, int sb, int sd) {
+  emit_mem(J, 0xF3, 0, 0x0F, 0x6F, 0, sb, sd);  /* movdqu xmm0, [src] */
+  emit_mem(J, 0xF3, 0, 0x0F, 0x7F, 0, db, dd);  /* movdqu [dst], xmm0 */
+}
+
+
+/* jumps with a 32-bit displacement; return position to patch */
+static int emit_jmp (JitState *J) {
+  e8(J, 0xE9);
+  e32(J, 0);
+  return J->pos - 4;
+}
+
+
+static int emit_jcc (JitState *J, int cc) {
+  e8(J, 0x0F);
+  e8(J, 0x80 | cc);
+  e32(J, 0);
+  return J->pos - 4;
+}
+
+
+static void patch_to (JitState *J, int at, int target) {
+  int rel = target - (at + 4);
+  memcpy(J->buf + at, &rel, 4);
+}
+
+#define patch_here(J,at)	patch_to(J, at, (J)->pos)
+
+
+/* jump at `at' goes to instruction `pc' (resolved at the end) */
+static void jump_pc (JitState *J, int at, int pc) {
+  J->fixpos[J->nfix] = at;
+  J->fixpc[J->nfix] = pc;
+  J->nfix++;
+}
+
+
+/*
+** 退出机器码: 设置`savedpc`为第`pc`条指令, 解释器从这条指令继续执行
+ */
+static void emit_exit (JitState *J, int pc) {
+  emit_loadptr(J, RAX, J->p->code + pc);
+  emit_stq(J, JR_L, LOFF(savedpc), RAX);
+  patch_to(J, emit_jmp(J), J->epilogue);
+}
+
+
+/*
+** 调用辅助函数`f(L, &code[pc])`, 之后重新加载可能变化的`base`
+ */
+static void emit_helper (JitState *J, JitHelper f, int pc) {
+  emit_rr(J, 0, 1, 0x89, -1, JR_L, RDI);  /* mov rdi, r13 */
+  emit_loadptr(J, RSI, J->p->code + pc);
+  emit_loadfn(J, RAX, f);
+  e8(J, 0xFF); e8(J, 0xD0);  /* call rax */
+  emit_ldq(J, JR_BASE, JR_L, LOFF(base));
+}
+
+#define emit_call(J,f,pc)	emit_helper(J, cast(JitHelper, f), pc)
+
+
+/*
+** 跳转到第`target`条指令. 向后跳转(循环)时先检查钩子, 有行/计数钩子则
+** 退回解释器, 保证钩子在长时间运行的循环中依然生效
+ */
+static void emit_goto (JitState *J, int pc, int target) {
+  if (target <= pc) {
+    int skip;
+    emit_mem(J, 0, 0, 0xF6, -1, 0, JR_L, LOFF(hookmask));  /* test byte */
+    e8(J, LUA_MASKLINE | LUA_MASKCOUNT);
+    skip = emit_jcc(J, CC_E);
+    emit_exit(J, target);
+    patch_here(J, skip);
+  }
+  jump_pc(J, emit_jmp(J), target);
+}
+
+
+/* conditional version of `emit_goto' */
+static void emit_cgoto (JitState *J, int cc, int pc, int target) {
+  if (target > pc)
+    jump_pc(J, emit_jcc(J, cc), target);
+  else {
+    int skip = emit_jcc(J, cc ^ 1);  /* inverted condition */
+    emit_goto(J, pc, target);
+    patch_here(J, skip);
+  }
+}
+
+
+/* addressing of register/constant operands */
+#define regaddr(x,r,d)	(*(r) = JR_BASE, *(d) = (x)*TVSIZE)
+
+static void rkaddr (int x, int *r, int *d) {
+  if (ISK(x)) { *r = JR_K; *d = INDEXK(x)*TVSIZE; }
+  else regaddr(x, r, d);
+}
+
+
+/* kind of RK operand `x' */
+enum { KREG, KFLT, KINT, KOTHER };
+
+static int kkind (JitState *J, int x) {
+  const TValue *o;
+  if (!ISK(x)) return KREG;
+  o = &J->p->k[INDEXK(x)];
+  return ttisflt(o) ? KFLT : ttisint(o) ? KINT : KOTHER;
+}
+
+/* operands `b' and `c' may both have the number subtype of kind `kind' */
+#define kboth(J,b,c,kind) \
+	((kkind(J, b) == KREG || kkind(J, b) == (kind)) && \
+	 (kkind(J, c) == KREG || kkind(J, c) == (kind)))
+
+
+/* check that register operand `x' has tag `tt'; add jump to `slow' if not */
+static void emit_tagcheck (JitState *J, int x, int tt, int *slow, int *ns) {
+  int r, d;
+  if (ISK(x)) return;  /* constant kind is known at compile time */
+  rkaddr(x, &r, &d);
+  emit_cmpimm(J, r, d + TTOFF, tt);
+  slow[(*ns)++] = emit_jcc(J, CC_NE);
+}
+
+
+/* eax = l_isfalse([r+d]) */
+static void emit_isfalse (JitState *J, int r, int d) {
+  int j1, j2, j3;
+  emit_ldd(J, RCX, r, d + TTOFF);
+  e8(J, 0xB8); e32(J, 1);  /* mov eax, 1 */
+  emit_rr(J, 0, 0, 0x85, -1, RCX, RCX);  /* test ecx, ecx */
+  j1 = emit_jcc(J, CC_E);  /* nil */
+  emit_rr(J, 0, 0, 0x81, -1, 7, RCX); e32(J, LUA_TBOOLEAN);  /* cmp ecx */
+  j2 = emit_jcc(J, CC_NE);
+  emit_cmpimm(J, r, d, 0);
+  j3 = emit_jcc(J, CC_E);  /* false */
+  patch_here(J, j2);
+  emit_rr(J, 0, 0, 0x31, -1, RAX, RAX);  /* xor eax, eax */
+  patch_here(J, j1);
+  patch_here(J, j3);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Instruction templates
+** =======================================================
+*/
+
+/*
+** 算术指令: 两个浮点数用SSE2计算; 两个整数(`iop`)用整数指令计算, 溢出
+** 时与其它情况一样调用`h_arith`
+ */
+static void emit_arith (JitState *J, int pc, Instruction i, int sseop,
+                        int iop) {
+  int b = GETARG_B(i), c = GETARG_C(i);
+  int rb, db, rc, dc;
+  int slow[3], ns = 0;
+  int done[2], nd = 0;
+  int da = GETARG_A(i)*TVSIZE;
+  int fpath = kboth(J, b, c, KFLT);
+  int ipath = (iop != INT_NONE && kboth(J, b, c, KINT));
+  rkaddr(b, &rb, &db);
+  rkaddr(c, &rc, &dc);
+  if (fpath) {
+    int fslow[2], nfs = 0;
+    emit_tagcheck(J, b, LUA_TNUMBER, fslow, &nfs);
+    emit_tagcheck(J, c, LUA_TNUMBER, fslow, &nfs);
+    emit_movsd(J, 0, rb, db);
+    emit_sse(J, sseop, 0, rc, dc);
+    emit_stsd(J, JR_BASE, da, 0);
+    emit_stimm(J, JR_BASE, da + TTOFF, LUA_TNUMBER);
+    if (nfs == 0) return;  /* two float constants */
+    done[nd++] = emit_jmp(J);
+    while (nfs > 0) patch_here(J, fslow[--nfs]);
+  }
+  if (ipath) {
+    emit_tagcheck(J, b, LUA_TNUMINT, slow, &ns);
+    emit_tagcheck(J, c, LUA_TNUMINT, slow, &ns);
+    emit_ldq(J, RAX, rb, db);
+    if (iop == INT_MUL)
+      emit_mem(J, 0, 1, 0x0F, INT_MUL, RAX, rc, dc);  /* imul rax, [c] */
+    else
+      emit_mem(J, 0, 1, iop, -1, RAX, rc, dc);  /* add/sub rax, [c] */
+    slow[ns++] = emit_jcc(J, CC_O);
+    emit_stq(J, JR_BASE, da, RAX);
+    emit_stimm(J, JR_BASE, da + TTOFF, LUA_TNUMINT);
+    done[nd++] = emit_jmp(J);
+  }
+  while (ns > 0) patch_here(J, slow[--ns]);
+  emit_call(J, h_arith, pc);
+  while (nd > 0) patch_here(J, done[--nd]);
+}
+
+
+/*
+** 比较指令与其后的JMP: 结果等于A时跳转到JMP的目标, 否则跳过JMP.
+** 数值比较用ucomisd; 操作数顺序保证NaN时比较结果为假
+ */
+static void emit_compare (JitState *J, int pc, Instruction i) {
+  OpCode op = quickbase(GET_OPCODE(i));
+  int b = GETARG_B(i), c = GETARG_C(i);
+  int target = pc + 2 + GETARG_sBx(J->p->code[pc+1]);
+  int rb, db, rc, dc;
+  int slow[2], ns = 0;
+  int done[2], nd = 0;
+  int fpath = kboth(J, b, c, KFLT);
+  int ipath = kboth(J, b, c, KINT);
+  int helper = 1;
+  rkaddr(b, &rb, &db);
+  rkaddr(c, &rc, &dc);
+  if (fpath) {
+    int fslow[2], nfs = 0;
+    int f1, f2 = -1;
+    emit_tagcheck(J, b, LUA_TNUMBER, fslow, &nfs);
+    emit_tagcheck(J, c, LUA_TNUMBER, fslow, &nfs);
+    emit_rr(J, 0, 0, 0x31, -1, RAX, RAX);  /* xor eax, eax */
+    if (op == OP_EQ) {
+      emit_movsd(J, 0, rb, db);
+      emit_ucomi(J, 0, rc, dc);
+      f1 = emit_jcc(J, CC_NE);
+      f2 = emit_jcc(J, CC_P);  /* unordered */
+    }
+    else {  /* b < c  <=>  c > b;  b <= c  <=>  c >= b */
+      emit_movsd(J, 0, rc, dc);
+      emit_ucomi(J, 0, rb, db);
+      f1 = emit_jcc(J, (op == OP_LT) ? CC_BE : CC_B);
+    }
+    e8(J, 0xB8); e32(J, 1);  /* mov eax, 1 */
+    patch_here(J, f1);
+    if (f2 >= 0) patch_here(J, f2);
+    if (nfs == 0)  /* two float constants */
+      ipath = helper = 0;
+    else {
+      done[nd++] = emit_jmp(J);
+      while (nfs > 0) patch_here(J, fslow[--nfs]);
+    }
+  }
+  if (ipath) {
+    int f;
+    emit_tagcheck(J, b, LUA_TNUMINT, slow, &ns);
+    emit_tagcheck(J, c, LUA_TNUMINT, slow, &ns);
+    emit_ldq(J, RCX, rb, db);
+    emit_mem(J, 0, 1, 0x3B, -1, RCX, rc, dc);  /* cmp rcx, [c] */
+    e8(J, 0xB8); e32(J, 0);  /* mov eax, 0 (keeps flags) */
+    f = emit_jcc(J, (op == OP_EQ) ? CC_NE : (op == OP_LT) ? CC_GE : CC_G);
+    e8(J, 0xB8); e32(J, 1);  /* mov eax, 1 */
+    patch_here(J, f);
+    if (ns == 0)  /* two integer constants */
+      helper = 0;
+    else
+      done[nd++] = emit_jmp(J);
+  }
+  if (helper) {
+    while (ns > 0) patch_here(J, slow[--ns]);
+    emit_call(J, h_compare, pc);
+  }
+  while (nd > 0) patch_here(J, done[--nd]);
+  emit_rr(J, 0, 0, 0x85, -1, RAX, RAX);  /* test eax, eax */
+  emit_cgoto(J, GETARG_A(i) ? CC_NE : CC_E, pc, target);
+  jump_pc(J, emit_jmp(J), pc + 2);
+}
+
+
+/*
+** 数值for循环: OP_FORPREP决定了整数循环或浮点数循环, 按索引的类型标记
+** 选择对应的代码
+ */
+static void emit_forloop (JitState *J, int pc, Instruction i) {
+  int da = GETARG_A(i)*TVSIZE;
+  int target = pc + 1 + GETARG_sBx(i);
+  int isint, neg, cont, d1, d2, d3, d4, d5;
+  emit_cmpimm(J, JR_BASE, da + TTOFF, LUA_TNUMBER);
+  isint = emit_jcc(J, CC_NE);
+  emit_movsd(J, 0, JR_BASE, da);  /* xmm0 = idx + step */
+  emit_sse(J, SSE_ADD, 0, JR_BASE, da + 2*TVSIZE);
+  emit_movsd(J, 1, JR_BASE, da + TVSIZE);  /* xmm1 = limit */
+  emit_movsd(J, 2, JR_BASE, da + 2*TVSIZE);  /* xmm2 = step */
+  emit_rr(J, 0x66, 0, 0x0F, 0x57, 3, 3);  /* xorpd xmm3, xmm3 */
+  emit_ucomirr(J, 2, 3);
+  neg = emit_jcc(J, CC_BE);  /* !(0 < step) */
+  emit_ucomirr(J, 1, 0);
+  d1 = emit_jcc(J, CC_B);  /* !(idx <= limit) */
+  cont = emit_jmp(J);
+  patch_here(J, neg);
+  emit_ucomirr(J, 0, 1);
+  d2 = emit_jcc(J, CC_B);  /* !(limit <= idx) */
+  patch_here(J, cont);
+  emit_stsd(J, JR_BASE, da, 0);  /* update internal index... */
+  emit_stsd(J, JR_BASE, da + 3*TVSIZE, 0);  /* ...and external index */
+  emit_stimm(J, JR_BASE, da + 3*TVSIZE + TTOFF, LUA_TNUMBER);
+  emit_goto(J, pc, target);
+  patch_here(J, isint);  /* integer loop */
+  emit_ldq(J, RAX, JR_BASE, da);
+  emit_ldq(J, RCX, JR_BASE, da + 2*TVSIZE);
+  emit_rr(J, 0, 1, 0x01, -1, RCX, RAX);  /* add rax, rcx */
+  d3 = emit_jcc(J, CC_O);  /* overflow ends the loop */
+  emit_rr(J, 0, 1, 0x85, -1, RCX, RCX);  /* test rcx, rcx */
+  neg = emit_jcc(J, CC_S);
+  emit_mem(J, 0, 1, 0x3B, -1, RAX, JR_BASE, da + TVSIZE);  /* cmp rax, limit */
+  d4 = emit_jcc(J, CC_G);  /* !(idx <= limit) */
+  cont = emit_jmp(J);
+  patch_here(J, neg);
+  emit_mem(J, 0, 1, 0x3B, -1, RAX, JR_BASE, da + TVSIZE);
+  d5 = emit_jcc(J, CC_L);  /* !(limit <= idx) */
+  patch_here(J, cont);
+  emit_stq(J, JR_BASE, da, RAX);
+  emit_stq(J, JR_BASE, da + 3*TVSIZE, RAX);
+  emit_stimm(J, JR_BASE, da + 3*TVSIZE + TTOFF, LUA_TNUMINT);
+  emit_goto(J, pc, target);
+  patch_here(J, d1);
+  patch_here(J, d2);
+  patch_here(J, d3);
+  patch_here(J, d4);
+  patch_here(J, d5);
+}
+
+
+/*
+** 为第`pc`条指令生成机器码, 返回下一条需要编译的指令
+ */
+static int emit_instruction (JitState *J, int pc) {
+  Instruction i = J->p->code[pc];
+  OpCode op = quickbase(fusedfirst(GET_OPCODE(i)));
+  int a = GETARG_A(i);
+  int da = a*TVSIZE;
+  switch (op) {
+    case OP_MOVE: {
+      emit_copy(J, JR_BASE, da, JR_BASE, GETARG_B(i)*TVSIZE);
+      break;
+    }
+    case OP_LOADK: {
+      emit_copy(J, JR_BASE, da, JR_K, GETARG_Bx(i)*TVSIZE);
+      break;
+    }
+    case OP_LOADBOOL: {
+      emit_stimm(J, JR_BASE, da, GETARG_B(i));
+      emit_stimm(J, JR_BASE, da + TTOFF, LUA_TBOOLEAN);
+      if (GETARG_C(i)) jump_pc(J, emit_jmp(J), pc + 2);
+      break;
+    }
+    case OP_LOADNIL: {
+      int r;
+      for (r = a; r <= GETARG_B(i); r++)
+        emit_stimm(J, JR_BASE, r*TVSIZE + TTOFF, LUA_TNIL);
+      break;
+    }
+    case OP_GETUPVAL: {
+      int du = cast_int(offsetof(LClosure, upvals)) +
+               GETARG_B(i)*cast_int(sizeof(UpVal *));
+      emit_ldq(J, RAX, JR_CL, du);
+      emit_ldq(J, RAX, RAX, cast_int(offsetof(UpVal, v)));
+      emit_copy(J, JR_BASE, da, RAX, 0);
+      break;
+    }
+    case OP_GETGLOBAL: emit_call(J, h_getglobal, pc); break;
+    case OP_GETTABLE: emit_call(J, h_gettable, pc); break;
+    case OP_SETGLOBAL: emit_call(J, h_setglobal, pc); break;
+    case OP_SETUPVAL: emit_call(J, h_setupval, pc); break;
+    case OP_SETTABLE: emit_call(J, h_settable, pc); break;
+    case OP_NEWTABLE: emit_call(J, h_newtable, pc); break;
+    case OP_SELF: emit_call(J, h_self, pc); break;
+    case OP_ADD: emit_arith(J, pc, i, SSE_ADD, INT_ADD); break;
+    case OP_SUB: emit_arith(J, pc, i, SSE_SUB, INT_SUB); break;
+    case OP_MUL: emit_arith(J, pc, i, SSE_MUL, INT_MUL); break;
+    case OP_DIV: emit_arith(J, pc, i, SSE_DIV, INT_NONE); break;
+    case OP_MOD: case OP_POW: case OP_UNM: {
+      emit_call(J, h_arith, pc);
+      break;
+    }
+    case OP_NOT: {
+      emit_isfalse(J, JR_BASE, GETARG_B(i)*TVSIZE);
+      emit_std(J, JR_BASE, da, RAX);
+      emit_stimm(J, JR_BASE, da + TTOFF, LUA_TBOOLEAN);
+      break;
+    }
+    case OP_LEN: emit_call(J, h_len, pc); break;
+    case OP_CONCAT: emit_call(J, h_concat, pc); break;
+    case OP_JMP: {
+      emit_goto(J, pc, pc + 1 + GETARG_sBx(i));
+      break;
+    }
+    case OP_EQ: case OP_LT: case OP_LE: {
+      emit_compare(J, pc, i);
+      break;
+    }
+    case OP_TEST: {
+      emit_isfalse(J, JR_BASE, da);
+      e8(J, 0x3D); e32(J, GETARG_C(i));  /* cmp eax, C */
+      emit_cgoto(J, CC_NE, pc, pc + 2 + GETARG_sBx(J->p->code[pc+1]));
+      jump_pc(J, emit_jmp(J), pc + 2);
+      break;
+    }
+    case OP_TESTSET: {
+      int skip;
+      emit_isfalse(J, JR_BASE, GETARG_B(i)*TVSIZE);
+      e8(J, 0x3D); e32(J, GETARG_C(i));  /* cmp eax, C */
+      skip = emit_jcc(J, CC_E);
+      emit_copy(J, JR_BASE, da, JR_BASE, GETARG_B(i)*TVSIZE);
+      emit_goto(J, pc, pc + 2 + GETARG_sBx(J->p->code[pc+1]));
+      patch_here(J, skip);
+      jump_pc(J, emit_jmp(J), pc + 2);
+      break;
+    }
+    case OP_CALL: case OP_TAILCALL: case OP_RETURN: {
+      emit_exit(J, pc);  /* frame changes are left to the interpreter */
+      break;
+    }
+    case OP_FORLOOP: emit_forloop(J, pc, i); break;
+    case OP_FORPREP: {
+      emit_call(J, h_forprep, pc);
+      emit_goto(J, pc, pc + 1 + GETARG_sBx(i));
+      break;
+    }
+    case OP_TFORLOOP: {
+      emit_call(J, h_tforloop, pc);
+      emit_rr(J, 0, 0, 0x85, -1, RAX, RAX);  /* test eax, eax */
+      emit_cgoto(J, CC_NE, pc, pc + 2 + GETARG_sBx(J->p->code[pc+1]));
+      jump_pc(J, emit_jmp(J), pc + 2);
+      break;
+    }
+    case OP_SETLIST: {
+      emit_call(J, h_setlist, pc);
+      if (GETARG_C(i) == 0) return pc + 2;  /* skip extra argument */
+      break;
+    }
+    case OP_CLOSE: emit_call(J, h_close, pc); break;
+    case OP_CLOSURE: {
+      emit_call(J, h_closure, pc);
+      return pc + 1 + J->p->p[GETARG_Bx(i)]->nups;  /* skip pseudo-ins. */
+    }
+    case OP_VARARG: emit_call(J, h_vararg, pc); break;
+    default: lua_assert(0); break;
+  }
+  return pc + 1;
+}
+
+
+/*
+** 入口代码: 保存callee-saved寄存器, 装入固定寄存器后跳到`target`;
+** 出口代码: 恢复寄存器并返回到`luaJ_execute`
+ */
+static void emit_entry (JitState *J) {
+  emit_push(J, RBP); emit_push(J, RBX); emit_push(J, R12);
+  emit_push(J, R13); emit_push(J, R14); emit_push(J, R15);
+  e8(J, 0x48); e8(J, 0x83); e8(J, 0xEC); e8(J, 8);  /* sub rsp, 8 */
+  emit_rr(J, 0, 1, 0x89, -1, RDI, JR_L);  /* mov r13, rdi */
+  emit_ldq(J, RAX, JR_L, LOFF(ci));
+  emit_ldq(J, RAX, RAX, cast_int(offsetof(CallInfo, func)));
+  emit_ldq(J, JR_CL, RAX, 0);  /* cl = clvalue(L->ci->func) */
+  emit_ldq(J, JR_BASE, JR_L, LOFF(base));
+  emit_loadptr(J, JR_K, J->p->k);
+  e8(J, 0xFF); e8(J, 0xE6);  /* jmp rsi */
+  J->epilogue = J->pos;
+  e8(J, 0x48); e8(J, 0x83); e8(J, 0xC4); e8(J, 8);  /* add rsp, 8 */
+  emit_pop(J, R15); emit_pop(J, R14); emit_pop(J, R13);
+  emit_pop(J, R12); emit_pop(J, RBX); emit_pop(J, RBP);
+  e8(J, 0xC3);  /* ret */
+}
+
+
+static int assemble (JitState *J) {
+  Proto *p = J->p;
+  int pc = 0;
+  if (!ensure(J, 256)) return 0;
+  emit_entry(J);
+  while (pc < p->sizecode) {
+    int next;
+    if (!ensure(J, MAXINSTSIZE)) return 0;
+    J->pcoff[pc] = J->pos;
+    next = emit_instruction(J, pc);
+    while (++pc < next) J->pcoff[pc] = -1;  /* pseudo-instructions */
+  }
+  for (pc = 0; pc < J->nfix; pc++) {
+    lua_assert(J->pcoff[J->fixpc[pc]] >= 0);
+    patch_to(J, J->fixpos[pc], J->pcoff[J->fixpc[pc]]);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** 编译函数原型. 失败(内存不足)时记录一个空的JitCode, 不再尝试
+ */
+int luaJ_compile (lua_State *L, Proto *p) {
+  JitState J;
+  JitCode *j = luaM_new(L, JitCode);
+  void *mc;
+  j->mcode = NULL;
+  j->size = 0;
+  j->pcoff = NULL;
+  j->sizepcoff = 0;
+  j->entry = NULL;
+  p->jit = j;
+  j->pcoff = luaM_newvector(L, p->sizecode, int);
+  j->sizepcoff = p->sizecode;
+  J.L = L;
+  J.p = p;
+  J.buf = NULL;
+  J.size = J.pos = 0;
+  J.pcoff = j->pcoff;
+  J.nfix = 0;
+  J.fixpos = cast(int *, jit_realloc(&J, NULL, 0, 2*p->sizecode*sizeof(int)));
+  J.fixpc = cast(int *, jit_realloc(&J, NULL, 0, 2*p->sizecode*sizeof(int)));
+  if (J.fixpos != NULL && J.fixpc != NULL && assemble(&J)) {
+    mc = mmap(NULL, J.pos, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mc != MAP_FAILED) {
+      memcpy(mc, J.buf, J.pos);
+      if (mprotect(mc, J.pos, PROT_READ | PROT_EXEC) == 0) {
+        j->mcode = cast(unsigned char *, mc);
+        j->size = J.pos;
+        j->entry = (luaJ_Entry)mc;
+      }
+      else munmap(mc, J.pos);
+    }
+  }
+  jit_realloc(&J, J.fixpc, 2*p->sizecode*sizeof(int), 0);
+  jit_realloc(&J, J.fixpos, 2*p->sizecode*sizeof(int), 0);
+  jit_realloc(&J, J.buf, J.size, 0);
+  return j->mcode != NULL;
+}
+
+
+/*
+** 从`pc`处开始执行当前函数的机器码, 直到遇到需要解释器处理的指令;
+** 返回时`L->savedpc`指向该指令
+ */
+void luaJ_execute (lua_State *L, const Instruction *pc) {
+  Proto *p = curr_func(L)->l.p;
+  JitCode *j = p->jit;
+  lua_assert(j != NULL && j->pcoff[pc - p->code] >= 0);
+  (*j->entry)(L, j->mcode + j->pcoff[pc - p->code]);
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  JitCode *j = p->jit;
+  if (j->mcode != NULL)
+    munmap(j->mcode, j->size);
+  luaM_freearray(L, j->pcoff, j->sizepcoff, int);
+  luaM_free(L, j);
+  p->jit = NULL;
+}
+
+
+#else  /* }{ */
+
+
+int luaJ_compile (lua_State *L, Proto *p) {
+  UNUSED(L); UNUSED(p);
+  return 0;
+}
+
+
+void luaJ_execute (lua_State *L, const Instruction *pc) {
+  UNUSED(L); UNUSED(pc);
+  lua_assert(0);
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  UNUSED(L); UNUSED(p);
+}
+
+
+#endif  /* } */
@@ -0,0 +1,48 @@
+/*
+** $Id: ljit.h $
+** Baseline JIT compiler for x86-64
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+
+#include "lgc.h"
+#include "lobject.h"
+
+
+/* signature of the native entry stub: jump to `target' inside the code */
+typedef void (*luaJ_Entry) (lua_State *L, const void *target);
+
+
+/*
+** 函数原型编译生成的机器码.
+** 机器码与解释器共享同一套栈帧(base, savedpc, CallInfo), 因此可以在任意指令
+** 边界进入和退出: `pcoff[pc]`为第pc条指令对应的机器码偏移(伪指令为-1).
+** `mcode`为NULL表示编译失败, 此后该函数一直由解释器执行.
+ */
+typedef struct JitCode {
+  unsigned char *mcode;  /* executable code (mmap'ed) */
+  size_t size;  /* size of `mcode' */
+  int *pcoff;  /* offset in `mcode' of each instruction */
+  int sizepcoff;
+  luaJ_Entry entry;
+} JitCode;
+
+
+/*
+** 函数是否可以以机器码执行: 已编译成功, 或者热度达到阈值并编译成功.
+** 共享原型只读, 始终由解释器执行.
+ */
+#define luaJ_hot(L,p)	((p)->jit != NULL ? (p)->jit->mcode != NULL : \
+	(!isshared(obj2gco(p)) && \
+	 ++(p)->hotcount >= LUAI_JITHOT && luaJ_compile(L, p)))
+
+
+LUAI_FUNC int luaJ_compile (lua_State *L, Proto *p);
+LUAI_FUNC void luaJ_execute (lua_State *L, const Instruction *pc);
+LUAI_FUNC void luaJ_free (lua_State *L, Proto *p);
+
+
+#endif
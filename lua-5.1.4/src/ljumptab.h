@@ -0,0 +1,94 @@
+/*
+** $Id: ljumptab.h $
+** Jump Table for the Lua interpreter
+** See Copyright Notice in lua.h
+*/
+
+/*
+** 解释器跳转表(threaded code). 仅在`luaV_execute`函数体内被包含.
+** 使用GCC/Clang的"标签地址"扩展(&&label, goto *addr), 每个操作码的处理代码
+** 末尾直接取下一条指令并跳转至其处理代码, 不再回到单一的`switch`分派点,
+** 从而让每个操作码拥有独立的间接跳转, 提高分支预测命中率.
+ */
+
+#undef vmdispatch
+#undef vmcase
+#undef vmbreak
+
+#define vmdispatch(x)     goto *disptab[x];
+
+#define vmcase(l)     L_##l:
+
+#define vmbreak		{ vmfetch(); vmdispatch(GET_OPCODE(i)); }
+
+
+/* 顺序必须与lopcodes.h中的OpCode枚举一致 *//* ORDER OP */
+static const void *const disptab[NUM_OPCODES] = {
+
+#if 0
+** you can update the following list with this command:
+**
+**  sed -n '/^OP_/!d; s/OP_/\&\&L_OP_/ ; s/,.*/,/ ; s/\/.*// ; p'  lopcodes.h
+**
+#endif
+
+&&L_OP_MOVE,
+&&L_OP_LOADK,
+&&L_OP_LOADBOOL,
+&&L_OP_LOADNIL,
+&&L_OP_GETUPVAL,
+&&L_OP_GETGLOBAL,
+&&L_OP_GETTABLE,
+&&L_OP_SETGLOBAL,
+&&L_OP_SETUPVAL,
+&&L_OP_SETTABLE,
+&&L_OP_NEWTABLE,
+&&L_OP_SELF,
+&&L_OP_ADD,
+&&L_OP_SUB,
+&&L_OP_MUL,
+&&L_OP_DIV,
+&&L_OP_MOD,
+&&L_OP_POW,
+&&L_OP_UNM,
+&&L_OP_NOT,
+&&L_OP_LEN,
+&&L_OP_CONCAT,
+&&L_OP_JMP,
+&&L_OP_EQ,
+&&L_OP_LT,
+&&L_OP_LE,
+&&L_OP_TEST,
+&&L_OP_TESTSET,
+&&L_OP_CALL,
+&&L_OP_TAILCALL,
+&&L_OP_RETURN,
+&&L_OP_FORLOOP,
+&&L_OP_FORPREP,
+&&L_OP_TFORLOOP,
+&&L_OP_SETLIST,
+&&L_OP_CLOSE,
+&&L_OP_CLOSURE,
+&&L_OP_VARARG,
+&&L_OP_LOADKCALL,
+&&L_OP_MOVECALL,
+&&L_OP_GETGLOBALCALL,
+&&L_OP_GETTABLECALL,
+&&L_OP_SELFCALL,
+&&L_OP_LOADKSET,
+&&L_OP_ADDNN,
+&&L_OP_ADDNK,
+&&L_OP_SUBNN,
+&&L_OP_SUBNK,
+&&L_OP_MULNN,
+&&L_OP_MULNK,
+&&L_OP_DIVNN,
+&&L_OP_DIVNK,
+&&L_OP_MODNN,
+&&L_OP_MODNK,
+&&L_OP_LTNN,
+&&L_OP_LTNK,
+&&L_OP_LENN,
+&&L_OP_LENK
+
+};
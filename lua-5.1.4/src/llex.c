@@ -42,7 +42,7 @@ const char *const luaX_tokens [] = {
     "in", "local", "nil", "not", "or", "repeat",
     "return", "then", "true", "until", "while",
     "..", "...", "==", ">=", "<=", "~=",
-    "<number>", "<name>", "<string>", "<eof>",
+    "<number>", "<integer>", "<name>", "<string>", "<eof>",
     NULL
 };
 
@@ -78,7 +78,8 @@ void luaX_init (lua_State *L) {
     TString *ts = luaS_new(L, luaX_tokens[i]);
     luaS_fix(ts);  /* 修改gc颜色标志, 保留字不会被垃圾回收 */ /* reserved words are never collected */
     lua_assert(strlen(luaX_tokens[i])+1 <= TOKEN_LEN); /* 确保不超过最长保留字长度 */
-    ts->tsv.reserved = cast_byte(i+1);  /* `reserved` >= 1, 存放保留字的下标索引(类型标识), 便于快速定位; `reserved` 非零不可回收, GC过程直接忽略之 */ /* reserved word */
+    if (ts->tsv.reserved == 0)  /* 共享段中的字符串已经设置 */ /* shared strings are read-only */
+      ts->tsv.reserved = cast_byte(i+1);  /* `reserved` >= 1, 存放保留字的下标索引(类型标识), 便于快速定位; `reserved` 非零不可回收, GC过程直接忽略之 */ /* reserved word */
   }
 }
 
@@ -106,6 +107,7 @@ static const char *txtToken (LexState *ls, int token) {
     case TK_NAME:
     case TK_STRING:
     case TK_NUMBER:
+    case TK_INT:
       /* 若`token`为名称, 字符串或数值, 把ls->buff转成'\0'结束的C字符串 */
       save(ls, '\0');
       return luaZ_buffer(ls->buff);
@@ -146,8 +148,11 @@ TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
   lua_State *L = ls->L;
   TString *ts = luaS_newlstr(L, str, l);
   TValue *o = luaH_setstr(L, ls->fs->h, ts);  /* entry for `str' */
-  if (ttisnil(o))
+  if (ttisnil(o)) {
     setbvalue(o, 1); /* 确保不被垃圾回收 */ /* make sure `str' will not be collected */
+  }
+  else if (!isshortstr(ts))  /* 长字符串不唯一, 改用表中已有(被锚定)的对象 */
+    ts = rawtsvalue(keyfromval(o));  /* re-use the anchored one */
   return ts;
 }
 
@@ -236,9 +241,10 @@ static void trydecpoint (LexState *ls, SemInfo *seminfo) {
 
 /* LUA_NUMBER */
 /*
-** 循环读取`LUA_NUMBER`(内部实现为double)字面量
+** 循环读取`LUA_NUMBER`(内部实现为double)字面量.
+** 没有小数点和指数并且不溢出的字面量是整数(TK_INT)
  */
-static void read_numeral (LexState *ls, SemInfo *seminfo) {
+static int read_numeral (LexState *ls, SemInfo *seminfo) {
   lua_assert(isdigit(ls->current));
   do {
     save_and_next(ls);
@@ -248,9 +254,14 @@ static void read_numeral (LexState *ls, SemInfo *seminfo) {
   while (isalnum(ls->current) || ls->current == '_')
     save_and_next(ls);
   save(ls, '\0');
+#if defined(LUA_INTSUBTYPE)
+  if (luaO_str2int(luaZ_buffer(ls->buff), &seminfo->i))
+    return TK_INT;
+#endif
   buffreplace(ls, '.', ls->decpoint);  /* 小数点本地化 */ /* follow locale for decimal point */
   if (!luaO_str2d(luaZ_buffer(ls->buff), &seminfo->r))  /* format error? */
     trydecpoint(ls, seminfo); /* try to update decimal point separator */
+  return TK_NUMBER;
 }
 
 
@@ -461,10 +472,7 @@ static int llex (LexState *ls, SemInfo *seminfo) {
           else return TK_CONCAT;   /* .. */
         }
         else if (!isdigit(ls->current)) return '.';
-        else {
-          read_numeral(ls, seminfo);
-          return TK_NUMBER;
-        }
+        else return read_numeral(ls, seminfo);
       }
       case EOZ: {
         return TK_EOS;
@@ -475,10 +483,8 @@ static int llex (LexState *ls, SemInfo *seminfo) {
           next(ls);
           continue;
         }
-        else if (isdigit(ls->current)) {  /* 数值 */
-          read_numeral(ls, seminfo);
-          return TK_NUMBER;
-        }
+        else if (isdigit(ls->current))  /* 数值 */
+          return read_numeral(ls, seminfo);
         else if (isalpha(ls->current) || ls->current == '_') {
           /* identifier or reserved word */
           TString *ts;
@@ -38,7 +38,7 @@ enum RESERVED {
   TK_RETURN, TK_THEN, TK_TRUE, TK_UNTIL, TK_WHILE,
   /* other terminal symbols */
   /* `TK_CONCAT` ~ `TK_EOS`为非保留字的其它终结符(运算符, 字面量和文件结束等) */
-  TK_CONCAT, TK_DOTS, TK_EQ, TK_GE, TK_LE, TK_NE, TK_NUMBER,
+  TK_CONCAT, TK_DOTS, TK_EQ, TK_GE, TK_LE, TK_NE, TK_NUMBER, TK_INT,
   TK_NAME, TK_STRING, TK_EOS
 };
 
@@ -53,11 +53,12 @@ LUAI_DATA const char *const luaX_tokens [];
 
 /*
 ** 语义信息
-** 如果为TK_NUMBER类型, seminfo.r表示对应的数值;
+** 如果为TK_NUMBER类型, seminfo.r表示对应的数值; TK_INT类型为seminfo.i;
 ** 如果为TK_NAME或TK_STRING类型, seminfo.ts就表示对应的字符串
  */
 typedef union {
   lua_Number r;
+  l_int i;
   TString *ts;
 } SemInfo;  /* semantics information */
 
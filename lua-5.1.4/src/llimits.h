@@ -17,6 +17,11 @@
 
 typedef LUAI_UINT32 lu_int32;
 
+typedef LUAI_UINT64 lu_int64;
+
+/* type of the integer subtype of numbers */
+typedef LUAI_INT l_int;
+
 typedef LUAI_UMEM lu_mem;
 
 typedef LUAI_MEM l_mem;
@@ -101,6 +106,12 @@ typedef lu_int32 Instruction;
 #endif
 
 
+/* buckets of the string table migrated per new string while resizing */
+#ifndef STRTMOVE
+#define STRTMOVE	4
+#endif
+
+
 /* minimum size for string buffer */
 #ifndef LUA_MINBUFFER
 #define LUA_MINBUFFER	32
@@ -116,6 +127,11 @@ typedef lu_int32 Instruction;
 #define luai_threadyield(L)     {lua_unlock(L); lua_lock(L);}
 #endif
 
+/* is another thread waiting for the lock? */
+#ifndef luai_lockwaiting
+#define luai_lockwaiting(L)	0
+#endif
+
 
 /*
 ** macro to control inclusion of some hard tests on stack reallocation
@@ -291,6 +291,17 @@ static int gctm (lua_State *L) {
 }
 
 
+/*
+** __clone tag method: a cloned state does not unload the libraries
+** loaded by its template
+*/
+static int clonetm (lua_State *L) {
+  void **lib = (void **)luaL_checkudata(L, 1, "_LOADLIB");
+  *lib = NULL;
+  return 0;
+}
+
+
 static int ll_loadfunc (lua_State *L, const char *path, const char *sym) {
   void **reg = ll_register(L, path);
   if (*reg == NULL) *reg = ll_load(L, path);
@@ -630,6 +641,8 @@ LUALIB_API int luaopen_package (lua_State *L) {
   luaL_newmetatable(L, "_LOADLIB");
   lua_pushcfunction(L, gctm);
   lua_setfield(L, -2, "__gc");
+  lua_pushcfunction(L, clonetm);
+  lua_setfield(L, -2, "__clone");
   /* create `package' table */
   luaL_register(L, LUA_LOADLIBNAME, pk_funcs);
 #if defined(LUA_COMPAT_LOADLIB) 
@@ -24,7 +24,7 @@
 
 
 
-const TValue luaO_nilobject_ = {{NULL}, LUA_TNIL};
+const TValue luaO_nilobject_ = {NILCONSTANT};
 
 
 /*
@@ -75,11 +75,14 @@ int luaO_rawequalObj (const TValue *t1, const TValue *t2) {
     case LUA_TNIL:
       return 1;
     case LUA_TNUMBER:
+      if (ttisint(t1) && ttisint(t2)) return ivalue(t1) == ivalue(t2);
       return luai_numeq(nvalue(t1), nvalue(t2));
     case LUA_TBOOLEAN:
       return bvalue(t1) == bvalue(t2);  /* boolean true must be 1 !! */
     case LUA_TLIGHTUSERDATA:
       return pvalue(t1) == pvalue(t2);
+    case LUA_TSTRING:
+      return eqstr(rawtsvalue(t1), rawtsvalue(t2));
     default:
       lua_assert(iscollectable(t1));
       return gcvalue(t1) == gcvalue(t2);
@@ -98,6 +101,7 @@ int luaO_str2d (const char *s, lua_Number *result) {
   if (endptr == s) return 0;  /* conversion failed */
   if (*endptr == 'x' || *endptr == 'X')  /* 十六进制? */ /* maybe an hexadecimal constant? */
     *result = cast_num(strtoul(s, &endptr, 16));
+  canonnan(*result);
   if (*endptr == '\0') return 1;  /* most common case */
   while (isspace(cast(unsigned char, *endptr))) endptr++; /* 忽略空白字符 */
   if (*endptr != '\0') return 0;  /* invalid trailing characters? */
@@ -105,6 +109,54 @@ int luaO_str2d (const char *s, lua_Number *result) {
 }
 
 
+/*
+** 字符串转整数: 只接受(可带符号的)十进制或十六进制整数, 并且不能溢出;
+** 否则返回0, 由`luaO_str2d`按浮点数转换
+ */
+int luaO_str2int (const char *s, l_int *result) {
+  lu_int64 a = 0;
+  int neg = 0;
+  int empty = 1;
+  while (isspace(cast(unsigned char, *s))) s++;
+  if (*s == '-') { s++; neg = 1; }
+  else if (*s == '+') s++;
+  if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {  /* hexadecimal? */
+    for (s += 2; isxdigit(cast(unsigned char, *s)); s++, empty = 0) {
+      int d = isdigit(cast(unsigned char, *s)) ? *s - '0'
+                                               : (*s | 0x20) - 'a' + 10;
+      if (a > (cast(lu_int64, LUAI_INTMAX) >> 4)) return 0;  /* overflow */
+      a = a * 16 + d;
+    }
+  }
+  else {
+    for (; isdigit(cast(unsigned char, *s)); s++, empty = 0) {
+      int d = *s - '0';
+      if (a > (cast(lu_int64, LUAI_INTMAX) - d) / 10) return 0;  /* overflow */
+      a = a * 10 + d;
+    }
+  }
+  while (isspace(cast(unsigned char, *s))) s++;
+  if (empty || *s != '\0') return 0;
+  *result = neg ? -cast(l_int, a) : cast(l_int, a);
+  return 1;
+}
+
+
+/*
+** 浮点数是否恰好等于某个整数(NaN, 无穷大和超出范围的值都不是)
+ */
+int luaO_num2int (lua_Number n, l_int *result) {
+  if (n >= cast_num(LUAI_INTMIN) && n < -cast_num(LUAI_INTMIN)) {
+    l_int i = cast(l_int, n);
+    if (luai_numeq(cast_num(i), n)) {
+      *result = i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
 
 static void pushstr (lua_State *L, const char *str) {
   setsvalue2s(L, L->top, luaS_new(L, str));
@@ -136,7 +188,7 @@ const char *luaO_pushvfstring (lua_State *L, const char *fmt, va_list argp) {
         break;
       }
       case 'd': {
-        setnvalue(L->top, cast_num(va_arg(argp, int)));
+        setivalue(L->top, va_arg(argp, int));
         incr_top(L);
         break;
       }
@@ -170,7 +222,7 @@ const char *luaO_pushvfstring (lua_State *L, const char *fmt, va_list argp) {
   pushstr(L, fmt);
   luaV_concat(L, n+1, cast_int(L->top - L->base) - 1);
   L->top -= n;
-  return svalue(L->top - 1);
+  return luaS_tocstr(L, rawtsvalue(L->top - 1));
 }
 
 
@@ -62,13 +62,23 @@ typedef struct GCheader {
 
 
 
+/*
+** 整数子类型的类型标记: 低4位仍为LUA_TNUMBER, 因此`ttype`对两种数值
+** 都返回LUA_TNUMBER; `rawtt`区分二者
+ */
+#define LUA_TNUMINT	(LUA_TNUMBER | (1 << 4))
+
+
 /*
 ** Union of all Lua values
 */
+#if !defined(LUA_NANBOX)	/* { */
+
 typedef union {
   GCObject *gc; /* 可被gc的对象 */
   void *p;      /* light userdata类型 */
   lua_Number n; /* 数值类型 */
+  l_int i;      /* 数值的整数子类型 */
   int b;        /* 布尔类型 */
 } Value;
 
@@ -117,45 +127,45 @@ typedef struct lua_TValue {
   TValuefields;
 } TValue;
 
+/* initializer of a nil TValue */
+#define NILCONSTANT	{NULL}, LUA_TNIL
+
 
 /* Macros to test type */
 /* 类型检测宏 */
-#define ttisnil(o)	(ttype(o) == LUA_TNIL)
-#define ttisnumber(o)	(ttype(o) == LUA_TNUMBER)
-#define ttisstring(o)	(ttype(o) == LUA_TSTRING)
-#define ttistable(o)	(ttype(o) == LUA_TTABLE)
-#define ttisfunction(o)	(ttype(o) == LUA_TFUNCTION)
-#define ttisboolean(o)	(ttype(o) == LUA_TBOOLEAN)
-#define ttisuserdata(o)	(ttype(o) == LUA_TUSERDATA)
-#define ttisthread(o)	(ttype(o) == LUA_TTHREAD)
-#define ttislightuserdata(o)	(ttype(o) == LUA_TLIGHTUSERDATA)
+#define ttisnil(o)	(rawtt(o) == LUA_TNIL)
+#define ttisstring(o)	(rawtt(o) == LUA_TSTRING)
+#define ttistable(o)	(rawtt(o) == LUA_TTABLE)
+#define ttisfunction(o)	(rawtt(o) == LUA_TFUNCTION)
+#define ttisboolean(o)	(rawtt(o) == LUA_TBOOLEAN)
+#define ttisuserdata(o)	(rawtt(o) == LUA_TUSERDATA)
+#define ttisthread(o)	(rawtt(o) == LUA_TTHREAD)
+#define ttislightuserdata(o)	(rawtt(o) == LUA_TLIGHTUSERDATA)
 
 /* Macros to access values */
 /* 取值相关宏 */
-#define ttype(o)	((o)->tt)
+#define rawtt(o)	((o)->tt)
 #define gcvalue(o)	check_exp(iscollectable(o), (o)->value.gc)
 #define pvalue(o)	check_exp(ttislightuserdata(o), (o)->value.p)
-#define nvalue(o)	check_exp(ttisnumber(o), (o)->value.n)
-#define rawtsvalue(o)	check_exp(ttisstring(o), &(o)->value.gc->ts)
-#define tsvalue(o)	(&rawtsvalue(o)->tsv)
-#define rawuvalue(o)	check_exp(ttisuserdata(o), &(o)->value.gc->u)
-#define uvalue(o)	(&rawuvalue(o)->uv)
-#define clvalue(o)	check_exp(ttisfunction(o), &(o)->value.gc->cl)
-#define hvalue(o)	check_exp(ttistable(o), &(o)->value.gc->h)
 #define bvalue(o)	check_exp(ttisboolean(o), (o)->value.b)
-#define thvalue(o)	check_exp(ttisthread(o), &(o)->value.gc->th)
-
-#define l_isfalse(o)	(ttisnil(o) || (ttisboolean(o) && bvalue(o) == 0))
 
-/*
-** for internal debug only
-*/
-#define checkconsistency(obj) \
-  lua_assert(!iscollectable(obj) || (ttype(obj) == (obj)->value.gc->gch.tt))
-
-#define checkliveness(g,obj) \
-  lua_assert(!iscollectable(obj) || \
-  ((ttype(obj) == (obj)->value.gc->gch.tt) && !isdead(g, (obj)->value.gc)))
+#if defined(LUA_INTSUBTYPE)
+#define ttype(o)	(rawtt(o) & 0x0F)
+#define ttisnumber(o)	((rawtt(o) & ~(1 << 4)) == LUA_TNUMBER)
+#define ttisint(o)	(rawtt(o) == LUA_TNUMINT)
+#define ttisflt(o)	(rawtt(o) == LUA_TNUMBER)
+#define ivalue(o)	check_exp(ttisint(o), (o)->value.i)
+#define fltvalue(o)	check_exp(ttisflt(o), (o)->value.n)
+/* value of any number as a lua_Number */
+#define nvalue(o)	check_exp(ttisnumber(o), \
+	ttisint(o) ? cast_num((o)->value.i) : (o)->value.n)
+#define setivalue(obj,x) \
+  { TValue *i_o=(obj); i_o->value.i=(x); i_o->tt=LUA_TNUMINT; }
+#else
+#define ttype(o)	rawtt(o)
+#define ttisnumber(o)	(rawtt(o) == LUA_TNUMBER)
+#define nvalue(o)	check_exp(ttisnumber(o), (o)->value.n)
+#endif
 
 
 /* Macros to set values */
@@ -172,44 +182,166 @@ typedef struct lua_TValue {
   { TValue *i_o=(obj); i_o->value.b=(x); i_o->tt=LUA_TBOOLEAN; }
 
 /* 赋值相关宏. GC部分 */
-#define setsvalue(L,obj,x) \
+#define setgcvalue(L,obj,x,t) \
   { TValue *i_o=(obj); \
-    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TSTRING; \
+    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=(t); \
     checkliveness(G(L),i_o); }
 
-#define setuvalue(L,obj,x) \
-  { TValue *i_o=(obj); \
-    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TUSERDATA; \
-    checkliveness(G(L),i_o); }
+/* 对象赋值 & 浅拷贝 */
+#define setobj(L,obj1,obj2) \
+  { const TValue *o2=(obj2); TValue *o1=(obj1); \
+    o1->value = o2->value; o1->tt=o2->tt; \
+    checkliveness(G(L),o1); }
 
-#define setthvalue(L,obj,x) \
-  { TValue *i_o=(obj); \
-    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TTHREAD; \
-    checkliveness(G(L),i_o); }
+#define setttype(obj, t) (rawtt(obj) = (t))
 
-#define setclvalue(L,obj,x) \
-  { TValue *i_o=(obj); \
-    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TFUNCTION; \
-    checkliveness(G(L),i_o); }
+/* >= 4 的数据类型会被垃圾回收*/
+#define iscollectable(o)	(ttype(o) >= LUA_TSTRING)
 
-#define sethvalue(L,obj,x) \
+/* numbers coming from outside need no special treatment */
+#define canonnan(x)	((void)0)
+
+#else	/* }{ */
+
+/*
+** NaN-boxing: 每个值只占8字节.
+** 数值直接以double存储; 其余类型的值编码在负quiet NaN中:
+**   位63..47  0x1FFF1 + 类型    (大于任何一个double的位模式, 包括NaN 0xFFF8...)
+**   位46..0   指针或布尔值      (x86-64用户态指针只有47位)
+** 运算只会产生或传播已有的NaN, 因此只需在数值从外部进入时(C API, 字符串
+** 转换, 预编译代码中的常量)把NaN规范化为0xFFF8000000000000, 见`canonnan`.
+ */
+typedef union {
+  lu_int64 u;  /* raw bits */
+  lua_Number n;
+} Value;
+
+#define TValuefields	Value value
+
+typedef struct lua_TValue {
+  TValuefields;
+} TValue;
+
+#define NB_TAGSHIFT	47
+#define NB_PAYLOAD	((cast(lu_int64, 1) << NB_TAGSHIFT) - 1)
+#define NB_NAN		(cast(lu_int64, 0xFFF8) << 48)  /* canonical NaN */
+
+/* high bits of a boxed value of type `t' */
+#define nbtag(t)	((cast(lu_int64, 0x1FFF1) + (t)) << NB_TAGSHIFT)
+#define nbpayload(o)	((o)->value.u & NB_PAYLOAD)
+/* box pointer `x' with tag `t' (`x' is evaluated only once) */
+#define nbsetptr(o,t,x) \
+  { size_t p_=cast(size_t, (x)); lua_assert((p_ & ~NB_PAYLOAD) == 0); \
+    (o)->value.u=nbtag(t) | cast(lu_int64, p_); }
+#define nbistag(o,t)	(((o)->value.u >> NB_TAGSHIFT) == \
+			  (nbtag(t) >> NB_TAGSHIFT))
+
+/* initializer of a nil TValue */
+#define NILCONSTANT	{nbtag(LUA_TNIL)}
+
+/* Macros to test type */
+/* 类型检测宏: 数值是小于所有类型标记的位模式 */
+#define ttisnil(o)	((o)->value.u == nbtag(LUA_TNIL))
+#define ttisnumber(o)	((o)->value.u < nbtag(LUA_TNIL))
+#define ttisstring(o)	nbistag(o, LUA_TSTRING)
+#define ttistable(o)	nbistag(o, LUA_TTABLE)
+#define ttisfunction(o)	nbistag(o, LUA_TFUNCTION)
+#define ttisboolean(o)	nbistag(o, LUA_TBOOLEAN)
+#define ttisuserdata(o)	nbistag(o, LUA_TUSERDATA)
+#define ttisthread(o)	nbistag(o, LUA_TTHREAD)
+#define ttislightuserdata(o)	nbistag(o, LUA_TLIGHTUSERDATA)
+
+/* Macros to access values */
+/* 取值相关宏 */
+#define rawtt(o)	ttype(o)
+#define ttype(o)	(ttisnumber(o) ? LUA_TNUMBER : \
+	cast_int(((o)->value.u >> NB_TAGSHIFT) & 0xF) - 1)
+#define gcvalue(o)	check_exp(iscollectable(o), \
+	cast(GCObject *, cast(size_t, nbpayload(o))))
+#define pvalue(o)	check_exp(ttislightuserdata(o), \
+	cast(void *, cast(size_t, nbpayload(o))))
+#define nvalue(o)	check_exp(ttisnumber(o), (o)->value.n)
+#define bvalue(o)	check_exp(ttisboolean(o), cast_int(nbpayload(o)))
+
+
+/* Macros to set values */
+/* 赋值相关宏 */
+#define setnilvalue(obj) ((obj)->value.u=nbtag(LUA_TNIL))
+
+#define setnvalue(obj,x) \
+  { TValue *i_o=(obj); i_o->value.n=(x); lua_assert(ttisnumber(i_o)); }
+
+#define setpvalue(obj,x) \
+  { TValue *i_o=(obj); nbsetptr(i_o, LUA_TLIGHTUSERDATA, x); }
+
+#define setbvalue(obj,x) \
   { TValue *i_o=(obj); \
-    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TTABLE; \
-    checkliveness(G(L),i_o); }
+    i_o->value.u=nbtag(LUA_TBOOLEAN) | cast(lu_int64, (x) != 0); }
 
-#define setptvalue(L,obj,x) \
+/* 赋值相关宏. GC部分 */
+#define setgcvalue(L,obj,x,t) \
   { TValue *i_o=(obj); \
-    i_o->value.gc=cast(GCObject *, (x)); i_o->tt=LUA_TPROTO; \
+    nbsetptr(i_o, t, x); \
     checkliveness(G(L),i_o); }
 
-
-
 /* 对象赋值 & 浅拷贝 */
 #define setobj(L,obj1,obj2) \
   { const TValue *o2=(obj2); TValue *o1=(obj1); \
-    o1->value = o2->value; o1->tt=o2->tt; \
+    o1->value = o2->value; \
     checkliveness(G(L),o1); }
 
+/* change the type keeping the payload (used for dead keys) */
+#define setttype(obj, t) \
+	((obj)->value.u = nbtag(t) | nbpayload(obj))
+
+/* 类型标记有序, 可回收类型的位模式最大 */
+#define iscollectable(o)	((o)->value.u >= nbtag(LUA_TSTRING))
+
+/* NaN coming from outside may collide with a boxed value */
+#define canonnan(x) \
+  { if (luai_numisnan(x)) { Value v_; v_.u = NB_NAN; (x) = v_.n; } }
+
+#endif	/* } */
+
+
+/* numbers without integer subtype: every number is a lua_Number */
+#if !defined(LUA_INTSUBTYPE)
+#define ttisint(o)	((void)(o), 0)
+#define ttisflt(o)	ttisnumber(o)
+#define ivalue(o)	cast(l_int, nvalue(o))
+#define fltvalue(o)	nvalue(o)
+#define setivalue(obj,x)	setnvalue(obj, cast_num(x))
+#endif
+
+
+#define rawtsvalue(o)	check_exp(ttisstring(o), &gcvalue(o)->ts)
+#define tsvalue(o)	(&rawtsvalue(o)->tsv)
+#define rawuvalue(o)	check_exp(ttisuserdata(o), &gcvalue(o)->u)
+#define uvalue(o)	(&rawuvalue(o)->uv)
+#define clvalue(o)	check_exp(ttisfunction(o), &gcvalue(o)->cl)
+#define hvalue(o)	check_exp(ttistable(o), &gcvalue(o)->h)
+#define thvalue(o)	check_exp(ttisthread(o), &gcvalue(o)->th)
+
+#define l_isfalse(o)	(ttisnil(o) || (ttisboolean(o) && bvalue(o) == 0))
+
+/*
+** for internal debug only
+*/
+#define checkconsistency(obj) \
+  lua_assert(!iscollectable(obj) || (ttype(obj) == gcvalue(obj)->gch.tt))
+
+#define checkliveness(g,obj) \
+  lua_assert(!iscollectable(obj) || \
+  ((ttype(obj) == gcvalue(obj)->gch.tt) && !isdead(g, gcvalue(obj))))
+
+
+#define setsvalue(L,obj,x)	setgcvalue(L,obj,x,LUA_TSTRING)
+#define setuvalue(L,obj,x)	setgcvalue(L,obj,x,LUA_TUSERDATA)
+#define setthvalue(L,obj,x)	setgcvalue(L,obj,x,LUA_TTHREAD)
+#define setclvalue(L,obj,x)	setgcvalue(L,obj,x,LUA_TFUNCTION)
+#define sethvalue(L,obj,x)	setgcvalue(L,obj,x,LUA_TTABLE)
+#define setptvalue(L,obj,x)	setgcvalue(L,obj,x,LUA_TPROTO)
+
 
 /*
 ** different types of sets, according to destination
@@ -230,12 +362,6 @@ typedef struct lua_TValue {
 #define setobj2n	setobj
 #define setsvalue2n	setsvalue
 
-#define setttype(obj, tt) (ttype(obj) = (tt))
-
-
-/* >= 4 的数据类型会被垃圾回收*/
-#define iscollectable(o)	(ttype(o) >= LUA_TSTRING)
-
 
 
 typedef TValue *StkId;  /* 栈元素引用 *//* index to stack elements */
@@ -248,15 +374,50 @@ typedef union TString {
   L_Umaxalign dummy;  /* ensures maximum alignment for strings */
   struct {
     CommonHeader;
-    lu_byte reserved; /* 是否保留字. 词法分析时便于快速判断字符串是否为保留字 @see `enum RESERVED` 和 `luaX_tokens` */
-    unsigned int hash;/* 字符串的散列值. lua 5.2 以后区分长字符串和短字符串, 为避免Hash Dos, 长字符串不再内部化 */
+    lu_byte reserved; /* 是否保留字. 词法分析时便于快速判断字符串是否为保留字 @see `enum RESERVED` 和 `luaX_tokens`; 绳索字符串为ROPESTR */
+    lu_byte hashed;   /* 长字符串: `hash`是否已经计算 */ /* long strings: `hash' is valid */
+    unsigned int hash;/* 字符串的散列值. 长字符串(见LUAI_MAXSHORTLEN)不内部化, 计算散列之前这里保存种子 */
     size_t len;       /* 字符串长度 */
   } tsv;
 } TString;
 
 
+/*
+** 绳索字符串: 拼接的结果不自带字节, 只记录长度和指向共享缓冲的指针.
+** 缓冲只在末尾追加, 已有字符串的字节不会改变; 长度等于`used`的字符串
+** 再拼接时直接追加到同一个缓冲, 所以`s = s .. x`的循环是线性的.
+** 缓冲也是API中的`lua_Rope`, 库用它构造可以不复制就成为字符串的内容
+*/
+typedef struct lua_Rope {
+  size_t used;  /* bytes written (followed by a '\0') */
+  size_t size;  /* capacity; the bytes follow the header */
+  int refs;  /* strings (and API handles) on this buffer */
+  int sealed;  /* C code holds the bytes: no more appends */
+} Rope;
+
+#define ropebytes(r)	cast(char *, (r) + 1)
+
+
+#if defined(LUA_ROPES)
+
+#define ROPESTR	0xFF  /* `reserved' of rope strings (never a keyword) */
+
+#define isrope(ts)	((ts)->tsv.reserved == ROPESTR)
+#define ropeof(ts)	(*cast(Rope **, (ts) + 1))
+
+/* 获取字符串字节的指针. 绳索字符串不一定以'\0'结尾, 见`luaS_tocstr` */
+#define getstr(ts)	(isrope(ts) ? cast(const char *, ropebytes(ropeof(ts))) \
+                                    : cast(const char *, (ts) + 1))
+
+#else
+
+#define isrope(ts)	0
+
 /* 获取C字符串的原始指针 */
 #define getstr(ts)	cast(const char *, (ts) + 1)
+
+#endif
+
 #define svalue(o)       getstr(rawtsvalue(o))
 
 
@@ -289,6 +450,8 @@ typedef struct Proto {
   Instruction *code; /* 指令列表/数组: 存放函数编译后生成的虚拟机指令 */
   struct Proto **p;  /* Proto表：嵌套于该函数的所有内部函数的Proto列表, OP_CLOSURE指令中的proto id通过proto表进行索引 */ /* functions defined inside the function */
   int *lineinfo;  /* 指令行号信息, 调试之用 */ /* map from opcodes to source lines */
+  int *icache;  /* 内联缓存, 与`code`一一对应: 常量字符串键上次命中的哈希节点下标; 算术/比较指令记录是否被去快速化 */
+  struct JitCode *jit;  /* JIT编译生成的机器码, 未编译时为NULL. @see ljit.h */
   struct LocVar *locvars;  /* 局部变量信息: 函数中的所有局部变量名称及其生命周期. 由于所有局部变量在运行期都转化成了寄存器id, 这些信息仅供debug使用 */ /* information about local variables */
   TString **upvalues;  /* upvalue names */
   TString  *source;     /* 函数信息, 调试之用 */
@@ -300,6 +463,8 @@ typedef struct Proto {
   int sizelocvars; /* `localvars` 数组长度*/
   int linedefined;      /* 函数定义起始行号, 即 `function` 关键字所在的行号 */
   int lastlinedefined;  /* 函数定义结束行号, 即 `end` 关键字所在的行号 */
+  int hotcount;  /* 热度计数: 调用及循环回跳次数, 达到LUAI_JITHOT时触发JIT编译 */
+  int icbase;  /* 共享原型: 本原型的缓存在各状态`icscratch`中的起始下标 */
   GCObject *gclist;
   lu_byte nups;       /* upvalue个数 *//* number of upvalues */
   lu_byte numparams;  /* 参数个数 */
@@ -407,6 +572,20 @@ typedef struct Node {
   TKey i_key;
 } Node;
 
+#if defined(LUA_SHAPES)
+/*
+** 形状: 表的字符串键布局, 第i个键的值保存在表的第i个槽位. 形状创建后
+** 不再改变, 增加一个键会转移到另一个形状(`parent`加上该键)
+ */
+typedef struct Shape {
+  struct Shape *parent;  /* shape without the last key */
+  struct Shape *hnext;  /* chain in the transition table */
+  int nkeys;
+  TString *keys[1];  /* keys in slot order */
+} Shape;
+#endif
+
+
 /*
 ** table是一个数组和散列表的混合数据结构. key为整数时数据保存在数组中; 其他类型保存在散列表中
  */
@@ -420,6 +599,10 @@ typedef struct Table {
   Node *lastfree;  /* Hash桶部分尾指针, 最后一个空闲位置 */ /* any free position is before this position */
   GCObject *gclist;
   int sizearray;  /* 数组部分大小 */ /* size of `array' array */
+#if defined(LUA_SHAPES)
+  struct Shape *shape;  /* 形状模式下的键布局, 散列模式为NULL */ /* key layout */
+  TValue *slots;  /* 形状键对应的值 */ /* values of the shape keys */
+#endif
 } Table;
 
 
@@ -446,6 +629,8 @@ LUAI_FUNC int luaO_int2fb (unsigned int x);
 LUAI_FUNC int luaO_fb2int (int x);
 LUAI_FUNC int luaO_rawequalObj (const TValue *t1, const TValue *t2);
 LUAI_FUNC int luaO_str2d (const char *s, lua_Number *result);
+LUAI_FUNC int luaO_str2int (const char *s, l_int *result);
+LUAI_FUNC int luaO_num2int (lua_Number n, l_int *result);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt,
                                                        va_list argp);
 LUAI_FUNC const char *luaO_pushfstring (lua_State *L, const char *fmt, ...);
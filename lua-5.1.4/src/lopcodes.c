@@ -52,6 +52,26 @@ const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSE",
   "CLOSURE",
   "VARARG",
+  "LOADKCALL",
+  "MOVECALL",
+  "GETGLOBALCALL",
+  "GETTABLECALL",
+  "SELFCALL",
+  "LOADKSET",
+  "ADDNN",
+  "ADDNK",
+  "SUBNN",
+  "SUBNK",
+  "MULNN",
+  "MULNK",
+  "DIVNN",
+  "DIVNK",
+  "MODNN",
+  "MODNK",
+  "LTNN",
+  "LTNK",
+  "LENN",
+  "LENK",
   NULL
 };
 
@@ -103,5 +123,38 @@ const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, OpArgN, OpArgN, iABC)		/* OP_CLOSE */
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
+ ,opmode(0, 1, OpArgK, OpArgN, iABx)		/* OP_LOADKCALL */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC)		/* OP_MOVECALL */
+ ,opmode(0, 1, OpArgK, OpArgN, iABx)		/* OP_GETGLOBALCALL */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETTABLECALL */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_SELFCALL */
+ ,opmode(0, 1, OpArgK, OpArgN, iABx)		/* OP_LOADKSET */
+ ,opmode(0, 1, OpArgR, OpArgR, iABC)		/* OP_ADDNN */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_ADDNK */
+ ,opmode(0, 1, OpArgR, OpArgR, iABC)		/* OP_SUBNN */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_SUBNK */
+ ,opmode(0, 1, OpArgR, OpArgR, iABC)		/* OP_MULNN */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_MULNK */
+ ,opmode(0, 1, OpArgR, OpArgR, iABC)		/* OP_DIVNN */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_DIVNK */
+ ,opmode(0, 1, OpArgR, OpArgR, iABC)		/* OP_MODNN */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_MODNK */
+ ,opmode(1, 0, OpArgR, OpArgR, iABC)		/* OP_LTNN */
+ ,opmode(1, 0, OpArgR, OpArgK, iABC)		/* OP_LTNK */
+ ,opmode(1, 0, OpArgR, OpArgR, iABC)		/* OP_LENN */
+ ,opmode(1, 0, OpArgR, OpArgK, iABC)		/* OP_LENK */
 };
 
+
+/*
+** 超级指令由哪两条指令合并而成. 顺序与OP_LOADKCALL..OP_LOADKSET一致
+ */
+const lu_byte luaP_fusedops[NUM_FUSEDOPS][2] = {
+/*  first         second		   superinstruction	*/
+  {OP_LOADK,     OP_CALL}		/* OP_LOADKCALL */
+ ,{OP_MOVE,      OP_CALL}		/* OP_MOVECALL */
+ ,{OP_GETGLOBAL, OP_CALL}		/* OP_GETGLOBALCALL */
+ ,{OP_GETTABLE,  OP_CALL}		/* OP_GETTABLECALL */
+ ,{OP_SELF,      OP_CALL}		/* OP_SELFCALL */
+ ,{OP_LOADK,     OP_SETTABLE}		/* OP_LOADKSET */
+};
@@ -266,11 +266,60 @@ OP_SETLIST,/*	A B C	R(A)[(C-1)*FPF+i] := R(A+i), 1 <= i <= B	*/	/* 设置表一
 OP_CLOSE,/*	A 	close all variables in the stack up to (>=) R(A)*/			/* 关闭用作 upvalue 的一系列局部变量 */
 OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx], R(A), ... ,R(A+n))	*/ /* 创建一函数原型的闭包 */
 
-OP_VARARG/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/				/* 将可变数量参数赋给寄存器 */
+OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-1) = vararg		*/				/* 将可变数量参数赋给寄存器 */
+
+/*
+超级指令(superinstruction): 编译结束时由`luaK_fuse`把相邻两条指令中的第一条
+改写而成, 第二条指令保持原样. 虚拟机执行完第一条的语义后不经分派直接执行
+第二条, 因此跳转到第二条指令依然正确. 操作数格式与第一条指令相同.
+ */
+OP_LOADKCALL,/*	A Bx	R(A) := Kst(Bx); next is OP_CALL		*/				/* LOADK + CALL */
+OP_MOVECALL,/*	A B	R(A) := R(B); next is OP_CALL			*/				/* MOVE + CALL */
+OP_GETGLOBALCALL,/*	A Bx	R(A) := Gbl[Kst(Bx)]; next is OP_CALL		*/	/* GETGLOBAL + CALL */
+OP_GETTABLECALL,/*	A B C	R(A) := R(B)[RK(C)]; next is OP_CALL		*/	/* GETTABLE + CALL */
+OP_SELFCALL,/*	A B C	R(A+1) := R(B); R(A) := R(B)[RK(C)]; next is OP_CALL */ /* SELF + CALL */
+OP_LOADKSET,/*	A Bx	R(A) := Kst(Bx); next is OP_SETTABLE		*/		/* LOADK + SETTABLE */
+
+/*
+快速化(quickened)指令: 编译器从不生成, 由虚拟机在运行期把操作数均为数值的
+算术/比较指令改写而成, NN表示两个寄存器操作数, NK表示C为数值常量.
+操作数类型不符时改写回原指令(去快速化). 转储时总是写出原指令.
+ */
+OP_ADDNN,/*	A B C	R(A) := R(B) + R(C)				*/						/* 数值加法 */
+OP_ADDNK,/*	A B C	R(A) := R(B) + K(C)				*/						/* 数值加常量 */
+OP_SUBNN,/*	A B C	R(A) := R(B) - R(C)				*/
+OP_SUBNK,/*	A B C	R(A) := R(B) - K(C)				*/
+OP_MULNN,/*	A B C	R(A) := R(B) * R(C)				*/
+OP_MULNK,/*	A B C	R(A) := R(B) * K(C)				*/
+OP_DIVNN,/*	A B C	R(A) := R(B) / R(C)				*/
+OP_DIVNK,/*	A B C	R(A) := R(B) / K(C)				*/
+OP_MODNN,/*	A B C	R(A) := R(B) % R(C)				*/
+OP_MODNK,/*	A B C	R(A) := R(B) % K(C)				*/
+OP_LTNN,/*	A B C	if ((R(B) <  R(C)) ~= A) then pc++		*/			/* 数值小于条件测试 */
+OP_LTNK,/*	A B C	if ((R(B) <  K(C)) ~= A) then pc++		*/
+OP_LENN,/*	A B C	if ((R(B) <= R(C)) ~= A) then pc++		*/			/* 数值小于等于条件测试 */
+OP_LENK/*	A B C	if ((R(B) <= K(C)) ~= A) then pc++		*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_VARARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_LENK) + 1)
+
+/* 快速化指令位于枚举末尾 */
+#define isquickop(o)	((o) >= OP_ADDNN)
+
+/* 超级指令 */
+#define isfusedop(o)	((o) >= OP_LOADKCALL && (o) <= OP_LOADKSET)
+#define NUM_FUSEDOPS	(cast(int, OP_LOADKSET) - cast(int, OP_LOADKCALL) + 1)
+
+/* 超级指令对应的第一条/第二条原指令 */
+#define fusedfirst(o)	(isfusedop(o) ? \
+	cast(OpCode, luaP_fusedops[(o) - OP_LOADKCALL][0]) : (o))
+#define fusedsecond(o)	cast(OpCode, luaP_fusedops[(o) - OP_LOADKCALL][1])
+
+/* 快速化指令对应的原指令 */
+#define quickbase(o)	(!isquickop(o) ? (o) : \
+	(o) < OP_LTNN ? cast(OpCode, OP_ADD + ((o) - OP_ADDNN)/2) : \
+	                cast(OpCode, OP_LT + ((o) - OP_LTNN)/2))
 
 
 
@@ -330,6 +379,8 @@ LUAI_DATA const lu_byte luaP_opmodes[NUM_OPCODES];
 
 LUAI_DATA const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 
+LUAI_DATA const lu_byte luaP_fusedops[NUM_FUSEDOPS][2];  /* pairs fused by superinstructions */
+
 
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
@@ -27,6 +27,7 @@ typedef enum {
   VFALSE,
   VK,		/* info = index of constant in `k' */
   VKNUM,	/* nval = numerical value */
+  VKINT,	/* ival = integer value */
   VLOCAL,	/* info = local register */
   VUPVAL,       /* info = index of upvalue in `upvalues' */
   VGLOBAL,	/* info = index of table; aux = index of global name in `k' */
@@ -43,6 +44,7 @@ typedef struct expdesc {
   union {
     struct { int info, aux; } s;
     lua_Number nval;
+    l_int ival;
   } u;
   int t;  /* 真值回填列表 */ /* patch list of `exit when true' */
   int f;  /* 假值回填列表 */ /* patch list of `exit when false' */
@@ -66,6 +68,7 @@ struct BlockCnt;  /* defined in lparser.c */
 typedef struct FuncState {
   Proto *f;  /* 当前函数头 */ /* current function header */
   Table *h;  /* table to find (and reuse) elements in `k' */
+  Table *hf;  /* 浮点常量的`h`: 在`h`中1.0与1是同一个键 */ /* the same for floats */
   struct FuncState *prev;  /* 外层函数状态. 栈底是mainfunc的FuncState, 栈顶是当前正在分析的FuncState */ /* enclosing function */
   struct LexState *ls;  /* 语法状态 */ /* lexical state */
   struct lua_State *L;  /* copy of the Lua state */
@@ -0,0 +1,405 @@
+/*
+** $Id: lshared.c $
+** Read-only prototypes shared by several states
+** See Copyright Notice in lua.h
+*/
+
+/*
+** 共享段: 把编译好的函数原型连同常量, 调试信息和其中的字符串一次性复制
+** 到一块不属于任何状态的内存中. 段内对象带有SHAREDBIT并且永远不是白色,
+** 各状态的垃圾回收器既不遍历也不释放它们, 内存也不计入任何状态.
+** 段在第一个状态挂接后冻结, 此后只读, 可以被不同线程中的状态同时使用;
+** 最后一个使用者(创建者或挂接的状态)释放时回收整个段.
+**
+** 状态必须在创建时挂接(`lua_newsharedstate`), 这样状态中内部化的字符串
+** 优先取段内的对象, 同一个字符串只有一个对象, 比较时仍然只比较指针.
+*/
+
+#include <string.h>
+
+#define lshared_c
+#define LUA_CORE
+
+#include "lua.h"
+
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lshared.h"
+#include "lstate.h"
+#include "lstring.h"
+
+
+/* segment objects are never white, never collected and never written */
+#define SHAREDMARK	(bitmask(SHAREDBIT) | bitmask(BLACKBIT) | \
+			 bitmask(FIXEDBIT) | bitmask(OLDBIT))
+
+
+#if defined(__GNUC__)
+#define incref(S)	__atomic_add_fetch(&(S)->refs, 1, __ATOMIC_RELAXED)
+#define decref(S)	__atomic_sub_fetch(&(S)->refs, 1, __ATOMIC_ACQ_REL)
+#define getrefs(S)	__atomic_load_n(&(S)->refs, __ATOMIC_ACQUIRE)
+#else
+#define incref(S)	(++(S)->refs)
+#define decref(S)	(--(S)->refs)
+#define getrefs(S)	((S)->refs)
+#endif
+
+
+static void *salloc (lua_Shared *S, size_t n) {
+  void *b;
+  if (n == 0) return NULL;
+  b = (*S->frealloc)(S->ud, NULL, 0, n);
+  if (b != NULL) S->totalbytes += n;
+  return b;
+}
+
+
+static void sfree (lua_Shared *S, void *b, size_t n) {
+  if (b == NULL) return;
+  (*S->frealloc)(S->ud, b, n, 0);
+  S->totalbytes -= n;
+}
+
+
+/* a copy of block `b'; NULL if `n' is 0 or there is no memory */
+static void *sdup (lua_Shared *S, const void *b, size_t n) {
+  void *c = salloc(S, n);
+  if (c != NULL) memcpy(c, b, n);
+  return c;
+}
+
+
+
+/*
+** {======================================================
+** Strings
+** =======================================================
+*/
+
+TString *luaR_findstr (lua_Shared *S, const char *str, size_t l,
+                       unsigned int h) {
+  GCObject *o;
+  if (S->strt.size == 0) return NULL;
+  for (o = S->strt.hash[lmod(h, S->strt.size)]; o != NULL; o = o->gch.next) {
+    TString *ts = rawgco2ts(o);
+    if (ts->tsv.hash == h && ts->tsv.len == l &&
+        (memcmp(str, getstr(ts), l) == 0))
+      return ts;
+  }
+  return NULL;
+}
+
+
+static int growstrt (lua_Shared *S) {
+  int newsize = (S->strt.size == 0) ? MINSTRTABSIZE : 2*S->strt.size;
+  GCObject **newhash = cast(GCObject **,
+                            salloc(S, newsize * sizeof(GCObject *)));
+  int i;
+  if (newhash == NULL) return 0;
+  for (i = 0; i < newsize; i++) newhash[i] = NULL;
+  for (i = 0; i < S->strt.size; i++) {  /* rehash */
+    GCObject *p = S->strt.hash[i];
+    while (p) {
+      GCObject *next = p->gch.next;
+      int h1 = lmod(gco2ts(p)->hash, newsize);
+      p->gch.next = newhash[h1];
+      newhash[h1] = p;
+      p = next;
+    }
+  }
+  sfree(S, S->strt.hash, S->strt.size * sizeof(GCObject *));
+  S->strt.hash = newhash;
+  S->strt.size = newsize;
+  return 1;
+}
+
+
+/* the segment string equal to `ts' (NULL if there is no memory) */
+static TString *sharestr (lua_Shared *S, TString *ts) {
+  size_t l = ts->tsv.len;
+  unsigned int h = luaS_hash(getstr(ts), l, S->seed);  /* `L' has its own */
+  TString *s = luaR_findstr(S, getstr(ts), l, h);
+  int h1;
+  if (s != NULL) return s;
+  if (S->strt.nuse >= cast(lu_int32, S->strt.size) && !growstrt(S))
+    return NULL;
+  s = cast(TString *, salloc(S, sizestring(&ts->tsv)));
+  if (s == NULL) return NULL;
+  s->tsv.tt = LUA_TSTRING;
+  s->tsv.marked = SHAREDMARK;
+  s->tsv.reserved = ts->tsv.reserved;
+  s->tsv.hashed = 1;  /* the segment is read-only from now on */
+  s->tsv.hash = h;
+  s->tsv.len = l;
+  memcpy(s+1, getstr(ts), (l+1)*sizeof(char));
+  h1 = lmod(s->tsv.hash, S->strt.size);
+  s->tsv.next = S->strt.hash[h1];
+  S->strt.hash[h1] = obj2gco(s);
+  S->strt.nuse++;
+  return s;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Prototypes
+** =======================================================
+*/
+
+static void freeproto (lua_Shared *S, Proto *f) {
+  int i;
+  for (i = 0; i < f->sizep; i++)
+    if (f->p[i]) freeproto(S, f->p[i]);
+  sfree(S, f->code, f->sizecode * sizeof(Instruction));
+  sfree(S, f->p, f->sizep * sizeof(Proto *));
+  sfree(S, f->k, f->sizek * sizeof(TValue));
+  sfree(S, f->lineinfo, f->sizelineinfo * sizeof(int));
+  sfree(S, f->locvars, f->sizelocvars * sizeof(LocVar));
+  sfree(S, f->upvalues, f->sizeupvalues * sizeof(TString *));
+  sfree(S, f, sizeof(Proto));
+}
+
+
+/*
+** 复制原型树. 快速化的指令恢复为通用指令, 内联缓存, 热度和机器码
+** 都不复制(共享原型由解释器执行, 使用各状态自己的缓存: 每个原型在
+** `icscratch`中占`sizecode`个元素, 从`icbase`开始)
+ */
+static Proto *shareproto (lua_Shared *S, lua_State *L, const Proto *f) {
+  Proto *p = cast(Proto *, salloc(S, sizeof(Proto)));
+  int i;
+  if (p == NULL) return NULL;
+  memset(p, 0, sizeof(Proto));
+  p->tt = LUA_TPROTO;
+  p->marked = SHAREDMARK;
+  p->linedefined = f->linedefined;
+  p->lastlinedefined = f->lastlinedefined;
+  p->nups = f->nups;
+  p->numparams = f->numparams;
+  p->is_vararg = f->is_vararg;
+  p->maxstacksize = f->maxstacksize;
+  if (f->source != NULL && (p->source = sharestr(S, f->source)) == NULL)
+    goto fail;
+  /* code */
+  p->code = cast(Instruction *, salloc(S, f->sizecode * sizeof(Instruction)));
+  if (p->code == NULL) goto fail;
+  p->sizecode = f->sizecode;
+  for (i = 0; i < f->sizecode; i++) {
+    Instruction ins = f->code[i];
+    SET_OPCODE(ins, quickbase(GET_OPCODE(ins)));  /* undo quickening */
+    p->code[i] = ins;
+  }
+  p->icbase = S->sizecache;
+  S->sizecache += f->sizecode;
+  /* constants */
+  p->k = cast(TValue *, salloc(S, f->sizek * sizeof(TValue)));
+  if (p->k == NULL && f->sizek > 0) goto fail;
+  p->sizek = f->sizek;
+  for (i = 0; i < f->sizek; i++) {
+    if (ttisstring(&f->k[i])) {
+      TString *s = sharestr(S, rawtsvalue(&f->k[i]));
+      if (s == NULL) goto fail;
+      setsvalue(L, &p->k[i], s);
+    }
+    else {
+      lua_assert(!iscollectable(&f->k[i]));
+      setobj(L, &p->k[i], &f->k[i]);
+    }
+  }
+  /* nested functions */
+  p->p = cast(Proto **, salloc(S, f->sizep * sizeof(Proto *)));
+  if (p->p == NULL && f->sizep > 0) goto fail;
+  for (i = 0; i < f->sizep; i++) p->p[i] = NULL;
+  p->sizep = f->sizep;
+  for (i = 0; i < f->sizep; i++) {
+    if ((p->p[i] = shareproto(S, L, f->p[i])) == NULL)
+      goto fail;
+  }
+  /* debug information */
+  p->lineinfo = cast(int *, sdup(S, f->lineinfo, f->sizelineinfo * sizeof(int)));
+  if (p->lineinfo == NULL && f->sizelineinfo > 0) goto fail;
+  p->sizelineinfo = f->sizelineinfo;
+  p->locvars = cast(LocVar *,
+                    sdup(S, f->locvars, f->sizelocvars * sizeof(LocVar)));
+  if (p->locvars == NULL && f->sizelocvars > 0) goto fail;
+  p->sizelocvars = f->sizelocvars;
+  for (i = 0; i < f->sizelocvars; i++) {
+    if (f->locvars[i].varname != NULL &&
+        (p->locvars[i].varname = sharestr(S, f->locvars[i].varname)) == NULL)
+      goto fail;
+  }
+  p->upvalues = cast(TString **,
+                     salloc(S, f->sizeupvalues * sizeof(TString *)));
+  if (p->upvalues == NULL && f->sizeupvalues > 0) goto fail;
+  p->sizeupvalues = f->sizeupvalues;
+  for (i = 0; i < f->sizeupvalues; i++) {
+    p->upvalues[i] = NULL;
+    if (f->upvalues[i] != NULL &&
+        (p->upvalues[i] = sharestr(S, f->upvalues[i])) == NULL)
+      goto fail;
+  }
+  return p;
+ fail:  /* strings already added stay in the segment */
+  freeproto(S, p);
+  return NULL;
+}
+
+
+static int growprotos (lua_Shared *S) {
+  int newsize = (S->sizeprotos == 0) ? 4 : 2*S->sizeprotos;
+  Proto **newp = cast(Proto **, salloc(S, newsize * sizeof(Proto *)));
+  if (newp == NULL) return 0;
+  if (S->nprotos > 0)
+    memcpy(newp, S->protos, S->nprotos * sizeof(Proto *));
+  sfree(S, S->protos, S->sizeprotos * sizeof(Proto *));
+  S->protos = newp;
+  S->sizeprotos = newsize;
+  return 1;
+}
+
+
+static void freeshared (lua_Shared *S) {
+  int i;
+  for (i = 0; i < S->nprotos; i++)
+    freeproto(S, S->protos[i]);
+  sfree(S, S->protos, S->sizeprotos * sizeof(Proto *));
+  for (i = 0; i < S->strt.size; i++) {
+    GCObject *o = S->strt.hash[i];
+    while (o) {
+      GCObject *next = o->gch.next;
+      sfree(S, o, sizestring(gco2ts(o)));
+      o = next;
+    }
+  }
+  sfree(S, S->strt.hash, S->strt.size * sizeof(GCObject *));
+  lua_assert(S->totalbytes == sizeof(lua_Shared));
+  (*S->frealloc)(S->ud, S, sizeof(lua_Shared), 0);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** 挂接到正在创建的状态`L`: 分配共享原型使用的内联缓存并增加引用
+ */
+void luaR_attach (lua_State *L, lua_Shared *S) {
+  global_State *g = G(L);
+  if (S->sizecache > 0) {
+    int i;
+    g->icscratch = luaM_newvector(L, S->sizecache, int);
+    for (i = 0; i < S->sizecache; i++) g->icscratch[i] = 0;
+  }
+  incref(S);  /* from now on the segment is frozen */
+  g->shared = S;
+  g->seed = S->seed;  /* no string exists yet */
+}
+
+
+void luaR_detach (lua_State *L) {
+  global_State *g = G(L);
+  lua_Shared *S = g->shared;
+  if (S == NULL) return;
+  luaM_freearray(L, g->icscratch, S->sizecache, int);
+  g->icscratch = NULL;
+  g->shared = NULL;
+  lua_releaseshared(S);
+}
+
+
+/*
+** 创建一个空的共享段, 段内存由`f`分配
+ */
+LUA_API lua_Shared *lua_newshared (lua_Alloc f, void *ud) {
+  lua_Shared *S = cast(lua_Shared *, (*f)(ud, NULL, 0, sizeof(lua_Shared)));
+  if (S == NULL) return NULL;
+  S->frealloc = f;
+  S->ud = ud;
+  S->refs = 1;
+  S->seed = luaS_makeseed(S);
+  S->strt.hash = NULL;
+  S->strt.size = 0;
+  S->strt.nuse = 0;
+  S->strt.old = NULL;  /* the segment always resizes at once */
+  S->strt.oldsize = 0;
+  S->strt.moved = 0;
+  S->protos = NULL;
+  S->nprotos = 0;
+  S->sizeprotos = 0;
+  S->sizecache = 0;
+  S->totalbytes = sizeof(lua_Shared);
+  return S;
+}
+
+
+/*
+** 弹出栈顶的Lua函数(没有upvalue, 例如`lua_load`得到的主函数), 把它的原型
+** 复制到段中, 返回之后`lua_pushshared`使用的编号. 段已经冻结, 栈顶不是
+** 这样的函数或者内存不足时返回-1
+ */
+LUA_API int lua_shareadd (lua_Shared *S, lua_State *L) {
+  const TValue *o;
+  int i = -1;
+  lua_lock(L);
+  api_check(L, L->top - L->base >= 1);
+  o = L->top - 1;
+  if (getrefs(S) == 1 &&  /* no state attached yet? */
+      ttisfunction(o) && !clvalue(o)->c.isC && clvalue(o)->l.nupvalues == 0 &&
+      (S->nprotos < S->sizeprotos || growprotos(S))) {
+    int sizecache = S->sizecache;
+    Proto *p = shareproto(S, L, clvalue(o)->l.p);
+    if (p != NULL) {
+      i = S->nprotos++;
+      S->protos[i] = p;
+    }
+    else
+      S->sizecache = sizecache;  /* the failed copy takes no slots */
+  }
+  L->top--;
+  lua_unlock(L);
+  return i;
+}
+
+
+/*
+** 放弃创建者的引用. 段在最后一个挂接的状态关闭后释放
+ */
+LUA_API void lua_releaseshared (lua_Shared *S) {
+  if (decref(S) == 0)
+    freeshared(S);
+}
+
+
+LUA_API size_t lua_sharedsize (lua_Shared *S) {
+  return S->totalbytes;
+}
+
+
+/*
+** 压入共享段中第`i`个函数的新闭包, 使用当前线程的全局表作为环境.
+** 状态没有挂接段或者`i`无效时什么都不做, 返回0
+ */
+LUA_API int lua_pushshared (lua_State *L, int i) {
+  lua_Shared *S;
+  Closure *cl;
+  lua_lock(L);
+  S = G(L)->shared;
+  if (S == NULL || i < 0 || i >= S->nprotos) {
+    lua_unlock(L);
+    return 0;
+  }
+  luaC_checkGC(L);
+  cl = luaF_newLclosure(L, 0, hvalue(gt(L)));
+  cl->l.p = S->protos[i];
+  setclvalue(L, L->top, cl);
+  api_check(L, L->top < L->ci->top);
+  L->top++;
+  lua_unlock(L);
+  return 1;
+}
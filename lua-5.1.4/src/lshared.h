@@ -0,0 +1,38 @@
+/*
+** $Id: lshared.h $
+** Read-only prototypes shared by several states
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lshared_h
+#define lshared_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** 共享段. 第一个状态挂接后冻结, 此后只有`refs`会被修改
+ */
+struct lua_Shared {
+  lua_Alloc frealloc;  /* function to allocate the segment */
+  void *ud;  /* auxiliary data to `frealloc' */
+  int refs;  /* 创建者加上挂接的状态数 */ /* creator plus attached states */
+  unsigned int seed;  /* 挂接的状态都使用这个散列种子 */ /* hash seed of attached states */
+  stringtable strt;  /* 段内的字符串 */ /* strings of the segment */
+  Proto **protos;  /* `lua_shareadd'加入的主函数原型 */ /* added main functions */
+  int nprotos;
+  int sizeprotos;
+  int sizecache;  /* 段内原型的`sizecode`之和 */ /* inline caches of the segment */
+  size_t totalbytes;  /* 段占用的内存, 不计入任何状态 */ /* memory of the segment */
+};
+
+
+LUAI_FUNC TString *luaR_findstr (lua_Shared *S, const char *str, size_t l,
+                                 unsigned int h);
+LUAI_FUNC void luaR_attach (lua_State *L, lua_Shared *S);
+LUAI_FUNC void luaR_detach (lua_State *L);
+
+
+#endif
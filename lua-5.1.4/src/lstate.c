@@ -6,6 +6,7 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #define lstate_c
 #define LUA_CORE
@@ -16,8 +17,10 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "llex.h"
 #include "lmem.h"
+#include "lshared.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -74,14 +77,21 @@ static void freestack (lua_State *L, lua_State *L1) {
 */
 static void f_luaopen (lua_State *L, void *ud) {
   global_State *g = G(L);
-  UNUSED(ud);
   stack_init(L, L);  /* init stack */
+  if (ud != NULL)  /* 先挂接共享段, 之后内部化的字符串优先使用段内对象 */
+    luaR_attach(L, cast(lua_Shared *, ud));
   sethvalue(L, gt(L), luaH_new(L, 0, 2));  /* table of globals */
   sethvalue(L, registry(L), luaH_new(L, 0, 2));  /* registry */
   luaS_resize(L, MINSTRTABSIZE);  /* initial size of string table */
   luaT_init(L);
   luaX_init(L);
   luaS_fix(luaS_newliteral(L, MEMERRMSG));
+#if defined(LUA_PARALLELGC)
+  luaC_setworkers(L, LUAI_GCWORKERS);
+#endif
+#if defined(LUA_BGSWEEP)
+  luaC_setbgsweep(L, 1);
+#endif
   g->GCthreshold = 4*g->totalbytes;
 }
 
@@ -95,6 +105,11 @@ static void preinit_state (lua_State *L, global_State *g) {
   L->hookmask = 0;
   L->basehookcount = 0;
   L->allowhook = 1;
+#if defined(LUA_USE_JIT)
+  L->jitmode = 1;
+#else
+  L->jitmode = 0;
+#endif
   resethookcount(L);
   L->openupval = NULL;
   L->size_ci = 0;
@@ -110,13 +125,44 @@ static void preinit_state (lua_State *L, global_State *g) {
 static void close_state (lua_State *L) {
   global_State *g = G(L);
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
+#if defined(LUA_PARALLELGC)
+  luaC_setworkers(L, 1);  /* stop marking threads */
+#endif
+#if defined(LUA_BGSWEEP)
+  luaC_setbgsweep(L, 0);  /* free what is pending and stop the sweeper */
+#endif
+  if (g->arena) {  /* the allocator releases everything with the state */
+#if defined(LUA_USE_JIT)
+    GCObject *o;  /* machine code is not in the arena */
+    for (o = g->rootgc; o != NULL; o = o->gch.next)
+      if (o->gch.tt == LUA_TPROTO && gco2p(o)->jit != NULL)
+        luaJ_free(L, gco2p(o));
+#endif
+    luaR_detach(L);
+#if defined(LUA_USE_THREADS)
+    pthread_cond_destroy(&g->lock.c);
+    pthread_mutex_destroy(&g->lock.m);
+#endif
+    (*g->frealloc)(g->ud, fromstate(L), state_size(LG), 0);
+    return;
+  }
   luaC_freeall(L);  /* collect all objects */
   lua_assert(g->rootgc == obj2gco(L));
   lua_assert(g->strt.nuse == 0);
+  luaR_detach(L);
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size, TString *);
+  if (g->strt.old != NULL)  /* closed in the middle of a migration */
+    luaM_freearray(L, g->strt.old, g->strt.oldsize, TString *);
+#if defined(LUA_SHAPES)
+  luaH_freeshapes(L);
+#endif
   luaZ_freebuffer(L, &g->buff);
   freestack(L, L);
   lua_assert(g->totalbytes == sizeof(LG));
+#if defined(LUA_USE_THREADS)
+  pthread_cond_destroy(&g->lock.c);
+  pthread_mutex_destroy(&g->lock.m);
+#endif
   (*g->frealloc)(g->ud, fromstate(L), state_size(LG), 0);
 }
 
@@ -133,6 +179,7 @@ lua_State *luaE_newthread (lua_State *L) {
   L1->hookmask = L->hookmask;
   L1->basehookcount = L->basehookcount;
   L1->hook = L->hook;
+  L1->jitmode = L->jitmode;
   resethookcount(L1);
   lua_assert(iswhite(obj2gco(L1)));
   return L1;
@@ -148,7 +195,41 @@ void luaE_freethread (lua_State *L, lua_State *L1) {
 }
 
 
-LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
+#if defined(LUA_USE_THREADS)
+/*
+** 取一个排队号, 等到轮到它为止; 没有竞争时不使用互斥量. 持有者用完
+** 时间片后在安全点发现有人排队(见`luaE_lockwaiting`)时释放再重新排队,
+** 因此每个等待者最多等待排在它前面的线程各执行一个时间片
+ */
+void luaE_lock (lua_State *L) {
+  GlobalLock *k = &G(L)->lock;
+  unsigned long t = __atomic_fetch_add(&k->next, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&k->serving, __ATOMIC_SEQ_CST) != t) {  /* must wait? */
+    pthread_mutex_lock(&k->m);
+    while (__atomic_load_n(&k->serving, __ATOMIC_SEQ_CST) != t)
+      pthread_cond_wait(&k->c, &k->m);
+    pthread_mutex_unlock(&k->m);
+  }
+  k->quantum = LUAI_LOCKQUANTUM;
+}
+
+
+void luaE_unlock (lua_State *L) {
+  GlobalLock *k = &G(L)->lock;
+  unsigned long s = __atomic_add_fetch(&k->serving, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&k->next, __ATOMIC_SEQ_CST) != s) {  /* somebody waiting? */
+    pthread_mutex_lock(&k->m);
+    pthread_cond_broadcast(&k->c);
+    pthread_mutex_unlock(&k->m);
+  }
+}
+#endif
+
+
+/*
+** 创建一个挂接共享段`S`的状态(见lshared.c), `S`为NULL时与`lua_newstate`相同
+ */
+LUA_API lua_State *lua_newsharedstate (lua_Alloc f, void *ud, lua_Shared *S) {
   int i;
   lua_State *L;
   global_State *g;
@@ -171,10 +252,24 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->strt.size = 0;
   g->strt.nuse = 0;
   g->strt.hash = NULL;
+  g->strt.old = NULL;
+  g->strt.oldsize = 0;
+  g->strt.moved = 0;
+  g->seed = luaS_makeseed(L);
+  g->shared = NULL;
+  g->icscratch = NULL;
+#if defined(LUA_USE_THREADS)
+  pthread_mutex_init(&g->lock.m, NULL);
+  pthread_cond_init(&g->lock.c, NULL);
+  g->lock.next = g->lock.serving = 0;
+  g->lock.quantum = LUAI_LOCKQUANTUM;
+#endif
   setnilvalue(registry(L));
   luaZ_initbuffer(L, &g->buff);
   g->panic = NULL;
   g->gcstate = GCSpause;
+  g->gckind = KGC_NORMAL;
+  g->arena = 0;
   g->rootgc = obj2gco(L);
   g->sweepstrgc = 0;
   g->sweepgc = &g->rootgc;
@@ -185,9 +280,25 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->totalbytes = sizeof(LG);
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->gcmaxpause = LUAI_GCMAXPAUSE;
+  g->genminormul = LUAI_GENMINORMUL;
+  g->majorbase = 0;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
+  g->gclast = g->gctotal = g->gcstats;
+  g->gcclockmark = g->gcstepstart = 0;
   g->gcdept = 0;
   for (i=0; i<NUM_TAGS; i++) g->mt[i] = NULL;
-  if (luaD_rawrunprotected(L, f_luaopen, NULL) != 0) {
+#if defined(LUA_SHAPES)
+  g->shapes = NULL;
+  g->sizeshapes = g->nshapes = 0;
+#endif
+#if defined(LUA_PARALLELGC)
+  g->gcpool = NULL;
+#endif
+#if defined(LUA_BGSWEEP)
+  g->sweeper = NULL;
+#endif
+  if (luaD_rawrunprotected(L, f_luaopen, S) != 0) {
     /* memory allocation error: free partial state */
     close_state(L);
     L = NULL;
@@ -198,6 +309,11 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
 }
 
 
+LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
+  return lua_newsharedstate(f, ud, NULL);
+}
+
+
 static void callallgcTM (lua_State *L, void *ud) {
   UNUSED(ud);
   luaC_callGCTM(L);  /* call GC metamethods for all udata */
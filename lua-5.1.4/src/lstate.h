@@ -16,6 +16,10 @@
 #include "ltm.h"
 #include "lzio.h"
 
+#if defined(LUA_USE_THREADS)
+#include <pthread.h>
+#endif
+
 
 
 struct lua_longjmp;  /* defined in ldo.c */
@@ -44,6 +48,10 @@ typedef struct stringtable {
   GCObject **hash;
   lu_int32 nuse;  /* 元素个数 */  /* number of elements */
   int size;       /* 桶大小 */
+  /* 扩容或精简时旧表逐步迁移到`hash`, 迁移期间查找两张表 */
+  GCObject **old;  /* table being migrated into `hash' (or NULL) */
+  int oldsize;     /* 0 when there is no migration */
+  int moved;       /* buckets of `old' already migrated */
 } stringtable;
 
 
@@ -70,6 +78,20 @@ typedef struct CallInfo {
 #define isLua(ci)	(ttisfunction((ci)->func) && f_isLua(ci))
 
 
+#if defined(LUA_USE_THREADS)
+/*
+** 全局状态的锁. 按排队号授予, 先到先得
+ */
+typedef struct GlobalLock {
+  pthread_mutex_t m;  /* for waiting on `c' */
+  pthread_cond_t c;  /* signaled when `serving' changes with waiters */
+  unsigned long next;  /* next ticket to hand out */
+  unsigned long serving;  /* ticket of the thread holding the lock */
+  int quantum;  /* safe points left before the holder must give way */
+} GlobalLock;
+#endif
+
+
 /*
 ** `global state', shared by all threads of this state
 */
@@ -79,10 +101,13 @@ typedef struct CallInfo {
  */
 typedef struct global_State {
   stringtable strt;  /* 全局字符串池 */ /* hash table for strings */
+  unsigned int seed;  /* 字符串散列的随机种子 */ /* randomized seed for hashes */
   lua_Alloc frealloc; /* 内存管理(分配/释放)函数指针. 可分别通过`lua_getallocf`和`lua_setallocf`访问和设置 */ /* function to reallocate memory */
   void *ud;         /* `frealloc`函数关联的参数 *//* auxiliary data to `frealloc' */
   lu_byte currentwhite;
   lu_byte gcstate;  /* 垃圾回收状态信息 */ /* state of garbage collector */
+  lu_byte gckind;  /* 增量或分代模式 */ /* kind of GC running */
+  lu_byte arena;  /* 释放状态时分配器一次性回收所有内存 */ /* `frealloc' frees all with the state */
   int sweepstrgc;  /* position of sweep in `strt' */
   GCObject *rootgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* position of sweep in `rootgc' */
@@ -97,12 +122,36 @@ typedef struct global_State {
   lu_mem gcdept;  /* how much GC is `behind schedule' */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC `granularity' */
+  int gcmaxpause;  /* 自动回收每一步的最长时间(微秒), 0表示不限 */ /* time limit of a GC step */
+  int genminormul;  /* 分代模式下新生代的大小 */ /* control for minor collections */
+  lu_mem majorbase;  /* 上次完整回收后的内存用量 */ /* memory in use after last major collection */
+  lua_GCStats gcstats;  /* 当前周期的统计 */ /* statistics of the running cycle */
+  lua_GCStats gclast;  /* 上一个完整周期的统计 */ /* statistics of the last complete cycle */
+  lua_GCStats gctotal;  /* 累计统计 */ /* statistics summed over all cycles */
+  lu_mem gcclockmark;  /* 当前阶段计时起点(微秒) */ /* start of the phase being timed */
+  lu_mem gcstepstart;  /* 当前回收步骤的开始时间(微秒) */ /* start of the running step */
   lua_CFunction panic;  /* 无保护模式函数调用时会触发该函数, 默认为null, 可以通过`lua_atpanic`配置 */ /* to be called in unprotected errors */
   TValue l_registry;  /* `LUA_REGISTRYINDEX` 对应的全局表, 全局唯一 */
   struct lua_State *mainthread;
   UpVal uvhead;  /* upvalue链表, 双链表数据结构 */ /* head of double-linked list of all open upvalues */
   struct Table *mt[NUM_TAGS];  /* 基本类型的元表 */ /* metatables for basic types */
   TString *tmname[TM_N];  /* 元方法名数组 */ /* array with tag-method names */
+  struct lua_Shared *shared;  /* 只读的共享段(可为NULL) */ /* read-only segment (or NULL) */
+  int *icscratch;  /* 共享原型使用的内联缓存 */ /* inline caches for shared protos */
+#if defined(LUA_SHAPES)
+  struct Shape **shapes;  /* 形状转移表, 以(父形状, 新键)散列 */ /* shape transitions */
+  int sizeshapes;
+  int nshapes;
+#endif
+#if defined(LUA_PARALLELGC)
+  struct GCPool *gcpool;  /* 并行标记的线程池 */ /* marking threads (NULL if none) */
+#endif
+#if defined(LUA_BGSWEEP)
+  struct GCSweeper *sweeper;  /* 后台清除线程 */ /* frees dead objects (NULL if off) */
+#endif
+#if defined(LUA_USE_THREADS)
+  GlobalLock lock;  /* 多个操作系统线程共享状态时的锁 */ /* see `lua_lock' */
+#endif
 } global_State;
 
 
@@ -156,6 +205,7 @@ struct lua_State {
   unsigned short baseCcalls;  /* nested C calls when resuming coroutine */
   lu_byte hookmask; /* hook掩码. @see LUA_MASKCALL, LUA_MASKRET, LUA_MASKLINE, LUA_MASKCOUNT */
   lu_byte allowhook; /* 是否允许hook */
+  lu_byte jitmode;  /* 是否使用JIT编译器. @see lua_jit */
   int basehookcount; /* 掩码设置为`LUA_MASKCOUNT`时, 执行`basehookcount`条指令触发hook */
   int hookcount;  /* 掩码设置为`LUA_MASKCOUNT`时, 运行了`hookcount`条指令 */
   lua_Hook hook; /* 用户注册的hook回调函数. 函数指针 */
@@ -210,5 +260,16 @@ union GCObject {
 LUAI_FUNC lua_State *luaE_newthread (lua_State *L);
 LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
 
+#if defined(LUA_USE_THREADS)
+LUAI_FUNC void luaE_lock (lua_State *L);
+LUAI_FUNC void luaE_unlock (lua_State *L);
+
+/* 还有线程在排队, 并且持有者用完了时间片 */
+#define luaE_lockwaiting(L) \
+	(__atomic_load_n(&G(L)->lock.next, __ATOMIC_RELAXED) - \
+	 __atomic_load_n(&G(L)->lock.serving, __ATOMIC_RELAXED) > 1 && \
+	 --G(L)->lock.quantum <= 0)
+#endif
+
 #endif
 
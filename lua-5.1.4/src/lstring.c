@@ -14,46 +14,184 @@
 
 #include "lmem.h"
 #include "lobject.h"
+#include "lshared.h"
 #include "lstate.h"
 #include "lstring.h"
 
 
 
+#if defined(LUA_FULLHASH)
+
+#define K64(hi,lo)	((cast(lu_int64, hi) << 32) | cast(lu_int64, lo))
+
+#define PRIME1	K64(0x9E3779B1, 0x85EBCA87)
+#define PRIME2	K64(0xC2B2AE3D, 0x27D4EB4F)
+#define PRIME3	K64(0x165667B1, 0x9E3779F9)
+#define PRIME4	K64(0x85EBCA77, 0xC2B2AE63)
+#define PRIME5	K64(0x27D4EB2F, 0x165667C5)
+
+#define rotl(x,n)	(((x) << (n)) | ((x) >> (64 - (n))))
+
+#define mix(acc,w)	(rotl((acc) + (w) * PRIME2, 31) * PRIME1)
+
+
+static lu_int64 getword (const char *p) {
+  lu_int64 w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+
+static lu_int32 gethalf (const char *p) {
+  lu_int32 w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+
+/*
+** xxHash64: 32字节的块由4条互不依赖的通道混合(可以并行或者向量化),
+** 剩下的部分每次8个字节, 最后做雪崩使低32位也依赖于所有输入
+*/
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  const char *p = str;
+  const char *e = str + l;
+  lu_int64 h;
+  if (l >= 32) {  /* four independent lanes over 32-byte blocks */
+    lu_int64 v[4];
+    int i;
+    v[0] = seed + PRIME1 + PRIME2;
+    v[1] = seed + PRIME2;
+    v[2] = seed;
+    v[3] = seed - PRIME1;
+    do {
+      for (i = 0; i < 4; i++)
+        v[i] = mix(v[i], getword(p + 8*i));
+      p += 32;
+    } while (e - p >= 32);
+    h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+    for (i = 0; i < 4; i++)
+      h = (h ^ mix(0, v[i])) * PRIME1 + PRIME4;
+  }
+  else
+    h = seed + PRIME5;
+  h += cast(lu_int64, l);
+  for (; e - p >= 8; p += 8)
+    h = rotl(h ^ mix(0, getword(p)), 27) * PRIME1 + PRIME4;
+  if (e - p >= 4) {
+    h = rotl(h ^ (gethalf(p) * PRIME1), 23) * PRIME2 + PRIME3;
+    p += 4;
+  }
+  for (; p < e; p++)
+    h = rotl(h ^ (cast(unsigned char, *p) * PRIME5), 11) * PRIME1;
+  h ^= h >> 33;  /* final mix */
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+  return cast(unsigned int, h);
+}
+
+#else
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  unsigned int h = seed ^ cast(unsigned int, l);
+  size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
+  size_t l1;
+  /* JS Hash Function */
+  /* 计算JS Hash值 */
+  for (l1=l; l1>=step; l1-=step)  /* compute hash */
+    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
+  return h;
+}
+
+#endif
+
+
+/*
+** 随机种子: luai_makeseed混入几个地址(堆, 栈, 代码), 受ASLR影响每次不同
+*/
+unsigned int luaS_makeseed (void *unique) {
+  char buff[3 * sizeof(void *)];
+  unsigned int h = luai_makeseed();
+  void *p;
+  memcpy(buff, &unique, sizeof(void *));  /* heap address */
+  p = &h;  /* stack address */
+  memcpy(buff + sizeof(void *), &p, sizeof(void *));
+  p = cast(void *, &luaO_nilobject_);  /* address of the library */
+  memcpy(buff + 2 * sizeof(void *), &p, sizeof(void *));
+  return luaS_hash(buff, sizeof(buff), h);
+}
+
+
+/*
+** 不在清除阶段释放的内存也要从`estimate`中扣除, 否则一轮回收结束时
+** 估计值会超过实际使用的内存
+*/
+static void uncount (global_State *g, lu_mem n) {
+  g->estimate = (g->estimate > n) ? g->estimate - n : 0;
+}
+
+
+/*
+** 把旧表中最多`n`个桶迁移到新表, 全部迁移完后释放旧表.
+** 清除字符串的阶段不迁移, 使GC按桶扫描两张表时不会漏掉或重复
+*/
+void luaS_resizestep (lua_State *L, int n) {
+  global_State *g = G(L);
+  stringtable *tb = &g->strt;
+  if (tb->old == NULL || g->gcstate == GCSsweepstring)
+    return;  /* nothing to migrate, or cannot move strings now */
+  for (; n > 0 && tb->moved < tb->oldsize; n--) {
+    GCObject *p = tb->old[tb->moved];
+    tb->old[tb->moved++] = NULL;
+    /* 重新散列, 将旧桶的拉链移动到新hash位置 */
+    while (p) {  /* for each node in the list */
+      GCObject *next = p->gch.next;  /* save next */
+      int h1 = lmod(gco2ts(p)->hash, tb->size);  /* new position */
+      p->gch.next = tb->hash[h1];  /* 前插至链首 *//* chain it */
+      tb->hash[h1] = p;
+      p = next;
+    }
+  }
+  if (tb->moved == tb->oldsize) {  /* migration done? */
+    luaM_freearray(L, tb->old, tb->oldsize, TString *);
+    uncount(g, tb->oldsize * sizeof(TString *));  /* (freed outside a sweep) */
+    tb->old = NULL;
+    tb->oldsize = 0;
+    tb->moved = 0;
+  }
+}
+
+
+/*
+** 开始把`strt`迁移到`newsize`个桶的新表, 之后每创建一个字符串或者
+** 每次GC步进都迁移几个桶, 避免一次重新散列所有字符串造成停顿
+*/
 void luaS_resize (lua_State *L, int newsize) {
   GCObject **newhash;
   stringtable *tb;
   int i;
   if (G(L)->gcstate == GCSsweepstring)
     return;  /* cannot resize during GC traverse */
-  newhash = luaM_newvector(L, newsize, GCObject *);
   tb = &G(L)->strt;
+  if (tb->old != NULL)  /* previous migration not finished? */
+    luaS_resizestep(L, MAX_INT);  /* finish it first */
+  newhash = luaM_newvector(L, newsize, GCObject *);
   for (i=0; i<newsize; i++) newhash[i] = NULL;
-  /* rehash */
-  /* 重新散列, 将旧hash位置所在的值移动到新hash位置 */
-  for (i=0; i<tb->size; i++) {
-    GCObject *p = tb->hash[i];
-    /* 遍历每个拉链 */
-    while (p) {  /* for each node in the list */
-      GCObject *next = p->gch.next;  /* save next */
-      unsigned int h = gco2ts(p)->hash;
-      int h1 = lmod(h, newsize);  /* new position */
-      lua_assert(cast_int(h%newsize) == lmod(h, newsize));
-      p->gch.next = newhash[h1];  /* 前插至链首 *//* chain it */
-      newhash[h1] = p;
-      p = next;
-    }
+  if (tb->size > 0) {  /* old table migrates incrementally */
+    tb->old = tb->hash;
+    tb->oldsize = tb->size;
+    tb->moved = 0;
   }
-  /* 释放旧表内存 */
-  luaM_freearray(L, tb->hash, tb->size, TString *);
   tb->size = newsize;
   tb->hash = newhash;
 }
 
 
-static TString *newlstr (lua_State *L, const char *str, size_t l,
-                                       unsigned int h) {
+static TString *createstrobj (lua_State *L, const char *str, size_t l,
+                              unsigned int h) {
   TString *ts;
-  stringtable *tb;
   if (l+1 > (MAX_SIZET - sizeof(TString))/sizeof(char))
     luaM_toobig(L);
   /* 分配内存并初始化 */
@@ -63,10 +201,18 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
   ts->tsv.marked = luaC_white(G(L));
   ts->tsv.tt = LUA_TSTRING;
   ts->tsv.reserved = 0;
+  ts->tsv.hashed = 0;
   /* 将 `str` 复制至 `ts` 末尾*/
   memcpy(ts+1, str, l*sizeof(char));
   ((char *)(ts+1))[l] = '\0'; /* 字符串部分位于 `ts + 1 ~ ts +l`, 为C API交互方便, 按照C语言风格末尾追加'\0'*/ /* ending 0 */
-  tb = &G(L)->strt;
+  return ts;
+}
+
+
+static TString *newlstr (lua_State *L, const char *str, size_t l,
+                                       unsigned int h) {
+  TString *ts = createstrobj(L, str, l, h);
+  stringtable *tb = &G(L)->strt;
   /* 计算位置, 对号入座, 前插至拉链的开头. 桶所在位置为字符串散列值关于桶个数的模. */
   h = lmod(h, tb->size);
   ts->tsv.next = tb->hash[h];  /* chain new entry */
@@ -74,32 +220,240 @@ static TString *newlstr (lua_State *L, const char *str, size_t l,
   /* 元素个数加一 */
   tb->nuse++;
   /* 元素个数超过`size`, 全局字符串表 `strt` 过于稠密则扩容为原大小的2倍 */
-  if (tb->nuse > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
+  if (tb->old != NULL)
+    luaS_resizestep(L, STRTMOVE);  /* keep migrating */
+  else if (tb->nuse > cast(lu_int32, tb->size) && tb->size <= MAX_INT/2)
     luaS_resize(L, tb->size*2);  /* too crowded */
   return ts;
 }
 
 
+/*
+** 长字符串: 不计算散列也不查找, 像其他对象一样挂在`rootgc`上.
+** `hash`暂存种子, 作为表的键时由`luaS_hashlongstr`计算
+*/
+static TString *newlngstr (lua_State *L, const char *str, size_t l) {
+  TString *ts = createstrobj(L, str, l, G(L)->seed);
+  luaC_link(L, obj2gco(ts), LUA_TSTRING);
+  return ts;
+}
+
+
+unsigned int luaS_hashlongstr (TString *ts) {
+  lua_assert(!isshortstr(ts));
+  if (!ts->tsv.hashed) {
+    ts->tsv.hash = luaS_hash(getstr(ts), ts->tsv.len, ts->tsv.hash);
+    ts->tsv.hashed = 1;
+  }
+  return ts->tsv.hash;
+}
+
+
+int luaS_eqlngstr (TString *a, TString *b) {
+  size_t len = a->tsv.len;
+  return (a == b) ||  /* same instance or... */
+    (len == b->tsv.len &&  /* equal length and ... */
+     !(a->tsv.hashed && b->tsv.hashed && a->tsv.hash != b->tsv.hash) &&
+     memcmp(getstr(a), getstr(b), len) == 0);  /* equal contents */
+}
+
+
+static Rope *newrope (lua_State *L, size_t size) {
+  Rope *r;
+  if (size+1 > MAX_SIZET - sizeof(Rope))
+    luaM_toobig(L);
+  r = cast(Rope *, luaM_malloc(L, sizeof(Rope) + size + 1));
+  r->used = 0;
+  r->size = size;
+  r->refs = 0;
+  r->sealed = 0;
+  return r;
+}
+
+
+static void freerope (lua_State *L, Rope *r) {
+  luaM_freemem(L, r, sizeof(Rope) + r->size + 1);
+}
+
+
+/* 放弃一个引用. 这里的释放不在清除阶段, 也从`estimate`中扣除 */
+void luaS_releaserope (lua_State *L, Rope *r) {
+  if (--r->refs == 0) {
+    uncount(G(L), sizeof(Rope) + r->size + 1);
+    freerope(L, r);
+  }
+}
+
+
+/*
+** API的缓冲(`lua_ropeprep`): 调用者自己记录内容的长度`len`, 准备在后面
+** 写`n`个字节. 没有字符串使用缓冲时`len`之后的字节都属于调用者; 否则
+** 只有缓冲最后写入的是调用者的内容并且没有封住时才能原地写, 其他情况
+** 把内容复制到新的缓冲, 旧缓冲留给字符串
+*/
+char *luaS_ropeprep (lua_State *L, Rope **pr, size_t len, size_t n) {
+  Rope *r = *pr;
+  if (n >= MAX_SIZET/2 - len)
+    luaM_toobig(L);
+  if (r != NULL && r->refs == 1) {  /* only the caller uses it? */
+    r->used = len;  /* the rest is free */
+    r->sealed = 0;
+    if (r->size - len < n) {  /* grow it */
+      size_t size = 2*(len + n);
+      r = cast(Rope *, luaM_realloc_(L, r, sizeof(Rope) + r->size + 1,
+                                           sizeof(Rope) + size + 1));
+      r->size = size;
+    }
+  }
+  else if (r == NULL || r->used != len || r->sealed || r->size - len < n) {
+    Rope *nr;
+    if (r == NULL)
+      nr = newrope(L, (len + n > LUA_MINBUFFER) ? len + n : LUA_MINBUFFER);
+    else
+      nr = newrope(L, (r->size - len >= n) ? r->size : 2*(len + n));
+    if (r != NULL) {
+      memcpy(ropebytes(nr), ropebytes(r), len);
+      luaS_releaserope(L, r);
+    }
+    nr->used = len;
+    nr->refs = 1;
+    r = nr;
+  }
+  *pr = r;
+  return ropebytes(r) + len;
+}
+
+
+#if defined(LUA_ROPES)
+
+/* 字符串头先于缓冲分配并挂到`rootgc`, 分配缓冲失败时由GC回收 */
+static TString *newropestr (lua_State *L, size_t l) {
+  TString *ts = cast(TString *, luaM_malloc(L, sizeof(TString) +
+                                               sizeof(Rope *)));
+  lua_assert(l > LUAI_MAXSHORTLEN);
+  ts->tsv.len = l;
+  ts->tsv.hash = G(L)->seed;  /* (see `newlngstr') */
+  ts->tsv.reserved = ROPESTR;
+  ts->tsv.hashed = 0;
+  ropeof(ts) = NULL;  /* no buffer yet */
+  luaC_link(L, obj2gco(ts), LUA_TSTRING);
+  return ts;
+}
+
+
+/*
+** 拼接`o`开始的`n`个字符串(总长`tl`). 第一个字符串是缓冲中最后写入的
+** 字符串并且剩余空间足够时, 把其余的字符串追加在它后面; 否则复制到一个
+** 两倍大小的新缓冲
+*/
+TString *luaS_ropecat (lua_State *L, const TValue *o, int n, size_t tl) {
+  TString *first = rawtsvalue(o);
+  TString *ts = newropestr(L, tl);
+  Rope *r = NULL;
+  size_t l = 0;
+  int i = 0;
+  if (isrope(first)) {
+    r = ropeof(first);
+    if (r->used == first->tsv.len && !r->sealed &&
+        tl <= r->size) {  /* append in place? */
+      l = r->used;
+      i = 1;
+    }
+  }
+  if (i == 0)  /* start a new buffer, with room to grow */
+    r = newrope(L, (tl <= MAX_SIZET/4) ? 2*tl : tl);
+  for (; i < n; i++) {
+    size_t li = tsvalue(o+i)->len;
+    memcpy(ropebytes(r) + l, svalue(o+i), li);
+    l += li;
+  }
+  lua_assert(l == tl);
+  ropebytes(r)[l] = '\0';
+  r->used = l;
+  r->refs++;
+  ropeof(ts) = r;
+  return ts;
+}
+
+
+/*
+** 交给C代码的字符串要以'\0'结尾, 并且以后不能改变: 缓冲中最后写入的
+** 字符串封住缓冲不再追加; 其他字符串后面是更长字符串的字节, 复制一份
+*/
+const char *luaS_flatten (lua_State *L, TString *ts) {
+  Rope *r = ropeof(ts);
+  size_t l = ts->tsv.len;
+  if (r->used != l) {  /* bytes after `ts' belong to longer strings */
+    Rope *nr = newrope(L, l);
+    memcpy(ropebytes(nr), ropebytes(r), l);
+    ropebytes(nr)[l] = '\0';
+    nr->used = l;
+    nr->refs = 1;
+    ropeof(ts) = nr;
+    luaS_releaserope(L, r);
+    r = nr;
+  }
+  r->sealed = 1;
+  return ropebytes(r);
+}
+
+
+void luaS_freerope (lua_State *L, TString *ts) {
+  Rope *r = ropeof(ts);
+  if (r != NULL && --r->refs == 0)
+    freerope(L, r);  /* (the sweep counts what it frees) */
+}
+
+#endif
+
+
+/* 缓冲的前`len`个字节作为字符串: 长字符串直接使用缓冲, 不复制 */
+TString *luaS_ropestr (lua_State *L, Rope *r, size_t len) {
+#if defined(LUA_ROPES)
+  if (len > LUAI_MAXSHORTLEN) {
+    TString *ts = newropestr(L, len);
+    ropeof(ts) = r;
+    r->refs++;
+    return ts;
+  }
+#endif
+  return luaS_newlstr(L, ropebytes(r), len);
+}
+
+
+static GCObject *findstr (GCObject *o, const char *str, size_t l,
+                          unsigned int h) {
+  for (; o != NULL; o = o->gch.next) {
+    TString *ts = rawgco2ts(o);
+    if (ts->tsv.hash == h && ts->tsv.len == l &&
+        (memcmp(str, getstr(ts), l) == 0))
+      break;
+  }
+  return o;
+}
+
+
 TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
   GCObject *o;
-  unsigned int h = cast(unsigned int, l);  /* seed */
-  size_t step = (l>>5)+1;  /* if string is too long, don't hash all its chars */
-  size_t l1;
-  /* JS Hash Function */
-  /* 计算JS Hash值 */
-  for (l1=l; l1>=step; l1-=step)  /* compute hash */
-    h = h ^ ((h<<5)+(h>>2)+cast(unsigned char, str[l1-1]));
+  unsigned int h;
+  if (l > LUAI_MAXSHORTLEN)  /* 长字符串不内部化 */
+    return newlngstr(L, str, l);
+  h = luaS_hash(str, l, G(L)->seed);
 
+  /* 共享段中的字符串优先, 保证同一字符串只有一个对象 */
+  if (G(L)->shared != NULL) {  /* strings of the segment come first */
+    TString *ts = luaR_findstr(G(L)->shared, str, l, h);
+    if (ts != NULL) return ts;
+  }
   /* 拉链法: 先定位到 `strt` 所在的桶, 然后遍历桶指向的链表, 比较其与 `str` 值相等的对象, 存在则返回 */
-  for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)];
-       o != NULL;
-       o = o->gch.next) {
-    TString *ts = rawgco2ts(o);
-    if (ts->tsv.len == l && (memcmp(str, getstr(ts), l) == 0)) {
-      /* string may be dead */
-      if (isdead(G(L), o)) changewhite(o);
-      return ts;
-    }
+  o = findstr(G(L)->strt.hash[lmod(h, G(L)->strt.size)], str, l, h);
+  /* 迁移期间还没移走的字符串在旧表中 */
+  if (o == NULL && G(L)->strt.old != NULL)  /* not migrated yet? */
+    o = findstr(G(L)->strt.old[lmod(h, G(L)->strt.oldsize)], str, l, h);
+  if (o != NULL) {
+    /* string may be dead */
+    if (isdead(G(L), o)) changewhite(o);
+    return rawgco2ts(o);
   }
   /* 不存在创建一个字符串对象 */
   return newlstr(L, str, l, h);  /* not found */
@@ -13,7 +13,13 @@
 #include "lstate.h"
 
 
+#if defined(LUA_ROPES)
+#define sizestring(s)	((s)->reserved == ROPESTR ? \
+                         sizeof(union TString)+sizeof(Rope *) : \
+                         sizeof(union TString)+((s)->len+1)*sizeof(char))
+#else
 #define sizestring(s)	(sizeof(union TString)+((s)->len+1)*sizeof(char))
+#endif
 
 #define sizeudata(u)	(sizeof(union Udata)+(u)->len)
 
@@ -22,9 +28,34 @@
 #define luaS_newliteral(L, s)	(luaS_newlstr(L, "" s, \
                                  (sizeof(s)/sizeof(char))-1))
 
-#define luaS_fix(s)	l_setbit((s)->tsv.marked, FIXEDBIT)
+/* 短字符串是内部化的, 地址相同即相等; 长字符串还要比较内容 */
+#define isshortstr(ts)	((ts)->tsv.len <= LUAI_MAXSHORTLEN)
+#define eqstr(a,b)	((a) == (b) || (!isshortstr(a) && luaS_eqlngstr(a, b)))
+
+/* shared strings are already fixed and must not be written */
+#define luaS_fix(s)	\
+  (testbit((s)->tsv.marked, FIXEDBIT) ? 0 : l_setbit((s)->tsv.marked, FIXEDBIT))
 
+LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l, unsigned int seed);
+LUAI_FUNC unsigned int luaS_makeseed (void *unique);
+LUAI_FUNC unsigned int luaS_hashlongstr (TString *ts);
+LUAI_FUNC int luaS_eqlngstr (TString *a, TString *b);
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
+LUAI_FUNC void luaS_resizestep (lua_State *L, int n);
+#if defined(LUA_ROPES)
+/* 给C代码使用的字节: 以'\0'结尾并且不会再改变 */
+#define luaS_tocstr(L,ts)	(isrope(ts) ? luaS_flatten(L, ts) : getstr(ts))
+LUAI_FUNC TString *luaS_ropecat (lua_State *L, const TValue *o, int n,
+                                 size_t tl);
+LUAI_FUNC const char *luaS_flatten (lua_State *L, TString *ts);
+LUAI_FUNC void luaS_freerope (lua_State *L, TString *ts);
+#else
+#define luaS_tocstr(L,ts)	getstr(ts)
+#define luaS_freerope(L,ts)	((void)0)
+#endif
+LUAI_FUNC char *luaS_ropeprep (lua_State *L, Rope **pr, size_t len, size_t n);
+LUAI_FUNC void luaS_releaserope (lua_State *L, Rope *r);
+LUAI_FUNC TString *luaS_ropestr (lua_State *L, Rope *r, size_t len);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, Table *e);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
 
@@ -493,9 +493,9 @@ static int push_captures (MatchState *ms, const char *s, const char *e) {
 }
 
 
-static int str_find_aux (lua_State *L, int find) {
-  size_t l1, l2;
-  const char *s = luaL_checklstring(L, 1, &l1);
+/* searches the pattern (argument 2) in `s'; also used by buffers */
+static int find_aux (lua_State *L, const char *s, size_t l1, int find) {
+  size_t l2;
   const char *p = luaL_checklstring(L, 2, &l2);
   ptrdiff_t init = posrelat(luaL_optinteger(L, 3, 1), l1) - 1;
   if (init < 0) init = 0;
@@ -536,6 +536,13 @@ static int str_find_aux (lua_State *L, int find) {
 }
 
 
+static int str_find_aux (lua_State *L, int find) {
+  size_t l1;
+  const char *s = luaL_checklstring(L, 1, &l1);
+  return find_aux(L, s, l1, find);
+}
+
+
 static int str_find (lua_State *L) {
   return str_find_aux(L, 1);
 }
@@ -754,18 +761,24 @@ static void addintlen (char *form) {
 }
 
 
-static int str_format (lua_State *L) {
-  int arg = 1;
+/* integers are formatted exactly; other numbers are truncated */
+static LUA_INTFRM_T checkintfrm (lua_State *L, int arg) {
+  if (lua_isinteger(L, arg))
+    return (LUA_INTFRM_T)lua_tointeger(L, arg);
+  return (LUA_INTFRM_T)luaL_checknumber(L, arg);
+}
+
+
+/* formats the arguments after `arg' as told by argument `arg' */
+static void addformat (lua_State *L, luaL_Buffer *b, int arg) {
   size_t sfl;
   const char *strfrmt = luaL_checklstring(L, arg, &sfl);
   const char *strfrmt_end = strfrmt+sfl;
-  luaL_Buffer b;
-  luaL_buffinit(L, &b);
   while (strfrmt < strfrmt_end) {
     if (*strfrmt != L_ESC)
-      luaL_addchar(&b, *strfrmt++);
+      luaL_addchar(b, *strfrmt++);
     else if (*++strfrmt == L_ESC)
-      luaL_addchar(&b, *strfrmt++);  /* %% */
+      luaL_addchar(b, *strfrmt++);  /* %% */
     else { /* format item */
       char form[MAX_FORMAT];  /* to store the format (`%...') */
       char buff[MAX_ITEM];  /* to store the formatted item */
@@ -778,12 +791,12 @@ static int str_format (lua_State *L) {
         }
         case 'd':  case 'i': {
           addintlen(form);
-          sprintf(buff, form, (LUA_INTFRM_T)luaL_checknumber(L, arg));
+          sprintf(buff, form, checkintfrm(L, arg));
           break;
         }
         case 'o':  case 'u':  case 'x':  case 'X': {
           addintlen(form);
-          sprintf(buff, form, (unsigned LUA_INTFRM_T)luaL_checknumber(L, arg));
+          sprintf(buff, form, (unsigned LUA_INTFRM_T)checkintfrm(L, arg));
           break;
         }
         case 'e':  case 'E': case 'f':
@@ -792,7 +805,7 @@ static int str_format (lua_State *L) {
           break;
         }
         case 'q': {
-          addquoted(L, &b, arg);
+          addquoted(L, b, arg);
           continue;  /* skip the 'addsize' at the end */
         }
         case 's': {
@@ -802,7 +815,7 @@ static int str_format (lua_State *L) {
             /* no precision and string is too long to be formatted;
                keep original string */
             lua_pushvalue(L, arg);
-            luaL_addvalue(&b);
+            luaL_addvalue(b);
             continue;  /* skip the `addsize' at the end */
           }
           else {
@@ -811,19 +824,238 @@ static int str_format (lua_State *L) {
           }
         }
         default: {  /* also treat cases `pnLlh' */
-          return luaL_error(L, "invalid option " LUA_QL("%%%c") " to "
-                               LUA_QL("format"), *(strfrmt - 1));
+          luaL_error(L, "invalid option " LUA_QL("%%%c") " to "
+                        LUA_QL("format"), *(strfrmt - 1));
         }
       }
-      luaL_addlstring(&b, buff, strlen(buff));
+      luaL_addlstring(b, buff, strlen(buff));
     }
   }
+}
+
+
+static int str_format (lua_State *L) {
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  addformat(L, &b, 1);
   luaL_pushresult(&b);
   return 1;
 }
 
 
+/*
+** {======================================================
+** STRING BUFFERS
+** =======================================================
+*/
+
+/*
+** 可以反复使用的字节缓冲. 内容放在`lua_Rope'里: `reset'只把长度清零,
+** 内存留给下一轮; 长内容`tostring'时不复制, 字符串和缓冲共用同一块内存,
+** 之后的写入不会改变已经得到的字符串
+*/
+typedef struct StrBuf {
+  lua_Rope *r;  /* contents (NULL before the first write) */
+  size_t len;  /* length of the contents */
+} StrBuf;
+
+
+#define tobuf(L,i)	((StrBuf *)luaL_checkudata(L, i, LUA_STRBUFHANDLE))
+
+
+static StrBuf *testbuf (lua_State *L, int i) {
+  StrBuf *b = NULL;
+  if (lua_type(L, i) == LUA_TUSERDATA && lua_getmetatable(L, i)) {
+    luaL_getmetatable(L, LUA_STRBUFHANDLE);
+    if (lua_rawequal(L, -1, -2))
+      b = (StrBuf *)lua_touserdata(L, i);
+    lua_pop(L, 2);
+  }
+  return b;
+}
+
+
+static char *prepbuf (lua_State *L, StrBuf *b, size_t n) {
+  return lua_ropeprep(L, &b->r, b->len, n);
+}
+
+
+static void addbuf (lua_State *L, StrBuf *b, const char *s, size_t l) {
+  char *p = prepbuf(L, b, l);
+  memcpy(p, s, l);
+  lua_ropeadd(b->r, l);
+  b->len += l;
+}
+
+
+static int str_buffer (lua_State *L) {
+  lua_Integer size = luaL_optinteger(L, 1, 0);
+  StrBuf *b;
+  luaL_argcheck(L, size >= 0, 1, "invalid size");
+  b = (StrBuf *)lua_newuserdata(L, sizeof(StrBuf));
+  b->r = NULL;
+  b->len = 0;
+  luaL_getmetatable(L, LUA_STRBUFHANDLE);
+  lua_setmetatable(L, -2);
+  if (size > 0)
+    prepbuf(L, b, (size_t)size);
+  return 1;
+}
+
+
+static int buf_put (lua_State *L) {
+  StrBuf *b = tobuf(L, 1);
+  int n = lua_gettop(L);
+  int i;
+  for (i = 2; i <= n; i++) {
+    StrBuf *o = testbuf(L, i);
+    if (o != NULL) {
+      size_t l = o->len;
+      char *p = prepbuf(L, b, l);  /* may move the contents of `o' == `b' */
+      memcpy(p, lua_ropedata(o->r), l);
+      lua_ropeadd(b->r, l);
+      b->len += l;
+    }
+    else {
+      size_t l;
+      const char *s = luaL_checklstring(L, i, &l);
+      addbuf(L, b, s, l);
+    }
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_putf (lua_State *L) {
+  StrBuf *b = tobuf(L, 1);
+  luaL_Buffer lb;
+  int i;
+  luaL_buffinit(L, &lb);
+  addformat(L, &lb, 2);
+  for (i = lb.lvl; i > 0; i--) {  /* pieces already on the stack */
+    size_t l;
+    const char *s = lua_tolstring(L, -i, &l);
+    addbuf(L, b, s, l);
+  }
+  addbuf(L, b, lb.buffer, lb.p - lb.buffer);  /* the rest */
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_reserve (lua_State *L) {
+  StrBuf *b = tobuf(L, 1);
+  lua_Integer n = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, n >= 0, 2, "invalid size");
+  prepbuf(L, b, (size_t)n);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_reset (lua_State *L) {
+  StrBuf *b = tobuf(L, 1);
+  b->len = 0;
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_len (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)tobuf(L, 1)->len);
+  return 1;
+}
+
+
+static int buf_sub (lua_State *L) {
+  StrBuf *b = tobuf(L, 1);
+  size_t l = b->len;
+  ptrdiff_t start = posrelat(luaL_checkinteger(L, 2), l);
+  ptrdiff_t end = posrelat(luaL_optinteger(L, 3, -1), l);
+  if (start < 1) start = 1;
+  if (end > (ptrdiff_t)l) end = (ptrdiff_t)l;
+  if (start > end)
+    lua_pushliteral(L, "");
+  else if (start == 1)  /* a prefix shares the contents */
+    lua_pushrope(L, b->r, (size_t)end);
+  else
+    lua_pushlstring(L, lua_ropedata(b->r) + start - 1, end - start + 1);
+  return 1;
+}
+
+
+static int buf_find (lua_State *L) {
+  StrBuf *b = tobuf(L, 1);
+  const char *s = "";
+  lua_settop(L, 4);  /* keep the anchor out of the optional arguments */
+  if (b->r != NULL)  /* anchor the bytes: a `__gc' may write to the buffer */
+    s = lua_pushrope(L, b->r, b->len);
+  return find_aux(L, s, b->len, 1);
+}
+
+
+static int buf_tostring (lua_State *L) {
+  StrBuf *b = tobuf(L, 1);
+  if (b->r == NULL)
+    lua_pushliteral(L, "");
+  else
+    lua_pushrope(L, b->r, b->len);
+  return 1;
+}
+
+
+static int buf_gc (lua_State *L) {
+  StrBuf *b = tobuf(L, 1);
+  lua_freerope(L, b->r);
+  b->r = NULL;
+  b->len = 0;
+  return 0;
+}
+
+
+static int buf_clone (lua_State *L) {
+  StrBuf *b = tobuf(L, 1);
+  lua_Rope *r = b->r;  /* still owned by the original state */
+  size_t l = b->len;
+  b->r = NULL;
+  b->len = 0;
+  if (l > 0)
+    addbuf(L, b, lua_ropedata(r), l);
+  return 0;
+}
+
+
+static const luaL_Reg buflib[] = {
+  {"find", buf_find},
+  {"len", buf_len},
+  {"put", buf_put},
+  {"putf", buf_putf},
+  {"reserve", buf_reserve},
+  {"reset", buf_reset},
+  {"sub", buf_sub},
+  {"tostring", buf_tostring},
+  {"__clone", buf_clone},
+  {"__gc", buf_gc},
+  {"__len", buf_len},
+  {"__tostring", buf_tostring},
+  {NULL, NULL}
+};
+
+
+static void createbufmeta (lua_State *L) {
+  luaL_newmetatable(L, LUA_STRBUFHANDLE);  /* create metatable for buffers */
+  lua_pushvalue(L, -1);  /* push metatable */
+  lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
+  luaL_register(L, NULL, buflib);  /* buffer methods */
+  lua_pop(L, 1);
+}
+
+/* }====================================================== */
+
+
 static const luaL_Reg strlib[] = {
+  {"buffer", str_buffer},
   {"byte", str_byte},
   {"char", str_char},
   {"dump", str_dump},
@@ -865,6 +1097,7 @@ LUALIB_API int luaopen_string (lua_State *L) {
   lua_setfield(L, -2, "gfind");
 #endif
   createmetatable(L);
+  createbufmeta(L);
   return 1;
 }
 
@@ -32,6 +32,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lstring.h"
 #include "ltable.h"
 
 
@@ -74,8 +75,8 @@
 #define dummynode		(&dummynode_)
 
 static const Node dummynode_ = {
-  {{NULL}, LUA_TNIL},  /* value */
-  {{{NULL}, LUA_TNIL, NULL}}  /* key */
+  {NILCONSTANT},  /* value */
+  {{NILCONSTANT, NULL}}  /* key */
 };
 
 
@@ -93,6 +94,182 @@ static Node *hashnum (const Table *t, lua_Number n) {
 }
 
 
+/*
+** hash for integer keys. Without the integer subtype they are stored
+** as lua_Numbers.
+*/
+#if defined(LUA_INTSUBTYPE)
+#define hashint(t,i)	hashpow2(t, cast(lu_int64, i))
+#define eqintkey(k,i)	(ttisint(k) && ivalue(k) == (i))
+#else
+#define hashint(t,i)	hashnum(t, cast_num(i))
+#define eqintkey(k,i)	(ttisnumber(k) && luai_numeq(nvalue(k), cast_num(i)))
+#endif
+
+
+/*
+** 整数值的浮点数键统一转为整数键, 使t[1]与t[1.0]是同一个键
+*/
+#if defined(LUA_INTSUBTYPE)
+static const TValue *normkey (const TValue *key, TValue *aux) {
+  l_int i;
+  if (ttisflt(key) && luaO_num2int(fltvalue(key), &i)) {
+    setivalue(aux, i);
+    return aux;
+  }
+  return key;
+}
+#else
+#define normkey(key,aux)	((void)(aux), (key))
+#endif
+
+
+
+#if defined(LUA_SHAPES)
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+/* 空形状, 所有形状模式的表都从这里开始 */
+static const Shape emptyshape_ = {NULL, NULL, 0, {NULL}};
+
+#define emptyshape	(cast(Shape *, &emptyshape_))
+
+#define sizeshape(n)	(sizeof(Shape) + sizeof(TString *) * ((n) - 1))
+
+#define hashshape(p,key,size)	lmod(IntPoint(p) ^ (key)->tsv.hash, size)
+
+
+/*
+** 键`key`在形状`s`中的槽位, 不存在时返回-1
+ */
+static int shapeslot (const Shape *s, TString *key) {
+  int i;
+  for (i = 0; i < s->nkeys; i++) {
+    if (s->keys[i] == key) return i;
+  }
+  return -1;
+}
+
+
+static void resizeshapes (lua_State *L, int newsize) {
+  global_State *g = G(L);
+  Shape **newhash = luaM_newvector(L, newsize, Shape *);
+  int i;
+  for (i = 0; i < newsize; i++) newhash[i] = NULL;
+  for (i = 0; i < g->sizeshapes; i++) {  /* rehash */
+    Shape *s = g->shapes[i];
+    while (s) {
+      Shape *next = s->hnext;
+      int h = hashshape(s->parent, lastkey(s), newsize);
+      s->hnext = newhash[h];
+      newhash[h] = s;
+      s = next;
+    }
+  }
+  luaM_freearray(L, g->shapes, g->sizeshapes, Shape *);
+  g->shapes = newhash;
+  g->sizeshapes = newsize;
+}
+
+
+/*
+** 形状`s`加上键`key`之后的形状; 超出LUAI_MAXSHAPEKEYS或者LUAI_MAXSHAPES
+** 时返回NULL, 表改用散列表部分
+ */
+static Shape *transition (lua_State *L, Shape *s, TString *key) {
+  global_State *g = G(L);
+  Shape *ns;
+  int h;
+  if (g->sizeshapes > 0) {
+    for (ns = g->shapes[hashshape(s, key, g->sizeshapes)]; ns; ns = ns->hnext) {
+      if (ns->parent == s && lastkey(ns) == key)
+        return ns;
+    }
+  }
+  if (s->nkeys >= LUAI_MAXSHAPEKEYS || g->nshapes >= LUAI_MAXSHAPES)
+    return NULL;
+  if (g->nshapes >= g->sizeshapes)
+    resizeshapes(L, (g->sizeshapes == 0) ? 32 : g->sizeshapes*2);
+  ns = cast(Shape *, luaM_malloc(L, sizeshape(s->nkeys + 1)));
+  ns->parent = s;
+  ns->nkeys = s->nkeys + 1;
+  memcpy(ns->keys, s->keys, s->nkeys * sizeof(TString *));
+  ns->keys[s->nkeys] = key;
+  h = hashshape(s, key, g->sizeshapes);
+  ns->hnext = g->shapes[h];
+  g->shapes[h] = ns;
+  g->nshapes++;
+  return ns;
+}
+
+
+/*
+** 在形状模式的表中加入字符串键`key`, 返回其值所在的槽位;
+** 形状无法再增长时返回NULL
+ */
+static TValue *shapenewkey (lua_State *L, Table *t, TString *key) {
+  Shape *s = transition(L, t->shape, key);
+  int n = t->shape->nkeys;
+  if (s == NULL) return NULL;
+  if (sizeslots(n + 1) != sizeslots(n))
+    luaM_reallocvector(L, t->slots, sizeslots(n), sizeslots(n + 1), TValue);
+  t->shape = s;
+  setnilvalue(&t->slots[n]);
+  return &t->slots[n];
+}
+
+
+static void setnodevector (lua_State *L, Table *t, int size);
+
+/*
+** 把形状模式的表转为普通的散列表部分
+ */
+static void unshape (lua_State *L, Table *t) {
+  Shape *s = t->shape;
+  TValue *slots = t->slots;
+  int i, n = 0;
+  for (i = 0; i < s->nkeys; i++) {
+    if (!ttisnil(&slots[i])) n++;
+  }
+  setnodevector(L, t, n);
+  t->shape = NULL;
+  t->slots = NULL;
+  for (i = 0; i < s->nkeys; i++) {
+    if (!ttisnil(&slots[i]))
+      setobjt2t(L, luaH_setstr(L, t, s->keys[i]), &slots[i]);
+  }
+  luaM_freearray(L, slots, sizeslots(s->nkeys), TValue);
+}
+
+
+/*
+** 释放所有形状, 在关闭状态机时调用
+ */
+void luaH_freeshapes (lua_State *L) {
+  global_State *g = G(L);
+  int i;
+  for (i = 0; i < g->sizeshapes; i++) {
+    Shape *s = g->shapes[i];
+    while (s) {
+      Shape *next = s->hnext;
+      luaM_freemem(L, s, sizeshape(s->nkeys));
+      s = next;
+    }
+  }
+  luaM_freearray(L, g->shapes, g->sizeshapes, Shape *);
+  g->shapes = NULL;
+  g->sizeshapes = g->nshapes = 0;
+}
+
+/*
+** }=============================================================
+*/
+#endif
+
+
 
 /*
 ** returns the `main' position of an element in a table (that is, the index
@@ -101,9 +278,13 @@ static Node *hashnum (const Table *t, lua_Number n) {
 static Node *mainposition (const Table *t, const TValue *key) {
   switch (ttype(key)) {
     case LUA_TNUMBER:
+      if (ttisint(key)) return hashint(t, ivalue(key));
       return hashnum(t, nvalue(key));
-    case LUA_TSTRING:
-      return hashstr(t, rawtsvalue(key));
+    case LUA_TSTRING: {
+      TString *ts = rawtsvalue(key);
+      if (isshortstr(ts)) return hashstr(t, ts);
+      return hashpow2(t, luaS_hashlongstr(ts));  /* hashed on first use */
+    }
     case LUA_TBOOLEAN:
       return hashboolean(t, bvalue(key));
     case LUA_TLIGHTUSERDATA:
@@ -119,7 +300,12 @@ static Node *mainposition (const Table *t, const TValue *key) {
 ** the array part of the table, -1 otherwise.
 */
 static int arrayindex (const TValue *key) {
-  if (ttisnumber(key)) {
+  if (ttisint(key)) {
+    l_int k = ivalue(key);
+    if (0 < k && k <= MAXASIZE)
+      return cast_int(k);
+  }
+  else if (ttisnumber(key)) {
     lua_Number n = nvalue(key);
     int k;
     lua_number2int(k, n);
@@ -135,12 +321,22 @@ static int arrayindex (const TValue *key) {
 ** elements in the array part, then elements in the hash part. The
 ** beginning of a traversal is signalled by -1.
 */
-static int findindex (lua_State *L, Table *t, StkId key) {
+static int findindex (lua_State *L, Table *t, StkId skey) {
+  TValue aux;
+  const TValue *key = normkey(skey, &aux);
   int i;
   if (ttisnil(key)) return -1;  /* first iteration */
   i = arrayindex(key);
   if (0 < i && i <= t->sizearray)  /* is `key' inside array part? */
     return i-1;  /* yes; that's the index (corrected to C) */
+#if defined(LUA_SHAPES)
+  else if (isshaped(t)) {
+    if (ttisstring(key) && (i = shapeslot(t->shape, rawtsvalue(key))) >= 0)
+      return i + t->sizearray;  /* slots are numbered after array ones */
+    luaG_runerror(L, "invalid key to " LUA_QL("next"));  /* key not found */
+    return 0;  /* to avoid warnings */
+  }
+#endif
   else {
     Node *n = mainposition(t, key);
     do {  /* check whether `key' is somewhere in the chain */
@@ -166,11 +362,23 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
   int i = findindex(L, t, key);  /* find original element */
   for (i++; i < t->sizearray; i++) { /* 取得数据部分第一个非空值 */ /* try first array part */
     if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
-      setnvalue(key, cast_num(i+1));
+      setivalue(key, i+1);
       setobj2s(L, key+1, &t->array[i]);
       return 1;
     }
   }
+#if defined(LUA_SHAPES)
+  if (isshaped(t)) {  /* then slots */
+    for (i -= t->sizearray; i < t->shape->nkeys; i++) {
+      if (!ttisnil(&t->slots[i])) {
+        setsvalue2s(L, key, t->shape->keys[i]);
+        setobj2s(L, key+1, &t->slots[i]);
+        return 1;
+      }
+    }
+    return 0;
+  }
+#endif
   for (i -= t->sizearray; i < sizenode(t); i++) { /* 取得散列表部分第一个非空值 */ /* then hash part */
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       setobj2s(L, key, key2tval(gnode(t, i)));
@@ -322,6 +530,7 @@ static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
     luaM_reallocvector(L, t->array, oldasize, nasize, TValue);
   }
   /* re-insert elements from hash part */
+  /* 节点位置会改变; 指令内联缓存在使用前会校验节点的键, 无需在此处失效 */
   for (i = twoto(oldhsize) - 1; i >= 0; i--) {
     Node *old = nold+i;
     if (!ttisnil(gval(old)))
@@ -355,6 +564,17 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
   /* compute new size for array part */
   /* 计算数组部分确保50%以上利用率所需的空间大小 */
   na = computesizes(nums, &nasize);
+#if defined(LUA_SHAPES)
+  if (isshaped(t)) {
+    if (na == totaluse) {  /* all new keys go to the array part? */
+      resize(L, t, nasize, 0);  /* keep the shape */
+      return;
+    }
+    unshape(L, t);  /* needs a hash part */
+    rehash(L, t, ek);
+    return;
+  }
+#endif
   /* resize the table to new computed sizes */
   resize(L, t, nasize, totaluse - na);
 }
@@ -382,7 +602,17 @@ Table *luaH_new (lua_State *L, int narray, int nhash) {
   t->sizearray = 0;
   t->lsizenode = 0;
   t->node = cast(Node *, dummynode); /* 指向空节点 */
+#if defined(LUA_SHAPES)
+  t->shape = NULL;
+  t->slots = NULL;
+#endif
   setarrayvector(L, t, narray);
+#if defined(LUA_SHAPES)
+  if (nhash <= LUAI_MAXSHAPEKEYS) {  /* may be a record? */
+    t->shape = emptyshape;  /* start in shape mode, without hash part */
+    nhash = 0;
+  }
+#endif
   setnodevector(L, t, nhash);
   return t;
 }
@@ -395,6 +625,10 @@ void luaH_free (lua_State *L, Table *t) {
   /* 销毁数组部分和散列表部分 */
   if (t->node != dummynode)
     luaM_freearray(L, t->node, sizenode(t), Node);
+#if defined(LUA_SHAPES)
+  if (isshaped(t))
+    luaM_freearray(L, t->slots, sizeslots(t->shape->nkeys), TValue);
+#endif
   luaM_freearray(L, t->array, t->sizearray, TValue);
   luaM_free(L, t);
 }
@@ -430,7 +664,18 @@ static Node *getfreepos (Table *t) {
 如果一个元素不在其主位置上, 则冲突元素就会在这个主位置上. 只有在两个元素拥有同样的主位置时才会出现冲突. 由于不存在次级冲突, 负载因子可以达到100%而没有任何性能损失
  */
 static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
-  Node *mp = mainposition(t, key);
+  Node *mp;
+#if defined(LUA_SHAPES)
+  if (isshaped(t)) {
+    if (ttisstring(key) && isshortstr(rawtsvalue(key))) {  /* shapes compare keys by address */
+      TValue *v = shapenewkey(L, t, rawtsvalue(key));
+      if (v != NULL) return v;
+    }
+    rehash(L, t, key);  /* keeps the shape only for new array keys */
+    return luaH_set(L, t, key);
+  }
+#endif
+  mp = mainposition(t, key);
   if (!ttisnil(gval(mp)) || mp == dummynode) {
     Node *othern;
     Node *n = getfreepos(t);  /* 获取空闲节点 */ /* get a free place */
@@ -456,7 +701,7 @@ static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
       mp = n;
     }
   }
-  gkey(mp)->value = key->value; gkey(mp)->tt = key->tt;
+  setobj2t(L, key2tval(mp), key);  /* `next' field is kept */
   luaC_barriert(L, t, key);
   lua_assert(ttisnil(gval(mp)));
   return gval(mp);
@@ -469,17 +714,16 @@ static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
 /*
 ** 从表`t`中读取键类型为整数时关联的值
  */
-const TValue *luaH_getnum (Table *t, int key) {
+const TValue *luaH_getnum (Table *t, l_int key) {
   /* (1 <= key && key <= t->sizearray) */
   /* 下标在数组大小范围内, 从数组部分直接读取 */
-  if (cast(unsigned int, key-1) < cast(unsigned int, t->sizearray))
+  if (cast(lu_int64, key) - 1u < cast(lu_int64, t->sizearray))
     return &t->array[key-1];
   else {
     /* 否则从散列表部分读取. 如非顺序下标或下标数值过大等情况 */
-    lua_Number nk = cast_num(key);
-    Node *n = hashnum(t, nk);
+    Node *n = hashint(t, key);
     do {  /* check whether `key' is somewhere in the chain */
-      if (ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk))
+      if (eqintkey(gkey(n), key))
         return gval(n);  /* that's it */
       else n = gnext(n);
     } while (n);
@@ -488,6 +732,24 @@ const TValue *luaH_getnum (Table *t, int key) {
 }
 
 
+/*
+** 长字符串键: 按内容比较. 形状中没有长字符串键
+ */
+static const TValue *getlngstr (Table *t, TString *key) {
+  Node *n;
+#if defined(LUA_SHAPES)
+  if (isshaped(t)) return luaO_nilobject;
+#endif
+  n = hashpow2(t, luaS_hashlongstr(key));
+  do {  /* check whether `key' is somewhere in the chain */
+    if (ttisstring(gkey(n)) && luaS_eqlngstr(rawtsvalue(gkey(n)), key))
+      return gval(n);  /* that's it */
+    else n = gnext(n);
+  } while (n);
+  return luaO_nilobject;
+}
+
+
 /*
 ** search function for strings
 */
@@ -495,8 +757,16 @@ const TValue *luaH_getnum (Table *t, int key) {
 ** 从表`t`中读取键类型为字符串时关联的值
  */
 const TValue *luaH_getstr (Table *t, TString *key) {
+  Node *n;
+  if (!isshortstr(key)) return getlngstr(t, key);
+#if defined(LUA_SHAPES)
+  if (isshaped(t)) {
+    int i = shapeslot(t->shape, key);
+    return (i >= 0) ? &t->slots[i] : luaO_nilobject;
+  }
+#endif
   /* 定位所在的bucket */
-  Node *n = hashstr(t, key);
+  n = hashstr(t, key);
   /* 遍历拉链 */
   do {  /* check whether `key' is somewhere in the chain */
     if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key)
@@ -507,6 +777,32 @@ const TValue *luaH_getstr (Table *t, TString *key) {
 }
 
 
+/*
+** 同`luaH_getstr`, 找到时把节点下标记录到`slot`中, 供内联缓存使用
+ */
+const TValue *luaH_getstrslot (Table *t, TString *key, int *slot) {
+  Node *n;
+  if (!isshortstr(key)) return getlngstr(t, key);  /* not cached */
+#if defined(LUA_SHAPES)
+  if (isshaped(t)) {
+    int i = shapeslot(t->shape, key);
+    if (i < 0) return luaO_nilobject;
+    *slot = i;
+    return &t->slots[i];
+  }
+#endif
+  n = hashstr(t, key);
+  do {  /* check whether `key' is somewhere in the chain */
+    if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key) {
+      *slot = cast_int(n - t->node);
+      return gval(n);  /* that's it */
+    }
+    else n = gnext(n);
+  } while (n);
+  return luaO_nilobject;
+}
+
+
 /*
 ** main search function
 */
@@ -518,10 +814,10 @@ const TValue *luaH_get (Table *t, const TValue *key) {
     case LUA_TNIL: return luaO_nilobject;
     case LUA_TSTRING: return luaH_getstr(t, rawtsvalue(key));
     case LUA_TNUMBER: {
-      int k;
-      lua_Number n = nvalue(key);
-      lua_number2int(k, n);
-      if (luai_numeq(cast_num(k), nvalue(key))) /* index is int? */
+      l_int k;
+      if (ttisint(key))
+        return luaH_getnum(t, ivalue(key));
+      if (luaO_num2int(nvalue(key), &k))  /* index is int? */
         return luaH_getnum(t, k);  /* use specialized version */
       /* else go through */
     }
@@ -549,22 +845,23 @@ TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   else {
+    TValue aux;
     if (ttisnil(key)) luaG_runerror(L, "table index is nil");
     else if (ttisnumber(key) && luai_numisnan(nvalue(key)))
       luaG_runerror(L, "table index is NaN");
     /* 创建值对象并加入表`t` */
-    return newkey(L, t, key);
+    return newkey(L, t, normkey(key, &aux));
   }
 }
 
 
-TValue *luaH_setnum (lua_State *L, Table *t, int key) {
+TValue *luaH_setnum (lua_State *L, Table *t, l_int key) {
   const TValue *p = luaH_getnum(t, key);
   if (p != luaO_nilobject)
     return cast(TValue *, p);
   else {
     TValue k;
-    setnvalue(&k, cast_num(key));
+    setivalue(&k, key);
     return newkey(L, t, &k);
   }
 }
@@ -630,12 +927,13 @@ int luaH_getn (Table *t) {
 
 
 
+int luaH_isdummy (Node *n) { return n == dummynode; }
+
+
 #if defined(LUA_DEBUG)
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
   return mainposition(t, key);
 }
 
-int luaH_isdummy (Node *n) { return n == dummynode; }
-
 #endif
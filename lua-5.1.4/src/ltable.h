@@ -21,10 +21,48 @@
 
 #define key2tval(n)	(&(n)->i_key.tvk)
 
+/* 散列表部分中值`v`所在节点的键 */ /* key of the node holding value `v' */
+#define keyfromval(v) \
+	(gkey(cast(Node *, cast(char *, (v)) - offsetof(Node, i_val))))
 
-LUAI_FUNC const TValue *luaH_getnum (Table *t, int key);
-LUAI_FUNC TValue *luaH_setnum (lua_State *L, Table *t, int key);
+#if defined(LUA_SHAPES)
+/* 表是否处于形状模式 */
+#define isshaped(t)	((t)->shape != NULL)
+/* capacity of the slot vector for `n' keys */
+#define sizeslots(n)	((n) == 0 ? 0 : twoto(ceillog2(n)))
+/* key added by the last transition into shape `s' */
+#define lastkey(s)	((s)->keys[(s)->nkeys - 1])
+#endif
+
+
+/*
+** 带内联缓存的字符串键查找. `slot`保存上次找到`key`的节点下标,
+** 使用前先校验该节点的键, 命中则无需散列和遍历拉链; 否则回退到
+** `luaH_getstrslot`并更新`slot`. 由于每次都做校验, 表重新散列或
+** 换成另一张表时缓存自然失效, 不需要额外的失效处理.
+** 形状模式的表中`slot`是槽位下标, 同样先校验形状中该位置的键.
+*/
+#define hashgetstrcached(t,key,slot) \
+	(*(slot) < sizenode(t) && \
+	 ttisstring(gkey(gnode(t, *(slot)))) && \
+	 rawtsvalue(gkey(gnode(t, *(slot)))) == (key) \
+	   ? gval(gnode(t, *(slot))) : luaH_getstrslot(t, key, slot))
+
+#if defined(LUA_SHAPES)
+#define luaH_getstrcached(t,key,slot) \
+	(isshaped(t) \
+	   ? (*(slot) < (t)->shape->nkeys && (t)->shape->keys[*(slot)] == (key) \
+	        ? &(t)->slots[*(slot)] : luaH_getstrslot(t, key, slot)) \
+	   : hashgetstrcached(t, key, slot))
+#else
+#define luaH_getstrcached(t,key,slot)	hashgetstrcached(t, key, slot)
+#endif
+
+
+LUAI_FUNC const TValue *luaH_getnum (Table *t, l_int key);
+LUAI_FUNC TValue *luaH_setnum (lua_State *L, Table *t, l_int key);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getstrslot (Table *t, TString *key, int *slot);
 LUAI_FUNC TValue *luaH_setstr (lua_State *L, Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_set (lua_State *L, Table *t, const TValue *key);
@@ -33,11 +71,15 @@ LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, int nasize);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
 LUAI_FUNC int luaH_getn (Table *t);
+#if defined(LUA_SHAPES)
+LUAI_FUNC void luaH_freeshapes (lua_State *L);
+#endif
 
 
+LUAI_FUNC int luaH_isdummy (Node *n);
+
 #if defined(LUA_DEBUG)
 LUAI_FUNC Node *luaH_mainposition (const Table *t, const TValue *key);
-LUAI_FUNC int luaH_isdummy (Node *n);
 #endif
 
 
@@ -52,6 +52,11 @@
 
 typedef struct lua_State lua_State;
 
+/* 多个状态共享的只读函数原型段 */
+typedef struct lua_Shared lua_Shared;
+
+typedef struct lua_Rope lua_Rope;
+
 typedef int (*lua_CFunction) (lua_State *L);
 
 
@@ -130,6 +135,7 @@ typedef LUA_INTEGER lua_Integer;
 LUA_API lua_State *(lua_newstate) (lua_Alloc f, void *ud);
 LUA_API void       (lua_close) (lua_State *L);
 LUA_API lua_State *(lua_newthread) (lua_State *L);
+LUA_API lua_State *(lua_clone) (lua_State *from, lua_Alloc f, void *ud);
 
 LUA_API lua_CFunction (lua_atpanic) (lua_State *L, lua_CFunction panicf);
 
@@ -153,6 +159,7 @@ LUA_API void  (lua_xmove) (lua_State *from, lua_State *to, int n);
 */
 
 LUA_API int             (lua_isnumber) (lua_State *L, int idx);
+LUA_API int             (lua_isinteger) (lua_State *L, int idx);
 LUA_API int             (lua_isstring) (lua_State *L, int idx);
 LUA_API int             (lua_iscfunction) (lua_State *L, int idx);
 LUA_API int             (lua_isuserdata) (lua_State *L, int idx);
@@ -246,10 +253,53 @@ LUA_API int  (lua_status) (lua_State *L);
 #define LUA_GCSTEP		5
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
+#define LUA_GCGEN		10
+#define LUA_GCINC		11
+#define LUA_GCSETWORKERS	12
+#define LUA_GCSETBGSWEEP	13
+#define LUA_GCSTEPTIME		14
+#define LUA_GCSETMAXPAUSE	15
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
 
+/*
+** garbage-collection statistics (times in microseconds; per-type
+** counts are indexed by type tag, with 9 = prototype and 10 = upvalue)
+*/
+
+#define LUA_GCPPROPAGATE	0
+#define LUA_GCPATOMIC		1
+#define LUA_GCPSWEEPSTRING	2
+#define LUA_GCPSWEEP		3
+#define LUA_GCPFINALIZE		4
+#define LUA_GCPHASES		5
+
+#define LUA_GCTYPES		11
+
+typedef struct lua_GCStats {
+  size_t cycles;  /* number of complete cycles */
+  double phasetime[LUA_GCPHASES];  /* time spent in each phase */
+  size_t marked[LUA_GCTYPES];  /* objects marked, by type */
+  size_t freed[LUA_GCTYPES];  /* objects freed, by type */
+  size_t traversed;  /* bytes traversed by the mark phase */
+  double maxstep;  /* longest single step */
+} lua_GCStats;
+
+LUA_API void (lua_gcstats) (lua_State *L, int total, lua_GCStats *s);
+
+
+/*
+** JIT compiler options (only effective when built with LUA_USE_JIT)
+*/
+
+#define LUA_JITOFF		0
+#define LUA_JITON		1
+#define LUA_JITSTATUS		2
+
+LUA_API int (lua_jit) (lua_State *L, int what);
+
+
 /*
 ** miscellaneous functions
 */
@@ -262,6 +312,30 @@ LUA_API void  (lua_concat) (lua_State *L, int n);
 
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud);
+LUA_API void (lua_setarena) (lua_State *L, int on);
+
+
+/*
+** shared read-only prototypes (see lshared.c)
+*/
+LUA_API lua_Shared *(lua_newshared) (lua_Alloc f, void *ud);
+LUA_API int        (lua_shareadd) (lua_Shared *S, lua_State *L);
+LUA_API void       (lua_releaseshared) (lua_Shared *S);
+LUA_API size_t     (lua_sharedsize) (lua_Shared *S);
+LUA_API lua_State *(lua_newsharedstate) (lua_Alloc f, void *ud, lua_Shared *S);
+LUA_API int        (lua_pushshared) (lua_State *L, int i);
+
+
+/*
+** growable byte buffers whose contents become strings without a copy
+** (see lstring.c)
+*/
+LUA_API char       *(lua_ropeprep) (lua_State *L, lua_Rope **r, size_t len,
+                                    size_t n);
+LUA_API void        (lua_ropeadd) (lua_Rope *r, size_t n);
+LUA_API const char *(lua_ropedata) (lua_Rope *r);
+LUA_API const char *(lua_pushrope) (lua_State *L, lua_Rope *r, size_t len);
+LUA_API void        (lua_freerope) (lua_State *L, lua_Rope *r);
 
 
 
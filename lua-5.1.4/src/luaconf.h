@@ -321,6 +321,224 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 
 
+/*
+@@ LUAI_GCMAXPAUSE is the default time limit, in microseconds, of each
+@* incremental step of the garbage collector (0 means no limit).
+** CHANGE it if your program must answer within a fixed time. A step
+** then stops when its time is up even if it did not pay its debt; the
+** atomic step cannot be interrupted. The collector reads the clock with
+** clock_gettime(CLOCK_MONOTONIC) on POSIX systems and with clock()
+** elsewhere. You can also change this value dynamically.
+*/
+/*
+@@ LUAI_GCMAXPAUSE 增量回收每一步的最长时间(微秒), 0表示不限
+*/
+#define LUAI_GCMAXPAUSE	0
+
+
+/*
+@@ LUAI_GENMINORMUL is the default size of the young generation in the
+@* generational mode, as a percentage of the memory in use after the
+@* previous collection: a minor collection starts when the program has
+@* allocated that much since then. You can also change it dynamically.
+@@ LUAI_GENMAJORMUL controls major collections in the generational
+@* mode: one is done when memory in use grows more than this percentage
+@* over its size after the previous major collection.
+*/
+/*
+@@ LUAI_GENMINORMUL 分代模式下新生代的大小(占上次回收后内存用量的百分比)
+@@ LUAI_GENMAJORMUL 内存用量比上次完整回收后增长超过该百分比时做一次完整回收
+*/
+#define LUAI_GENMINORMUL	20
+#define LUAI_GENMAJORMUL	100
+
+
+/*
+@@ LUA_PARALLELGC lets the collector mark the heap with several threads.
+** CHANGE it (define it) if you have large heaps and spare cores. Full
+** collections, generational cycles and the atomic step of incremental
+** cycles then share the marking work among a pool of threads while the
+** rest of the VM waits. It needs POSIX threads and GCC atomic builtins
+** (link with -lpthread if your libc does not include them).
+@@ LUAI_GCWORKERS is the initial number of marking threads (counting the
+@* thread that runs the collector). You can also change it dynamically
+@* with LUA_GCSETWORKERS.
+*/
+/*
+@@ LUA_PARALLELGC 用多个线程并行标记: 完整回收, 分代回收以及增量回收的原子
+** 阶段由线程池分担标记工作, 其余的虚拟机处于暂停状态. 需要POSIX线程
+@@ LUAI_GCWORKERS 初始的标记线程数(包括执行回收的线程), 1表示不并行
+*/
+#if defined(LUA_PARALLELGC)
+#if !defined(LUA_USE_POSIX) || !defined(__GNUC__)
+#undef LUA_PARALLELGC
+#endif
+#endif
+
+#if !defined(LUAI_GCWORKERS)
+#define LUAI_GCWORKERS	1
+#endif
+
+
+/*
+@@ LUA_BGSWEEP makes a background thread free the dead objects.
+** CHANGE it (define it) if freeing memory shows up in your latency
+** profiles. The sweep phase then only unlinks dead objects and hands
+** them to the thread; threads and open upvalues are still freed in
+** place. The allocation function must be thread-safe (the default one
+** is). It needs POSIX threads. You can also turn it on and off
+** dynamically with LUA_GCSETBGSWEEP.
+*/
+/*
+@@ LUA_BGSWEEP 由后台线程释放死对象, 清除阶段只把它们从链表中摘下.
+** 内存管理函数必须是线程安全的
+*/
+#if defined(LUA_BGSWEEP)
+#if !defined(LUA_USE_POSIX)
+#undef LUA_BGSWEEP
+#endif
+#endif
+
+
+/*
+@@ LUA_USE_THREADS lets several OS threads share one state.
+** CHANGE it (define it) if your host runs coroutines of the same state
+** on different threads. Each API call then holds a lock on the global
+** state, which is released while C functions and hooks run. The
+** interpreter passes a safe point at every function entry and loop
+** back-edge; after LUAI_LOCKQUANTUM of them it hands the lock over if
+** another thread is waiting. Waiters are served in arrival order, so a
+** thread waits at most one quantum of each thread ahead of it. Compiled
+** code (LUA_USE_JIT) does not pass those points, so the JIT is turned
+** off. It needs POSIX threads and GCC atomic builtins (link with
+** -lpthread if your libc does not include them).
+@@ LUAI_LOCKQUANTUM is the number of safe points a thread may still pass
+@* once another thread waits for the lock.
+*/
+/*
+@@ LUA_USE_THREADS 允许多个操作系统线程共享同一个状态: API调用期间持有
+** 全局状态上的锁, 执行C函数和钩子时释放. 解释器在函数入口和循环回跳处
+** 经过LUAI_LOCKQUANTUM个安全点后, 如有线程等待则交出锁, 等待者按到达
+** 顺序获得锁. 此时关闭JIT
+*/
+#if defined(LUA_USE_THREADS)
+#if !defined(LUA_USE_POSIX) || !defined(__GNUC__)
+#undef LUA_USE_THREADS
+#else
+#define lua_lock(L)		luaE_lock(L)
+#define lua_unlock(L)		luaE_unlock(L)
+#define luai_lockwaiting(L)	luaE_lockwaiting(L)
+#undef LUA_USE_JIT
+#endif
+#endif
+
+#define LUAI_LOCKQUANTUM	1000
+
+
+/*
+@@ LUA_FULLHASH makes the string hash read every byte of a string.
+** CHANGE it (undefine it) to get back the hash of Lua 5.1, which reads
+** at most 32 bytes spread over the string: it is faster on huge strings,
+** but strings that differ only in the skipped bytes (long URLs, JSON
+** keys with a common prefix) land in the same bucket of the string
+** table. Either way the hash is seeded per state, so the collisions of
+** one process cannot be replayed against another.
+@@ luai_makeseed is the source of randomness for those seeds.
+** CHANGE it if your system has a better one; the seed also mixes in
+** some addresses, which vary with ASLR. Define it as a constant to get
+** the same hashes in every run.
+*/
+/*
+@@ LUA_FULLHASH 字符串散列读取全部字节(按xxHash64的方式每次8个字节),
+** 否则与Lua 5.1相同, 长字符串只采样至多32个字节. 散列值总是带有每个
+** 状态不同的随机种子(luai_makeseed)
+*/
+#define LUA_FULLHASH
+
+#if defined(LUA_CORE)
+#include <time.h>
+#define luai_makeseed()		((unsigned int)time(NULL))
+#endif
+
+
+/*
+@@ LUAI_MAXSHORTLEN is the maximum length of an interned string.
+** CHANGE it if your programs build many strings just above or below it.
+** Longer strings are not hashed nor looked up when created, so reading
+** a file or concatenating big pieces costs only the copy; they are
+** hashed (once) when first used as a table key and compared by length
+** and contents instead of by address.
+*/
+/*
+@@ LUAI_MAXSHORTLEN 内部化字符串的最大长度. 更长的字符串创建时不计算
+** 散列也不查找字符串表, 第一次作为表的键使用时才计算散列, 比较相等时
+** 比较长度和内容
+*/
+#define LUAI_MAXSHORTLEN	40
+
+
+/*
+@@ LUA_ROPES lets concatenation append to the buffer of its first operand.
+@@ LUAI_MINROPE is the shortest concatenation result that does so.
+** CHANGE them (undefine LUA_ROPES) to copy every result into a new string,
+** as Lua 5.1 does. A result of at least LUAI_MINROPE bytes whose first
+** operand is not a short string goes to a buffer with room to grow, and
+** the result of `s .. x' with such an `s' is appended in place, so loops
+** like `s = s .. piece' take linear time. The bytes are contiguous, so
+** hashing and comparisons read them directly; lua_tolstring seals the
+** buffer (or copies a string that others extended) to give a C string.
+** LUAI_MINROPE must be greater than LUAI_MAXSHORTLEN.
+*/
+/*
+@@ LUA_ROPES 拼接结果追加到第一个操作数的缓冲中, 不再每次复制整个字符串.
+@@ LUAI_MINROPE 结果至少这么长, 并且第一个操作数不是短字符串时才使用
+** 绳索字符串. 循环`s = s .. piece`每次只复制`piece`
+*/
+#define LUA_ROPES
+#define LUAI_MINROPE	256
+
+
+/*
+@@ LUA_USE_JUMPTABLE controls how 'luaV_execute' dispatches opcodes.
+** CHANGE it to 0 if your compiler does not support GCC's "labels as
+** values" extension or if you want the portable 'switch' dispatch.
+** (By default it is on for GCC-compatible compilers.)
+*/
+/*
+@@ LUA_USE_JUMPTABLE 为1时虚拟机主循环使用跳转表(computed goto)分派指令,
+** 为0时使用`switch`. 可在编译时通过 -DLUA_USE_JUMPTABLE=0 关闭.
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__) && !defined(LUA_ANSI)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+
+/*
+@@ LUA_USE_JIT enables the baseline JIT compiler (see ljit.c).
+** CHANGE it (define it) if you want hot Lua functions translated to
+** native code. It is only honored on x86-64 with POSIX mmap; elsewhere
+** it is silently turned off and Lua runs on the interpreter alone.
+@@ LUAI_JITHOT is the number of calls or loop back-edges after which
+** a function is compiled.
+*/
+/*
+@@ LUA_USE_JIT 开启基线JIT编译器: 热点函数被翻译成x86-64机器码执行.
+** 仅支持x86-64 + POSIX(mmap); 需在编译时通过 -DLUA_USE_JIT 打开.
+@@ LUAI_JITHOT 函数被调用或循环回跳多少次后触发编译.
+*/
+#if defined(LUA_USE_JIT)
+#if !defined(__x86_64__) || !defined(LUA_USE_POSIX) || defined(__cplusplus)
+#undef LUA_USE_JIT
+#endif
+#endif
+
+#define LUAI_JITHOT	50
+
+
 
 /*
 @@ LUA_COMPAT_GETN controls compatibility with old getn behavior.
@@ -507,6 +725,22 @@
 */
 #define LUAL_BUFFERSIZE		BUFSIZ
 
+
+/*
+@@ LUAL_POOLMAX is the largest block served by the size-class pools of
+@* luaL_newpoolstate; larger blocks go to realloc.
+@@ LUAL_POOLCHUNK is the size of the chunks the pools carve blocks from.
+** CHANGE them if your objects have other sizes. LUAL_POOLMAX must be a
+** multiple of 8; the default covers strings of up to a few hundred
+** bytes, tables, upvalues, closures and the initial CallInfo array.
+*/
+/*
+@@ LUAL_POOLMAX 内存池按大小分级管理的最大块, 更大的块直接使用realloc
+@@ LUAL_POOLCHUNK 内存池每次向系统申请的内存大小
+*/
+#define LUAL_POOLMAX		512
+#define LUAL_POOLCHUNK		(16*1024)
+
 /* }================================================================== */
 
 
@@ -605,6 +839,113 @@ union luai_Cast { double l_d; long l_l; };
 /* }================================================================== */
 
 
+/*
+** {==================================================================
+@@ LUA_INTSUBTYPE gives numbers an integer subtype.
+** CHANGE it (undefine it) if you want all numbers to be lua_Numbers.
+** Integer literals, lengths, lua_pushinteger and integer-valued table
+** keys produce 64-bit integers; `+', `-', `*' and `%' over two integers
+** stay integers unless they overflow. Every other operation, and any
+** operation mixing integers with floats, follows the lua_Number rules.
+** Both subtypes still have type "number". Not available with LUA_NANBOX.
+@@ LUAI_INT is the type of the integer subtype (at least 64 bits).
+@@ LUAI_UINT64 is an unsigned integer with exactly 64 bits.
+@@ LUAI_INTFMT is the format for writing integers.
+@@ lua_int2str converts an integer to a string.
+** ===================================================================
+*/
+/*
+@@ LUA_INTSUBTYPE 数值的整数子类型: 整数字面量, 长度, lua_pushinteger以及
+** 整数值的表键都是64位整数; 两个整数的加减乘模不溢出时结果仍是整数,
+** 其它运算以及整数与浮点数的混合运算按lua_Number计算
+*/
+#if defined(LUA_NUMBER_DOUBLE)
+#define LUA_INTSUBTYPE
+#endif
+
+#define LUAI_INT	long long
+#define LUAI_UINT64	unsigned long long
+#define LUAI_INTMAX	LLONG_MAX
+#define LUAI_INTMIN	LLONG_MIN
+#define LUAI_INTFMT	"%lld"
+#define lua_int2str(s,i)	sprintf((s), LUAI_INTFMT, (i))
+
+
+/*
+@@ The luai_int* macros define the primitive operations over integers.
+** Each one stores the result in `*r' and returns 1, or returns 0 when
+** the result is not representable (the caller then uses lua_Numbers).
+*/
+#if defined(LUA_CORE)
+#if defined(__GNUC__) && __GNUC__ >= 5
+#define luai_intadd(a,b,r)	(!__builtin_add_overflow(a, b, r))
+#define luai_intsub(a,b,r)	(!__builtin_sub_overflow(a, b, r))
+#define luai_intmul(a,b,r)	(!__builtin_mul_overflow(a, b, r))
+#else
+#define luai_intadd(a,b,r)	(((b) >= 0 ? (a) <= LUAI_INTMAX - (b) \
+				          : (a) >= LUAI_INTMIN - (b)) && \
+				 (*(r) = (a) + (b), 1))
+#define luai_intsub(a,b,r)	(((b) >= 0 ? (a) >= LUAI_INTMIN + (b) \
+				          : (a) <= LUAI_INTMAX + (b)) && \
+				 (*(r) = (a) - (b), 1))
+#define luai_intmul(a,b,r)	((a) >= -2147483647 && (a) <= 2147483647 && \
+				 (b) >= -2147483647 && (b) <= 2147483647 && \
+				 (*(r) = (a) * (b), 1))
+#endif
+/* result has the sign of the divisor, as luai_nummod */
+#define luai_intmod(a,b,r)	((b) != 0 && \
+	(*(r) = ((b) == -1) ? 0 : (a) % (b), \
+	 (*(r) != 0 && (*(r) ^ (b)) < 0) ? (*(r) += (b)) : 0, 1))
+#endif
+
+/* }================================================================== */
+
+
+/*
+@@ LUA_NANBOX selects the 8-byte "NaN-boxed" representation of values.
+** CHANGE it (define it) if you want every TValue (stack slots, array
+** entries, table keys and values) to take 8 bytes instead of 16.
+** Numbers are stored as plain doubles; every other value lives inside
+** the payload of a negative quiet NaN (4-bit type tag + 47-bit pointer).
+** It requires double numbers and x86-64 (user-space pointers fit in 47
+** bits). The JIT (LUA_USE_JIT) knows only the 16-byte layout, and
+** a 64-bit integer subtype (LUA_INTSUBTYPE) does not fit in a NaN.
+*/
+/*
+@@ LUA_NANBOX 使用NaN-boxing表示TValue: 数值直接存为double, 其余类型的值
+** 编码在负quiet NaN的低51位中(4位类型 + 47位指针), 每个值只占8字节.
+*/
+#if defined(LUA_NANBOX)
+#if !defined(LUA_NUMBER_DOUBLE) || !defined(__x86_64__)
+#error "LUA_NANBOX requires double numbers and x86-64"
+#endif
+#undef LUA_USE_JIT
+#undef LUA_INTSUBTYPE
+#endif
+
+
+/*
+@@ LUA_SHAPES turns on shapes (hidden classes) for record-like tables.
+** CHANGE it (define it) if your program builds many tables with the
+** same few string keys. Such tables share one immutable key layout (a
+** shape) and keep their values in a dense slot vector instead of owning
+** a hash part; a table falls back to the ordinary hash part as soon as
+** it gets a key that is not a string (outside its array part) or more
+** keys than a shape can hold.
+@@ LUAI_MAXSHAPEKEYS is the maximum number of keys in a shape.
+@@ LUAI_MAXSHAPES is the maximum number of shapes in a state.
+** Shapes and their keys live until the state is closed.
+*/
+/*
+@@ LUA_SHAPES 为记录式的表开启形状(隐藏类): 键集合相同的表共享一份不可变
+** 的键布局, 值按槽位保存在紧凑的数组中, 不再各自分配散列表部分
+*/
+#if defined(LUA_SHAPES)
+#define LUAI_MAXSHAPEKEYS	16
+#define LUAI_MAXSHAPES		4096
+#endif
+
+
 /*
 @@ LUAI_USER_ALIGNMENT_T is a type that requires maximum alignment.
 ** CHANGE it if your system requires alignments larger than double. (For
@@ -14,6 +14,9 @@
 /* Key to file-handle type */
 #define LUA_FILEHANDLE		"FILE*"
 
+/* Key to string-buffer type */
+#define LUA_STRBUFHANDLE	"string.buffer"
+
 
 #define LUA_COLIBNAME	"coroutine"
 LUALIB_API int (luaopen_base) (lua_State *L);
@@ -39,6 +42,35 @@ LUALIB_API int (luaopen_debug) (lua_State *L);
 #define LUA_LOADLIBNAME	"package"
 LUALIB_API int (luaopen_package) (lua_State *L);
 
+#define LUA_WORKERLIBNAME	"worker"
+LUALIB_API int (luaopen_worker) (lua_State *L);
+
+/*
+** Buffers and channels of the worker library. Buffers are immutable
+** byte blocks or arrays of numbers shared by reference between
+** independent states; `f' (if not NULL) releases `data' when the last
+** reference goes away. A channel carries messages between states; it
+** starts with one reference, owned by the caller of `luaW_newchannel'.
+*/
+typedef struct luaW_Channel luaW_Channel;
+typedef void (*luaW_Free) (void *ud, void *data);
+
+LUALIB_API void (luaW_pushbuffer) (lua_State *L, void *data, size_t len,
+                                   luaW_Free f, void *ud);
+LUALIB_API void (luaW_pusharray) (lua_State *L, lua_Number *data, size_t n,
+                                  luaW_Free f, void *ud);
+LUALIB_API const char *(luaW_tobuffer) (lua_State *L, int idx, size_t *len);
+LUALIB_API const lua_Number *(luaW_toarray) (lua_State *L, int idx,
+                                             size_t *n);
+
+LUALIB_API luaW_Channel *(luaW_newchannel) (int capacity);
+LUALIB_API void (luaW_releasechannel) (luaW_Channel *c);
+LUALIB_API void (luaW_closechannel) (luaW_Channel *c);
+LUALIB_API void (luaW_pushchannel) (lua_State *L, luaW_Channel *c);
+LUALIB_API luaW_Channel *(luaW_tochannel) (lua_State *L, int idx);
+LUALIB_API int (luaW_send) (lua_State *L, luaW_Channel *c, int n);
+LUALIB_API int (luaW_receive) (lua_State *L, luaW_Channel *c, int wait);
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L); 
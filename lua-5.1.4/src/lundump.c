@@ -86,6 +86,7 @@ static lua_Number LoadNumber(LoadState* S)
 {
  lua_Number x;
  LoadVar(S,x);
+ canonnan(x);
  return x;
 }
 
@@ -146,6 +147,13 @@ static void LoadConstants(LoadState* S, Proto* f)
    case LUA_TNUMBER:  /* 数值 */
 	setnvalue(o,LoadNumber(S));
 	break;
+   case LUA_TNUMINT:  /* 整数 */
+	{
+	 l_int x;
+	 LoadVar(S,x);
+	 setivalue(o,x);
+	}
+	break;
    case LUA_TSTRING:  /* 字符串 */
 	setsvalue2n(S->L,o,LoadString(S));
 	break;
@@ -263,7 +271,7 @@ void luaU_header (char* h)
  memcpy(h,LUA_SIGNATURE,sizeof(LUA_SIGNATURE)-1); /* 头部签名 `<esc>Lua`或`0x1B4C7561`, 通过检查该签名确定文件是二进制还是文本 */
  h+=sizeof(LUA_SIGNATURE)-1;
  *h++=(char)LUAC_VERSION;                         /* 版本号, lua5.1为`0x51` */
- *h++=(char)LUAC_FORMAT;                          /* 格式版本, 官方文本为0 */
+ *h++=(char)LUAC_FORMAT;                          /* 格式版本, 官方格式为0, 本实现为1 */
  *h++=(char)*(char*)&x;				                    /* 字节序标识, 默认为 1. 0: 大端模式; 1: 小端模式 *//* endianness */
  *h++=(char)sizeof(int);                          /* integer数据类型大小 */
  *h++=(char)sizeof(size_t);                       /* size_t数据类型大小 */
@@ -29,7 +29,10 @@ LUAI_FUNC void luaU_print (const Proto* f, int full);
 #define LUAC_VERSION		0x51
 
 /* for header of binary files -- this is the official format */
-#define LUAC_FORMAT		0
+/* 格式1: 在官方格式(0)基础上增加了超级指令操作码, 常量中还可以有整数
+** (LUA_TNUMINT), 与官方格式互不兼容. 加入整数之前的加载器也接受格式1,
+** 但遇到整数常量时报告"bad constant" */
+#define LUAC_FORMAT		1
 
 /* size of header of binary files */
 /* lua5.1二进制文件头部大小严格等于12字节, 否则系统拒绝加载该二进制文件. */
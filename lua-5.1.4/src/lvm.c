@@ -11,6 +11,7 @@
  * 不过寄存器式虚拟机生成的操作码要比堆栈式虚拟机少, 因此指令总长度大不了多少
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,6 +25,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -39,15 +41,70 @@
 #define MAXTAGLOOP	100
 
 
-const TValue *luaV_tonumber (const TValue *obj, TValue *n) {
+/*
+** 数值比较: 两个整数直接比较, 否则按lua_Number比较
+ */
+#define numlt(a,b)	((ttisint(a) && ttisint(b)) ? ivalue(a) < ivalue(b) : \
+			 luai_numlt(nvalue(a), nvalue(b)))
+#define numle(a,b)	((ttisint(a) && ttisint(b)) ? ivalue(a) <= ivalue(b) : \
+			 luai_numle(nvalue(a), nvalue(b)))
+#define numeq(a,b)	((ttisint(a) && ttisint(b)) ? ivalue(a) == ivalue(b) : \
+			 luai_numeq(nvalue(a), nvalue(b)))
+
+
+static const TValue *str2number (const char *s, TValue *n) {
   lua_Number num;
-  if (ttisnumber(obj)) return obj;
-  if (ttisstring(obj) && luaO_str2d(svalue(obj), &num)) {
+  l_int i;
+  if (luaO_str2int(s, &i)) {  /* integer string? */
+    setivalue(n, i);
+    return n;
+  }
+  if (luaO_str2d(s, &num)) {
     setnvalue(n, num);
     return n;
   }
-  else
-    return NULL;
+  return NULL;
+}
+
+
+#if defined(LUA_ROPES)
+
+/*
+** 后面还有其他字节的绳索字符串: 去掉两端的空白(`luaO_str2d`会忽略)后
+** 复制出来再转换. 短的复制到栈上, 长的复制到`G(L)->buff`中,
+** 结果与缓冲后面追加了什么无关
+*/
+static const TValue *ropetonumber (lua_State *L, const TString *ts,
+                                   TValue *n) {
+  char sbuff[LUAI_MINROPE];
+  char *buff = sbuff;
+  const char *s = getstr(ts);
+  size_t l = ts->tsv.len;
+  while (l > 0 && isspace(cast(unsigned char, *s))) s++, l--;
+  while (l > 0 && isspace(cast(unsigned char, s[l-1]))) l--;
+  if (l >= sizeof(sbuff))  /* long numeral? */
+    buff = luaZ_openspace(L, &G(L)->buff, l + 1);
+  memcpy(buff, s, l);
+  buff[l] = '\0';
+  return str2number(buff, n);
+}
+
+#endif
+
+
+const TValue *luaV_tonumber (lua_State *L, const TValue *obj, TValue *n) {
+  if (ttisnumber(obj)) return obj;
+  if (ttisstring(obj)) {
+#if defined(LUA_ROPES)
+    const TString *ts = rawtsvalue(obj);
+    if (isrope(ts) && ropeof(ts)->used != ts->tsv.len)  /* not a C string? */
+      return ropetonumber(L, ts, n);
+#else
+    UNUSED(L);
+#endif
+    return str2number(svalue(obj), n);
+  }
+  return NULL;
 }
 
 
@@ -57,8 +114,12 @@ int luaV_tostring (lua_State *L, StkId obj) {
     return 0;
   else {
     char s[LUAI_MAXNUMBER2STR];
-    lua_Number n = nvalue(obj);
-    lua_number2str(s, n);
+    if (ttisint(obj))
+      lua_int2str(s, ivalue(obj));
+    else {
+      lua_Number n = nvalue(obj);
+      lua_number2str(s, n);
+    }
     setsvalue2s(L, obj, luaS_new(L, s));
     return 1;
   }
@@ -220,10 +281,10 @@ static int call_orderTM (lua_State *L, const TValue *p1, const TValue *p2,
 }
 
 
-static int l_strcmp (const TString *ls, const TString *rs) {
-  const char *l = getstr(ls);
+static int l_strcmp (lua_State *L, TString *ls, TString *rs) {
+  const char *l = luaS_tocstr(L, ls);  /* `strcoll' needs C strings */
   size_t ll = ls->tsv.len;
-  const char *r = getstr(rs);
+  const char *r = luaS_tocstr(L, rs);
   size_t lr = rs->tsv.len;
   for (;;) {
     int temp = strcoll(l, r);
@@ -249,23 +310,23 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
   else if (ttisnumber(l))
-    return luai_numlt(nvalue(l), nvalue(r));
+    return numlt(l, r);
   else if (ttisstring(l))
-    return l_strcmp(rawtsvalue(l), rawtsvalue(r)) < 0;
+    return l_strcmp(L, rawtsvalue(l), rawtsvalue(r)) < 0;
   else if ((res = call_orderTM(L, l, r, TM_LT)) != -1)
     return res;
   return luaG_ordererror(L, l, r);
 }
 
 
-static int lessequal (lua_State *L, const TValue *l, const TValue *r) {
+int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r) {
   int res;
   if (ttype(l) != ttype(r))
     return luaG_ordererror(L, l, r);
   else if (ttisnumber(l))
-    return luai_numle(nvalue(l), nvalue(r));
+    return numle(l, r);
   else if (ttisstring(l))
-    return l_strcmp(rawtsvalue(l), rawtsvalue(r)) <= 0;
+    return l_strcmp(L, rawtsvalue(l), rawtsvalue(r)) <= 0;
   else if ((res = call_orderTM(L, l, r, TM_LE)) != -1)  /* first try `le' */
     return res;
   else if ((res = call_orderTM(L, r, l, TM_LT)) != -1)  /* else try `lt' */
@@ -282,9 +343,10 @@ int luaV_equalval (lua_State *L, const TValue *t1, const TValue *t2) {
   lua_assert(ttype(t1) == ttype(t2));
   switch (ttype(t1)) {
     case LUA_TNIL: return 1;
-    case LUA_TNUMBER: return luai_numeq(nvalue(t1), nvalue(t2));
+    case LUA_TNUMBER: return numeq(t1, t2);
     case LUA_TBOOLEAN: return bvalue(t1) == bvalue(t2);  /* true must be 1 !! */
     case LUA_TLIGHTUSERDATA: return pvalue(t1) == pvalue(t2);
+    case LUA_TSTRING: return eqstr(rawtsvalue(t1), rawtsvalue(t2));
     case LUA_TUSERDATA: {
       if (uvalue(t1) == uvalue(t2)) return 1;
       tm = get_compTM(L, uvalue(t1)->metatable, uvalue(t2)->metatable,
@@ -327,6 +389,15 @@ void luaV_concat (lua_State *L, int total, int last) {
         if (l >= MAX_SIZET - tl) luaG_runerror(L, "string length overflow");
         tl += l;
       }
+#if defined(LUA_ROPES)
+      /* 第一个操作数可能是正在累加的字符串, 结果放到它的缓冲中 */
+      if (tl >= LUAI_MINROPE && !isshortstr(rawtsvalue(top-n))) {
+        setsvalue2s(L, top-n, luaS_ropecat(L, top-n, n, tl));
+        total -= n-1;
+        last -= n-1;
+        continue;
+      }
+#endif
       buffer = luaZ_openspace(L, &G(L)->buff, tl);
       tl = 0;
       for (i=n; i>0; i--) {  /* concat all strings */
@@ -342,16 +413,37 @@ void luaV_concat (lua_State *L, int total, int last) {
 }
 
 
+/*
+** 整数运算. 结果不能表示为整数(溢出, 模0, 除法, 乘方)时返回0
+ */
+static int intarith (TValue *ra, l_int x, l_int y, TMS op) {
+  l_int r;
+  switch (op) {
+    case TM_ADD: if (!luai_intadd(x, y, &r)) return 0; break;
+    case TM_SUB: if (!luai_intsub(x, y, &r)) return 0; break;
+    case TM_MUL: if (!luai_intmul(x, y, &r)) return 0; break;
+    case TM_MOD: if (!luai_intmod(x, y, &r)) return 0; break;
+    case TM_UNM: if (x == LUAI_INTMIN) return 0; r = -x; break;
+    default: return 0;
+  }
+  setivalue(ra, r);
+  return 1;
+}
+
+
 /*
 ** 算术操作
  */
-static void Arith (lua_State *L, StkId ra, const TValue *rb,
-                   const TValue *rc, TMS op) {
+void luaV_arith (lua_State *L, StkId ra, const TValue *rb,
+                 const TValue *rc, TMS op) {
   TValue tempb, tempc;
   const TValue *b, *c;
-  if ((b = luaV_tonumber(rb, &tempb)) != NULL &&
-      (c = luaV_tonumber(rc, &tempc)) != NULL) {
-    lua_Number nb = nvalue(b), nc = nvalue(c);
+  if ((b = luaV_tonumber(L, rb, &tempb)) != NULL &&
+      (c = luaV_tonumber(L, rc, &tempc)) != NULL) {
+    lua_Number nb, nc;
+    if (ttisint(b) && ttisint(c) && intarith(ra, ivalue(b), ivalue(c), op))
+      return;
+    nb = nvalue(b); nc = nvalue(c);
     switch (op) {
       case TM_ADD: setnvalue(ra, luai_numadd(nb, nc)); break;
       case TM_SUB: setnvalue(ra, luai_numsub(nb, nc)); break;
@@ -369,11 +461,90 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 
 
 
+/*
+** 取长度操作`#`: 表和字符串直接求值, 其余类型尝试`__len`元方法
+ */
+void luaV_objlen (lua_State *L, StkId ra, const TValue *rb) {
+  switch (ttype(rb)) {
+    case LUA_TTABLE: {
+      setivalue(ra, luaH_getn(hvalue(rb)));
+      break;
+    }
+    case LUA_TSTRING: {
+      setivalue(ra, tsvalue(rb)->len);
+      break;
+    }
+    default: {  /* try metamethod */
+      if (!call_binTM(L, rb, luaO_nilobject, ra, TM_LEN))
+        luaG_typeerror(L, rb, "get length of");
+    }
+  }
+}
+
+
+/*
+** 整数循环的上限: 浮点数上限按步长方向取整, 超出整数范围时截断为
+** LUAI_INTMAX或LUAI_INTMIN. 上限是NaN, 或者超出的一侧与步长方向相反
+** (循环一次也不执行)时返回0, 交给浮点数循环处理
+ */
+static int forlimit (const TValue *lim, l_int step, l_int *p) {
+  if (ttisint(lim)) {
+    *p = ivalue(lim);
+    return 1;
+  }
+  else {
+    lua_Number n = nvalue(lim);
+    n = (step > 0) ? floor(n) : ceil(n);
+    if (luaO_num2int(n, p))
+      return 1;
+    else if (luai_numlt(0, n)) {  /* too large: clip */
+      *p = LUAI_INTMAX;
+      return (step > 0);
+    }
+    else if (luai_numlt(n, 0)) {  /* too small: clip */
+      *p = LUAI_INTMIN;
+      return (step < 0);
+    }
+    else return 0;  /* NaN */
+  }
+}
+
+
+/*
+** 数值for循环的准备(OP_FORPREP): 检查初值, 上限和步长. 初值和步长都是
+** 整数时做整数循环, 否则三者都转为lua_Number. 最后初值减去步长
+ */
+void luaV_forprep (lua_State *L, StkId ra) {
+  const TValue *init = ra;
+  const TValue *plimit = ra+1;
+  const TValue *pstep = ra+2;
+  l_int i, limit;
+  if (!tonumber(L, init, ra))
+    luaG_runerror(L, LUA_QL("for") " initial value must be a number");
+  else if (!tonumber(L, plimit, ra+1))
+    luaG_runerror(L, LUA_QL("for") " limit must be a number");
+  else if (!tonumber(L, pstep, ra+2))
+    luaG_runerror(L, LUA_QL("for") " step must be a number");
+  if (ttisint(init) && ttisint(pstep) &&
+      forlimit(plimit, ivalue(pstep), &limit) &&
+      luai_intsub(ivalue(init), ivalue(pstep), &i)) {
+    setivalue(ra+1, limit);
+    setivalue(ra+2, ivalue(pstep));
+    setivalue(ra, i);
+  }
+  else {
+    lua_Number step = nvalue(pstep);
+    setnvalue(ra+1, nvalue(plimit));
+    setnvalue(ra, luai_numsub(nvalue(init), step));
+    setnvalue(ra+2, step);
+  }
+}
+
 /*
 ** some macros for common tasks in `luaV_execute'
 */
 
-#define runtime_check(L, c)	{ if (!(c)) break; }
+#define runtime_check(L, c)	{ if (!(c)) vmbreak; }
 
 /* 从指令i中取出A部分, 与当前函数基址`base`相加 */
 #define RA(i)	(base+GETARG_A(i))
@@ -388,21 +559,222 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb,
 #define KBx(i)	check_exp(getBMode(GET_OPCODE(i)) == OpArgK, k+GETARG_Bx(i))
 
 
-#define dojump(L,pc,i)	{(pc) += (i); luai_threadyield(L);}
+/* 跳转本身不交出全局锁, 见`threadyield` */
+#define dojump(L,pc,i)	{(pc) += (i);}
 
 
 #define Protect(x)	{ L->savedpc = pc; {x;}; base = L->base; }
 
 
-#define arith_op(op,tm) { \
+/*
+** 取指令. 同时处理行/计数钩子, 并解码出目标寄存器`ra`
+ */
+#define vmfetch()	{ \
+  i = *pc++; \
+  if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) && \
+      (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) { \
+    traceexec(L, pc); \
+    if (L->status == LUA_YIELD) {  /* did hook yield? */ \
+      L->savedpc = pc - 1; \
+      return; \
+    } \
+    base = L->base; \
+  } \
+  /* warning!! several calls may realloc the stack and invalidate `ra' */ \
+  ra = RA(i); \
+  lua_assert(base == L->base && L->base == L->ci->base); \
+  lua_assert(base <= L->top && L->top <= L->stack + L->stacksize); \
+  lua_assert(L->top == L->ci->top || luaG_checkopenop(i)); \
+}
+
+
+/*
+** 超级指令: 执行完第一条指令的语义后, 不经过分派直接取出紧随其后的第二条
+** 指令, 跳转到标签`l`处执行. 有行/计数钩子时退化为普通分派, 以保证钩子
+** 依然能看到每一条指令.
+ */
+#define vmfuse(l)	{ \
+  if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) vmbreak; \
+  i = *pc++; \
+  ra = RA(i); \
+  lua_assert(GET_OPCODE(i) == OP_CALL || GET_OPCODE(i) == OP_SETTABLE); \
+  goto l; \
+}
+
+
+/*
+** 指令分派. 默认使用`switch`; 开启LUA_USE_JUMPTABLE时由"ljumptab.h"
+** 改为跳转表(computed goto), 每条指令结束时直接跳到下一条指令的处理代码
+ */
+#define vmdispatch(o)	switch(o)
+#define vmcase(l)	case l:
+#define vmbreak		continue
+
+
+/*
+** 常量字符串键的读表操作, 使用当前指令的内联缓存`cache`.
+** 缓存未命中, 结果为nil且有`__index`或者`t`不是表时走通用路径.
+ */
+#define gettable_cached(t,key,cache) { \
+        const TValue *t_ = (t); \
+        if (ttistable(t_)) { \
+          Table *h = hvalue(t_); \
+          const TValue *res = luaH_getstrcached(h, rawtsvalue(key), cache); \
+          if (!ttisnil(res) || fasttm(L, h->metatable, TM_INDEX) == NULL) { \
+            setobj2s(L, ra, res); \
+          } \
+          else Protect(luaV_gettable(L, t_, key, ra)); \
+        } \
+        else Protect(luaV_gettable(L, t_, key, ra)); \
+      }
+
+/*
+** 进入机器码: 当前线程开启了JIT, 没有行/计数钩子, 并且函数已编译(或此时
+** 足够热而编译成功)时, 从`pc`开始执行机器码; 机器码在遇到CALL/TAILCALL/
+** RETURN或者循环中发现钩子时返回, 解释器从`L->savedpc`继续
+ */
+#if defined(LUA_USE_JIT)
+#define jitenter()	{ \
+  if (L->jitmode && !(L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) && \
+      luaJ_hot(L, cl->p)) { \
+    L->savedpc = pc; \
+    luaJ_execute(L, pc); \
+    pc = L->savedpc; \
+    base = L->base; \
+  } \
+}
+#else
+#define jitenter()	((void)0)
+#endif
+
+/*
+** 安全点(函数入口和循环回跳): 其他操作系统线程在等待全局锁时交出锁
+** (见LUA_USE_THREADS). 等待期间其他线程可能执行回收并重新分配本线程
+** 的栈, 因此之后重新读取`base`
+ */
+#define threadyield() \
+	{ if (luai_lockwaiting(L)) Protect(luai_threadyield(L)); }
+
+/* 当前指令的内联缓存槽位 */
+#define ICACHE(pc)	(ic + pcRel(pc, cl->p))
+
+
+/*
+** 两个数值的运算: 都是整数且`iop`的结果可以表示为整数时得到整数,
+** 否则按lua_Number运算`op`
+ */
+#define numarith(op,iop,rb,rc) { \
+        l_int i_; \
+        if (ttisint(rb) && ttisint(rc) && iop(ivalue(rb), ivalue(rc), &i_)) { \
+          setivalue(ra, i_); \
+        } \
+        else { \
+          lua_Number nb = nvalue(rb), nc = nvalue(rc); \
+          setnvalue(ra, op(nb, nc)); \
+        } \
+      }
+
+/* 没有整数形式的运算(除法, 乘方) */
+#define luai_intnone(a,b,r)	((void)(r), 0)
+
+
+#define arith_op(op,iop,tm) { \
+        TValue *rb = RKB(i); \
+        TValue *rc = RKC(i); \
+        if (ttisnumber(rb) && ttisnumber(rc)) \
+          numarith(op, iop, rb, rc) \
+        else \
+          Protect(luaV_arith(L, ra, rb, rc, tm)); \
+      }
+
+
+/*
+** 快速化(quickening): 通用指令的操作数都是数值时, 把当前指令改写为专用指令
+** `qop`(C为寄存器)或`qop+1`(C为常量), 下次执行时免去RK解码和常量类型检查.
+** B为常量时不改写. 专用指令遇到非数值操作数时改写回通用指令(去快速化),
+** 并在内联缓存中做标记, 此后该指令不再快速化, 避免反复改写.
+** 共享原型的代码只读, 不做快速化.
+ */
+#define setcurop(o)	SET_OPCODE(cl->p->code[pcRel(pc, cl->p)], o)
+
+#define quicken(qop) \
+	{ if (!ISK(GETARG_B(i)) && *ICACHE(pc) == 0 && !isshared(obj2gco(cl->p))) \
+	    setcurop(ISK(GETARG_C(i)) ? (qop)+1 : (qop)); }
+
+#define dequicken(bop)	{ setcurop(bop); *ICACHE(pc) = 1; }
+
+
+#define arith_qop(op,iop,tm,qop) { \
         TValue *rb = RKB(i); \
         TValue *rc = RKC(i); \
         if (ttisnumber(rb) && ttisnumber(rc)) { \
-          lua_Number nb = nvalue(rb), nc = nvalue(rc); \
-          setnvalue(ra, op(nb, nc)); \
+          numarith(op, iop, rb, rc); \
+          quicken(qop); \
         } \
         else \
-          Protect(Arith(L, ra, rb, rc, tm)); \
+          Protect(luaV_arith(L, ra, rb, rc, tm)); \
+      }
+
+
+#define arith_nn(op,iop,tm,bop) { \
+        TValue *rb = RB(i); \
+        TValue *rc = RC(i); \
+        if (ttisnumber(rb) && ttisnumber(rc)) \
+          numarith(op, iop, rb, rc) \
+        else { \
+          dequicken(bop); \
+          Protect(luaV_arith(L, ra, rb, rc, tm)); \
+        } \
+      }
+
+
+#define arith_nk(op,iop,tm,bop) { \
+        TValue *rb = RB(i); \
+        TValue *rc = k+INDEXK(GETARG_C(i)); \
+        lua_assert(ttisnumber(rc)); \
+        if (ttisnumber(rb)) \
+          numarith(op, iop, rb, rc) \
+        else { \
+          dequicken(bop); \
+          Protect(luaV_arith(L, ra, rb, rc, tm)); \
+        } \
+      }
+
+
+/*
+** 比较指令. `cmp`为通用比较函数(可能调用元方法)
+ */
+#define compare_qop(numop,cmp,qop) { \
+        TValue *rb = RKB(i); \
+        TValue *rc = RKC(i); \
+        if (ttisnumber(rb) && ttisnumber(rc)) { \
+          quicken(qop); \
+          if (numop(rb, rc) == GETARG_A(i)) \
+            dojump(L, pc, GETARG_sBx(*pc)); \
+        } \
+        else Protect( \
+          if (cmp(L, rb, rc) == GETARG_A(i)) \
+            dojump(L, pc, GETARG_sBx(*pc)); \
+        ) \
+        pc++; \
+      }
+
+
+#define compare_nop(numop,cmp,bop,rc) { \
+        TValue *rb = RB(i); \
+        TValue *rc_ = (rc); \
+        if (ttisnumber(rb) && ttisnumber(rc_)) { \
+          if (numop(rb, rc_) == GETARG_A(i)) \
+            dojump(L, pc, GETARG_sBx(*pc)); \
+        } \
+        else { \
+          dequicken(bop); \
+          Protect( \
+            if (cmp(L, rb, rc_) == GETARG_A(i)) \
+              dojump(L, pc, GETARG_sBx(*pc)); \
+          ) \
+        } \
+        pc++; \
       }
 
 
@@ -414,172 +786,176 @@ void luaV_execute (lua_State *L, int nexeccalls) {
   LClosure *cl;
   StkId base;
   TValue *k;
+  int *ic;
   const Instruction *pc;
+  Instruction i;
+  StkId ra;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
  reentry:  /* entry point */
   lua_assert(isLua(L->ci));
   pc = L->savedpc;              /* @see luaD_precall() `L->savedpc = p->code;` */
   cl = &clvalue(L->ci->func)->l;
   base = L->base;
   k = cl->p->k;
+  ic = cl->p->icache;
+  if (ic == NULL) {  /* first run of this function? */
+    if (isshared(obj2gco(cl->p)))  /* 共享原型使用本状态的缓存 */ /* read-only proto */
+      ic = G(L)->icscratch + cl->p->icbase;
+    else {
+      luaF_newicache(L, cl->p);
+      ic = cl->p->icache;
+    }
+  }
+  threadyield();
+  jitenter();
   /* main loop of interpreter */
   /* 解释器主循环 */
   for (;;) {
-    const Instruction i = *pc++;
-    StkId ra;
-    if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) &&
-        (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) {
-      traceexec(L, pc);
-      if (L->status == LUA_YIELD) {  /* did hook yield? */
-        L->savedpc = pc - 1;
-        return;
-      }
-      base = L->base;
-    }
-    /* warning!! several calls may realloc the stack and invalidate `ra' */
-    ra = RA(i);
-    lua_assert(base == L->base && L->base == L->ci->base);
-    lua_assert(base <= L->top && L->top <= L->stack + L->stacksize);
-    lua_assert(L->top == L->ci->top || luaG_checkopenop(i));
-    switch (GET_OPCODE(i)) {
-      case OP_MOVE: {
+    vmfetch();
+    vmdispatch (GET_OPCODE(i)) {
+      vmcase(OP_MOVE) {
         setobjs2s(L, ra, RB(i));
-        continue;
+        vmbreak;
       }
-      case OP_LOADK: {
+      vmcase(OP_LOADK) {
         setobj2s(L, ra, KBx(i));
-        continue;
+        vmbreak;
       }
-      case OP_LOADBOOL: {
+      vmcase(OP_LOADBOOL) {
         setbvalue(ra, GETARG_B(i));
         if (GETARG_C(i)) pc++;  /* skip next instruction (if C) */
-        continue;
+        vmbreak;
       }
-      case OP_LOADNIL: {
+      vmcase(OP_LOADNIL) {
         TValue *rb = RB(i);
         do {
           setnilvalue(rb--);
         } while (rb >= ra);
-        continue;
+        vmbreak;
       }
-      case OP_GETUPVAL: {
+      vmcase(OP_GETUPVAL) {
         int b = GETARG_B(i);
         setobj2s(L, ra, cl->upvals[b]->v);
-        continue;
+        vmbreak;
       }
-      case OP_GETGLOBAL: {
+      vmcase(OP_GETGLOBAL) {
         TValue g;
         TValue *rb = KBx(i);
         sethvalue(L, &g, cl->env);
         lua_assert(ttisstring(rb));
-        Protect(luaV_gettable(L, &g, rb, ra));
-        continue;
+        gettable_cached(&g, rb, ICACHE(pc));
+        vmbreak;
       }
-      case OP_GETTABLE: {
-        Protect(luaV_gettable(L, RB(i), RKC(i), ra));
-        continue;
+      vmcase(OP_GETTABLE) {
+        TValue *rc = RKC(i);
+        if (ISK(GETARG_C(i)) && ttisstring(rc)) {
+          gettable_cached(RB(i), rc, ICACHE(pc));
+        }
+        else
+          Protect(luaV_gettable(L, RB(i), rc, ra));
+        vmbreak;
       }
-      case OP_SETGLOBAL: {
+      vmcase(OP_SETGLOBAL) {
         TValue g;
         sethvalue(L, &g, cl->env);
         lua_assert(ttisstring(KBx(i)));
         Protect(luaV_settable(L, &g, KBx(i), ra));
-        continue;
+        vmbreak;
       }
-      case OP_SETUPVAL: {
+      vmcase(OP_SETUPVAL) {
         UpVal *uv = cl->upvals[GETARG_B(i)];
         setobj(L, uv->v, ra);
         luaC_barrier(L, uv, ra);
-        continue;
+        vmbreak;
       }
-      case OP_SETTABLE: {
+      vmcase(OP_SETTABLE) {
+       l_settable:
         Protect(luaV_settable(L, ra, RKB(i), RKC(i)));
-        continue;
+        vmbreak;
       }
-      case OP_NEWTABLE: {
+      vmcase(OP_NEWTABLE) {
         int b = GETARG_B(i);
         int c = GETARG_C(i);
         sethvalue(L, ra, luaH_new(L, luaO_fb2int(b), luaO_fb2int(c)));
         Protect(luaC_checkGC(L));
-        continue;
+        vmbreak;
       }
-      case OP_SELF: {
+      vmcase(OP_SELF) {
         StkId rb = RB(i);
+        TValue *rc = RKC(i);
         setobjs2s(L, ra+1, rb);
-        Protect(luaV_gettable(L, rb, RKC(i), ra));
-        continue;
+        if (ISK(GETARG_C(i)) && ttisstring(rc)) {
+          gettable_cached(rb, rc, ICACHE(pc));
+        }
+        else
+          Protect(luaV_gettable(L, rb, rc, ra));
+        vmbreak;
       }
-      case OP_ADD: {
-        arith_op(luai_numadd, TM_ADD);
-        continue;
+      vmcase(OP_ADD) {
+        arith_qop(luai_numadd, luai_intadd, TM_ADD, OP_ADDNN);
+        vmbreak;
       }
-      case OP_SUB: {
-        arith_op(luai_numsub, TM_SUB);
-        continue;
+      vmcase(OP_SUB) {
+        arith_qop(luai_numsub, luai_intsub, TM_SUB, OP_SUBNN);
+        vmbreak;
       }
-      case OP_MUL: {
-        arith_op(luai_nummul, TM_MUL);
-        continue;
+      vmcase(OP_MUL) {
+        arith_qop(luai_nummul, luai_intmul, TM_MUL, OP_MULNN);
+        vmbreak;
       }
-      case OP_DIV: {
-        arith_op(luai_numdiv, TM_DIV);
-        continue;
+      vmcase(OP_DIV) {
+        arith_qop(luai_numdiv, luai_intnone, TM_DIV, OP_DIVNN);
+        vmbreak;
       }
-      case OP_MOD: {
-        arith_op(luai_nummod, TM_MOD);
-        continue;
+      vmcase(OP_MOD) {
+        arith_qop(luai_nummod, luai_intmod, TM_MOD, OP_MODNN);
+        vmbreak;
       }
-      case OP_POW: {
-        arith_op(luai_numpow, TM_POW);
-        continue;
+      vmcase(OP_POW) {
+        arith_op(luai_numpow, luai_intnone, TM_POW);
+        vmbreak;
       }
-      case OP_UNM: {
+      vmcase(OP_UNM) {
         TValue *rb = RB(i);
-        if (ttisnumber(rb)) {
+        if (ttisint(rb) && ivalue(rb) != LUAI_INTMIN) {
+          setivalue(ra, -ivalue(rb));
+        }
+        else if (ttisnumber(rb)) {
           lua_Number nb = nvalue(rb);
           setnvalue(ra, luai_numunm(nb));
         }
         else {
-          Protect(Arith(L, ra, rb, rb, TM_UNM));
+          Protect(luaV_arith(L, ra, rb, rb, TM_UNM));
         }
-        continue;
+        vmbreak;
       }
-      case OP_NOT: {
+      vmcase(OP_NOT) {
         int res = l_isfalse(RB(i));  /* next assignment may change this value */
         setbvalue(ra, res);
-        continue;
+        vmbreak;
       }
-      case OP_LEN: {
-        const TValue *rb = RB(i);
-        switch (ttype(rb)) {
-          case LUA_TTABLE: {
-            setnvalue(ra, cast_num(luaH_getn(hvalue(rb))));
-            break;
-          }
-          case LUA_TSTRING: {
-            setnvalue(ra, cast_num(tsvalue(rb)->len));
-            break;
-          }
-          default: {  /* try metamethod */
-            Protect(
-              if (!call_binTM(L, rb, luaO_nilobject, ra, TM_LEN))
-                luaG_typeerror(L, rb, "get length of");
-            )
-          }
-        }
-        continue;
+      vmcase(OP_LEN) {
+        Protect(luaV_objlen(L, ra, RB(i)));
+        vmbreak;
       }
-      case OP_CONCAT: {
+      vmcase(OP_CONCAT) {
         int b = GETARG_B(i);
         int c = GETARG_C(i);
         Protect(luaV_concat(L, c-b+1, c); luaC_checkGC(L));
         setobjs2s(L, RA(i), base+b);
-        continue;
+        vmbreak;
       }
-      case OP_JMP: {
+      vmcase(OP_JMP) {
         dojump(L, pc, GETARG_sBx(i));
-        continue;
+        if (GETARG_sBx(i) < 0) {  /* loop back-edge */
+          threadyield();
+          jitenter();
+        }
+        vmbreak;
       }
-      case OP_EQ: {
+      vmcase(OP_EQ) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         Protect(
@@ -587,42 +963,36 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             dojump(L, pc, GETARG_sBx(*pc));
         )
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_LT: {
-        Protect(
-          if (luaV_lessthan(L, RKB(i), RKC(i)) == GETARG_A(i))
-            dojump(L, pc, GETARG_sBx(*pc));
-        )
-        pc++;
-        continue;
+      vmcase(OP_LT) {
+        compare_qop(numlt, luaV_lessthan, OP_LTNN);
+        vmbreak;
       }
-      case OP_LE: {
-        Protect(
-          if (lessequal(L, RKB(i), RKC(i)) == GETARG_A(i))
-            dojump(L, pc, GETARG_sBx(*pc));
-        )
-        pc++;
-        continue;
+      vmcase(OP_LE) {
+        compare_qop(numle, luaV_lessequal, OP_LENN);
+        vmbreak;
       }
-      case OP_TEST: {
+      vmcase(OP_TEST) {
         if (l_isfalse(ra) != GETARG_C(i))
           dojump(L, pc, GETARG_sBx(*pc));
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_TESTSET: {
+      vmcase(OP_TESTSET) {
         TValue *rb = RB(i);
         if (l_isfalse(rb) != GETARG_C(i)) {
           setobjs2s(L, ra, rb);
           dojump(L, pc, GETARG_sBx(*pc));
         }
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_CALL: {
-        int b = GETARG_B(i);
-        int nresults = GETARG_C(i) - 1;
+      vmcase(OP_CALL) {
+        int b, nresults;
+       l_call:
+        b = GETARG_B(i);
+        nresults = GETARG_C(i) - 1;
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
         L->savedpc = pc;
         switch (luaD_precall(L, ra, nresults)) {
@@ -634,14 +1004,15 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             /* it was a C function (`precall' called it); adjust results */
             if (nresults >= 0) L->top = L->ci->top;
             base = L->base;
-            continue;
+            jitenter();
+            vmbreak;
           }
           default: {
             return;  /* yield */
           }
         }
       }
-      case OP_TAILCALL: {
+      vmcase(OP_TAILCALL) {
         int b = GETARG_B(i);
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
         L->savedpc = pc;
@@ -666,14 +1037,15 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           }
           case PCRC: {  /* it was a C function (`precall' called it) */
             base = L->base;
-            continue;
+            jitenter();
+            vmbreak;
           }
           default: {
             return;  /* yield */
           }
         }
       }
-      case OP_RETURN: {
+      vmcase(OP_RETURN) {
         int b = GETARG_B(i);
         if (b != 0) L->top = ra+b-1;
         if (L->openupval) luaF_close(L, base);
@@ -688,34 +1060,40 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           goto reentry;
         }
       }
-      case OP_FORLOOP: {
-        lua_Number step = nvalue(ra+2);
-        lua_Number idx = luai_numadd(nvalue(ra), step); /* increment index */
-        lua_Number limit = nvalue(ra+1);
-        if (luai_numlt(0, step) ? luai_numle(idx, limit)
-                                : luai_numle(limit, idx)) {
-          dojump(L, pc, GETARG_sBx(i));  /* jump back */
-          setnvalue(ra, idx);  /* update internal index... */
-          setnvalue(ra+3, idx);  /* ...and external index */
+      vmcase(OP_FORLOOP) {
+        if (ttisint(ra)) {  /* integer loop? (set by OP_FORPREP) */
+          l_int step = ivalue(ra+2);
+          l_int idx;
+          if (luai_intadd(ivalue(ra), step, &idx) &&  /* no overflow? */
+              (step > 0 ? idx <= ivalue(ra+1) : ivalue(ra+1) <= idx)) {
+            dojump(L, pc, GETARG_sBx(i));  /* jump back */
+            setivalue(ra, idx);  /* update internal index... */
+            setivalue(ra+3, idx);  /* ...and external index */
+            threadyield();
+            jitenter();
+          }
         }
-        continue;
+        else {
+          lua_Number step = fltvalue(ra+2);
+          lua_Number idx = luai_numadd(fltvalue(ra), step); /* increment index */
+          lua_Number limit = fltvalue(ra+1);
+          if (luai_numlt(0, step) ? luai_numle(idx, limit)
+                                  : luai_numle(limit, idx)) {
+            dojump(L, pc, GETARG_sBx(i));  /* jump back */
+            setnvalue(ra, idx);  /* update internal index... */
+            setnvalue(ra+3, idx);  /* ...and external index */
+            threadyield();
+            jitenter();
+          }
+        }
+        vmbreak;
       }
-      case OP_FORPREP: {
-        const TValue *init = ra;
-        const TValue *plimit = ra+1;
-        const TValue *pstep = ra+2;
-        L->savedpc = pc;  /* next steps may throw errors */
-        if (!tonumber(init, ra))
-          luaG_runerror(L, LUA_QL("for") " initial value must be a number");
-        else if (!tonumber(plimit, ra+1))
-          luaG_runerror(L, LUA_QL("for") " limit must be a number");
-        else if (!tonumber(pstep, ra+2))
-          luaG_runerror(L, LUA_QL("for") " step must be a number");
-        setnvalue(ra, luai_numsub(nvalue(ra), nvalue(pstep)));
+      vmcase(OP_FORPREP) {
+        Protect(luaV_forprep(L, ra));  /* may throw errors */
         dojump(L, pc, GETARG_sBx(i));
-        continue;
+        vmbreak;
       }
-      case OP_TFORLOOP: {
+      vmcase(OP_TFORLOOP) {
         StkId cb = ra + 3;  /* call base */
         setobjs2s(L, cb+2, ra+2);
         setobjs2s(L, cb+1, ra+1);
@@ -727,11 +1105,15 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         if (!ttisnil(cb)) {  /* continue loop? */
           setobjs2s(L, cb-1, cb);  /* save control variable */
           dojump(L, pc, GETARG_sBx(*pc));  /* jump back */
+          pc++;
+          threadyield();
+          jitenter();
+          vmbreak;
         }
         pc++;
-        continue;
+        vmbreak;
       }
-      case OP_SETLIST: {
+      vmcase(OP_SETLIST) {
         int n = GETARG_B(i);
         int c = GETARG_C(i);
         int last;
@@ -751,13 +1133,13 @@ void luaV_execute (lua_State *L, int nexeccalls) {
           setobj2t(L, luaH_setnum(L, h, last--), val);
           luaC_barriert(L, h, val);
         }
-        continue;
+        vmbreak;
       }
-      case OP_CLOSE: {
+      vmcase(OP_CLOSE) {
         luaF_close(L, ra);
-        continue;
+        vmbreak;
       }
-      case OP_CLOSURE: {
+      vmcase(OP_CLOSURE) {
         Proto *p;
         Closure *ncl;
         int nup, j;
@@ -775,9 +1157,9 @@ void luaV_execute (lua_State *L, int nexeccalls) {
         }
         setclvalue(L, ra, ncl);
         Protect(luaC_checkGC(L));
-        continue;
+        vmbreak;
       }
-      case OP_VARARG: {
+      vmcase(OP_VARARG) {
         int b = GETARG_B(i) - 1;
         int j;
         CallInfo *ci = L->ci;
@@ -796,7 +1178,103 @@ void luaV_execute (lua_State *L, int nexeccalls) {
             setnilvalue(ra + j);
           }
         }
-        continue;
+        vmbreak;
+      }
+      vmcase(OP_LOADKCALL) {
+        setobj2s(L, ra, KBx(i));
+        vmfuse(l_call);
+      }
+      vmcase(OP_MOVECALL) {
+        setobjs2s(L, ra, RB(i));
+        vmfuse(l_call);
+      }
+      vmcase(OP_GETGLOBALCALL) {
+        TValue g;
+        TValue *rb = KBx(i);
+        sethvalue(L, &g, cl->env);
+        lua_assert(ttisstring(rb));
+        gettable_cached(&g, rb, ICACHE(pc));
+        vmfuse(l_call);
+      }
+      vmcase(OP_GETTABLECALL) {
+        TValue *rc = RKC(i);
+        if (ISK(GETARG_C(i)) && ttisstring(rc)) {
+          gettable_cached(RB(i), rc, ICACHE(pc));
+        }
+        else
+          Protect(luaV_gettable(L, RB(i), rc, ra));
+        vmfuse(l_call);
+      }
+      vmcase(OP_SELFCALL) {
+        StkId rb = RB(i);
+        TValue *rc = RKC(i);
+        setobjs2s(L, ra+1, rb);
+        if (ISK(GETARG_C(i)) && ttisstring(rc)) {
+          gettable_cached(rb, rc, ICACHE(pc));
+        }
+        else
+          Protect(luaV_gettable(L, rb, rc, ra));
+        vmfuse(l_call);
+      }
+      vmcase(OP_LOADKSET) {
+        setobj2s(L, ra, KBx(i));
+        vmfuse(l_settable);
+      }
+      vmcase(OP_ADDNN) {
+        arith_nn(luai_numadd, luai_intadd, TM_ADD, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_ADDNK) {
+        arith_nk(luai_numadd, luai_intadd, TM_ADD, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_SUBNN) {
+        arith_nn(luai_numsub, luai_intsub, TM_SUB, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_SUBNK) {
+        arith_nk(luai_numsub, luai_intsub, TM_SUB, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_MULNN) {
+        arith_nn(luai_nummul, luai_intmul, TM_MUL, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_MULNK) {
+        arith_nk(luai_nummul, luai_intmul, TM_MUL, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_DIVNN) {
+        arith_nn(luai_numdiv, luai_intnone, TM_DIV, OP_DIV);
+        vmbreak;
+      }
+      vmcase(OP_DIVNK) {
+        arith_nk(luai_numdiv, luai_intnone, TM_DIV, OP_DIV);
+        vmbreak;
+      }
+      vmcase(OP_MODNN) {
+        arith_nn(luai_nummod, luai_intmod, TM_MOD, OP_MOD);
+        vmbreak;
+      }
+      vmcase(OP_MODNK) {
+        arith_nk(luai_nummod, luai_intmod, TM_MOD, OP_MOD);
+        vmbreak;
+      }
+      vmcase(OP_LTNN) {
+        compare_nop(numlt, luaV_lessthan, OP_LT, RC(i));
+        vmbreak;
+      }
+      vmcase(OP_LTNK) {
+        compare_nop(numlt, luaV_lessthan, OP_LT, k+INDEXK(GETARG_C(i)));
+        vmbreak;
+      }
+      vmcase(OP_LENN) {
+        compare_nop(numle, luaV_lessequal, OP_LE, RC(i));
+        vmbreak;
+      }
+      vmcase(OP_LENK) {
+        compare_nop(numle, luaV_lessequal, OP_LE, k+INDEXK(GETARG_C(i)));
+        vmbreak;
       }
     }
   }
@@ -0,0 +1,1503 @@
+/*
+** $Id: lworklib.c $
+** Worker pools: run Lua functions on other cores
+** See Copyright Notice in lua.h
+*/
+
+/*
+** 工作线程池: 每个操作系统线程拥有自己的lua_State. 提交的函数(用
+** `lua_dump`导出的字节码)和参数编码成字节串交给工作线程, 在那里解码
+** 执行, 结果再编码返回. 提交得到一个future对象, 可以查询或者等待结果.
+** 状态之间不共享任何对象, 因此工作线程之间不需要加锁.
+** 唯一的例外是缓冲区(不可变的字节块或数值数组)和通道: 它们在C堆上,
+** 带引用计数, 发送时只传递指针, 所以大块数据在状态之间传递时不复制.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#define lworklib_c
+#define LUA_LIB
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+#if defined(LUA_USE_POSIX)
+
+#include <pthread.h>
+#include <unistd.h>
+
+
+#define BUFFER		"worker.message"
+#define BLOB		"worker.blob"
+#define CHANNEL		"worker.channel"
+#define POOL		"worker.pool"
+#define FUTURE		"worker.future"
+#define OWNER		"worker.owner"  /* pool of a worker state */
+
+
+static void createmetas (lua_State *L);
+
+
+/* the host may have left this library out of the state */
+static void setmeta (lua_State *L, const char *name) {
+  luaL_getmetatable(L, name);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    createmetas(L);
+    luaL_getmetatable(L, name);
+  }
+  lua_setmetatable(L, -2);
+}
+
+
+
+/*
+** {======================================================
+** Shared objects
+** =======================================================
+*/
+
+/*
+** 在状态之间按引用传递的对象(缓冲区和通道). 每个持有者(Lua中的
+** userdata, 在途的消息, C代码)各占一个引用, 最后一个引用释放时销毁.
+** 引用成环(例如通道里的消息持有该通道本身)时不会被释放
+*/
+typedef struct Ref {
+  int refs;
+  void (*destroy) (struct Ref *r);
+} Ref;
+
+
+#define incref(r)	__atomic_add_fetch(&(r)->refs, 1, __ATOMIC_RELAXED)
+
+static void unref (Ref *r) {
+  if (__atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    r->destroy(r);
+}
+
+
+/* push an empty handle; `__gc' ignores it until it is filled */
+static Ref **newhandle (lua_State *L, const char *name) {
+  Ref **p = (Ref **)lua_newuserdata(L, sizeof(Ref *));
+  *p = NULL;
+  setmeta(L, name);
+  return p;
+}
+
+
+/* push a new handle for `r' (taking a reference) */
+static void pushref (lua_State *L, Ref *r, const char *name) {
+  Ref **p = newhandle(L, name);
+  *p = r;
+  incref(r);
+}
+
+
+static Ref *toref (lua_State *L, int idx, const char *name) {
+  Ref **p = (Ref **)lua_touserdata(L, idx);
+  Ref *r = NULL;
+  if (p != NULL && lua_getmetatable(L, idx)) {
+    luaL_getmetatable(L, name);
+    if (lua_rawequal(L, -1, -2)) r = *p;
+    lua_pop(L, 2);
+  }
+  return r;
+}
+
+
+/* `__clone': the copy in the new state is one more holder */
+static int ref_clone (lua_State *L) {
+  Ref **p = (Ref **)lua_touserdata(L, 1);
+  if (*p != NULL) incref(*p);
+  return 0;
+}
+
+
+static int ref_gc (lua_State *L) {
+  Ref **p = (Ref **)lua_touserdata(L, 1);
+  if (*p != NULL) {
+    unref(*p);
+    *p = NULL;
+  }
+  return 0;
+}
+
+
+/*
+** 不可变的数据块: 字节缓冲区或者数值数组. 发送时只传递指针,
+** 接收方直接读取同一块内存
+*/
+enum { BLOB_BYTES, BLOB_NUMBERS };
+
+typedef struct Blob {
+  Ref r;
+  int kind;
+  size_t len;  /* in bytes or in numbers */
+  void *data;
+  luaW_Free freef;  /* releases `data' */
+  void *ud;
+} Blob;
+
+
+static void destroyblob (Ref *r) {
+  Blob *b = (Blob *)r;
+  if (b->freef) b->freef(b->ud, b->data);
+  free(b);
+}
+
+
+static void freedata (void *ud, void *data) {
+  (void)ud;
+  free(data);
+}
+
+
+/* push a new blob adopting `data' */
+static void pushblob (lua_State *L, int kind, void *data, size_t len,
+                      luaW_Free f, void *ud) {
+  Ref **p = newhandle(L, BLOB);
+  Blob *b = (Blob *)malloc(sizeof(Blob));
+  if (b == NULL) {
+    if (f) f(ud, data);
+    luaL_error(L, "not enough memory");
+  }
+  b->r.refs = 1;
+  b->r.destroy = destroyblob;
+  b->kind = kind;
+  b->len = len;
+  b->data = data;
+  b->freef = f;
+  b->ud = ud;
+  *p = &b->r;
+}
+
+
+static Blob *checkblob (lua_State *L, int idx) {
+  Blob *b = (Blob *)toref(L, idx, BLOB);
+  if (b == NULL) luaL_typerror(L, idx, "buffer");
+  return b;
+}
+
+
+LUALIB_API void luaW_pushbuffer (lua_State *L, void *data, size_t len,
+                                 luaW_Free f, void *ud) {
+  pushblob(L, BLOB_BYTES, data, len, f, ud);
+}
+
+
+LUALIB_API void luaW_pusharray (lua_State *L, lua_Number *data, size_t n,
+                                luaW_Free f, void *ud) {
+  pushblob(L, BLOB_NUMBERS, data, n, f, ud);
+}
+
+
+LUALIB_API const char *luaW_tobuffer (lua_State *L, int idx, size_t *len) {
+  Blob *b = (Blob *)toref(L, idx, BLOB);
+  if (b == NULL || b->kind != BLOB_BYTES) return NULL;
+  if (len) *len = b->len;
+  return (const char *)b->data;
+}
+
+
+LUALIB_API const lua_Number *luaW_toarray (lua_State *L, int idx, size_t *n) {
+  Blob *b = (Blob *)toref(L, idx, BLOB);
+  if (b == NULL || b->kind != BLOB_NUMBERS) return NULL;
+  if (n) *n = b->len;
+  return (const lua_Number *)b->data;
+}
+
+
+static ptrdiff_t posrelat (ptrdiff_t pos, size_t len) {
+  /* relative string position: negative means back from end */
+  if (pos < 0) pos += (ptrdiff_t)len + 1;
+  return (pos >= 0) ? pos : 0;
+}
+
+
+/*
+** worker.buffer(s): 把字符串复制一次到不可变的缓冲区, 此后发送不再复制
+*/
+static int w_buffer (lua_State *L) {
+  size_t l;
+  const char *s = luaL_checklstring(L, 1, &l);
+  char *data = (char *)malloc(l + 1);
+  if (data == NULL) return luaL_error(L, "not enough memory");
+  memcpy(data, s, l);
+  pushblob(L, BLOB_BYTES, data, l, freedata, NULL);
+  return 1;
+}
+
+
+/*
+** worker.array(t): 由t中的数值构造不可变的数值数组
+*/
+static int w_array (lua_State *L) {
+  int i, n;
+  lua_Number *data;
+  luaL_checktype(L, 1, LUA_TTABLE);
+  n = luaL_getn(L, 1);
+  data = (lua_Number *)malloc((n + 1) * sizeof(lua_Number));
+  if (data == NULL) return luaL_error(L, "not enough memory");
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, 1, i);
+    if (!lua_isnumber(L, -1)) {
+      free(data);
+      return luaL_error(L, "element %d is not a number", i);
+    }
+    data[i - 1] = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+  }
+  pushblob(L, BLOB_NUMBERS, data, (size_t)n, freedata, NULL);
+  return 1;
+}
+
+
+static int blob_len (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)checkblob(L, 1)->len);
+  return 1;
+}
+
+
+static int blob_kind (lua_State *L) {
+  Blob *b = checkblob(L, 1);
+  lua_pushstring(L, (b->kind == BLOB_BYTES) ? "bytes" : "numbers");
+  return 1;
+}
+
+
+/* b[i] is the i-th byte or number; other keys are methods */
+static int blob_index (lua_State *L) {
+  Blob *b = checkblob(L, 1);
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    lua_Integer i = lua_tointeger(L, 2);
+    if (i < 1 || (size_t)i > b->len)
+      lua_pushnil(L);
+    else if (b->kind == BLOB_BYTES)
+      lua_pushinteger(L, ((unsigned char *)b->data)[i - 1]);
+    else
+      lua_pushnumber(L, ((lua_Number *)b->data)[i - 1]);
+  }
+  else {
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(1));
+  }
+  return 1;
+}
+
+
+/*
+** b:sub(i [, j]): 字节缓冲区的一段, 作为字符串返回(这里才复制)
+*/
+static int blob_sub (lua_State *L) {
+  Blob *b = checkblob(L, 1);
+  ptrdiff_t start = posrelat(luaL_checkinteger(L, 2), b->len);
+  ptrdiff_t end = posrelat(luaL_optinteger(L, 3, -1), b->len);
+  if (b->kind != BLOB_BYTES)
+    return luaL_argerror(L, 1, "not a byte buffer");
+  if (start < 1) start = 1;
+  if (end > (ptrdiff_t)b->len) end = (ptrdiff_t)b->len;
+  if (start <= end)
+    lua_pushlstring(L, (char *)b->data + start - 1, end - start + 1);
+  else lua_pushliteral(L, "");
+  return 1;
+}
+
+
+/*
+** b:unpack([i [, j]]): 返回第i到第j个字节或数值
+*/
+static int blob_unpack (lua_State *L) {
+  Blob *b = checkblob(L, 1);
+  ptrdiff_t i = posrelat(luaL_optinteger(L, 2, 1), b->len);
+  ptrdiff_t e = posrelat(luaL_optinteger(L, 3, -1), b->len);
+  int n;
+  if (i < 1) i = 1;
+  if (e > (ptrdiff_t)b->len) e = (ptrdiff_t)b->len;
+  if (i > e) return 0;  /* empty interval */
+  n = (int)(e - i + 1);
+  if (n <= 0 || n != e - i + 1 || !lua_checkstack(L, n))
+    return luaL_error(L, "too many results to unpack");
+  for (; i <= e; i++) {
+    if (b->kind == BLOB_BYTES)
+      lua_pushinteger(L, ((unsigned char *)b->data)[i - 1]);
+    else
+      lua_pushnumber(L, ((lua_Number *)b->data)[i - 1]);
+  }
+  return n;
+}
+
+
+static int blob_tostring (lua_State *L) {
+  Blob *b = checkblob(L, 1);
+  lua_pushfstring(L, "%s (%p)", (b->kind == BLOB_BYTES) ? "buffer" : "array",
+                  (void *)b);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Codec
+** =======================================================
+*/
+
+/*
+** 编码格式: 每个值以一个标记字节开头. 整数和长度使用变长编码(每字节7位),
+** 表以键值对序列加T_END表示, 同一个表再次出现时编码为其序号(T_REF),
+** 因此共享的子表和环都能保持. 缓冲区和通道只编码其指针(T_BLOB,
+** T_CHAN), 消息本身为每个这样的指针持有一个引用.
+*/
+enum { T_NIL, T_FALSE, T_TRUE, T_INT, T_NUM, T_STR, T_TABLE, T_END, T_REF,
+       T_FUNC, T_BLOB, T_CHAN };
+
+
+/*
+** growable block owned by a userdata, so errors do not leak it; once
+** complete it is a message, also owning the references in `held'
+*/
+typedef struct Buf {
+  char *b;
+  size_t n;
+  size_t size;
+  Ref **held;
+  int nheld;
+  int sizeheld;
+} Buf;
+
+
+static void freebuf (Buf *B) {
+  int i;
+  for (i = 0; i < B->nheld; i++)
+    unref(B->held[i]);
+  free(B->held);
+  free(B->b);
+  B->b = NULL;
+  B->n = B->size = 0;
+  B->held = NULL;
+  B->nheld = B->sizeheld = 0;
+}
+
+
+static int buf_gc (lua_State *L) {
+  freebuf((Buf *)luaL_checkudata(L, 1, BUFFER));
+  return 0;
+}
+
+
+/* `__clone': the memory stays with the original; the copy starts empty */
+static int buf_clone (lua_State *L) {
+  memset(luaL_checkudata(L, 1, BUFFER), 0, sizeof(Buf));
+  return 0;
+}
+
+
+static Buf *newbuf (lua_State *L) {
+  Buf *B = (Buf *)lua_newuserdata(L, sizeof(Buf));
+  B->b = NULL;
+  B->n = B->size = 0;
+  B->held = NULL;
+  B->nheld = B->sizeheld = 0;
+  setmeta(L, BUFFER);
+  return B;
+}
+
+
+/* move the message out of its userdata */
+static void bufsteal (Buf *B, Buf *to) {
+  *to = *B;
+  B->b = NULL;
+  B->n = B->size = 0;
+  B->held = NULL;
+  B->nheld = B->sizeheld = 0;
+}
+
+
+static void addlstr (lua_State *L, Buf *B, const void *s, size_t n) {
+  if (B->size - B->n < n) {
+    size_t newsize = (B->size == 0) ? LUAL_BUFFERSIZE : 2*B->size;
+    char *nb;
+    while (newsize - B->n < n) newsize *= 2;
+    nb = (char *)realloc(B->b, newsize);
+    if (nb == NULL) luaL_error(L, "not enough memory");
+    B->b = nb;
+    B->size = newsize;
+  }
+  memcpy(B->b + B->n, s, n);
+  B->n += n;
+}
+
+
+static void addbyte (lua_State *L, Buf *B, int c) {
+  char ch = (char)c;
+  addlstr(L, B, &ch, 1);
+}
+
+
+static void addsize (lua_State *L, Buf *B, size_t x) {
+  char s[sizeof(size_t)*8/7 + 1];
+  int n = 0;
+  do {
+    s[n++] = (char)((x & 0x7f) | (x > 0x7f ? 0x80 : 0));
+    x >>= 7;
+  } while (x != 0);
+  addlstr(L, B, s, n);
+}
+
+
+static void addref (lua_State *L, Buf *B, int tag, Ref *r) {
+  if (B->nheld == B->sizeheld) {
+    int newsize = (B->sizeheld == 0) ? 4 : 2*B->sizeheld;
+    Ref **nh = (Ref **)realloc(B->held, newsize * sizeof(Ref *));
+    if (nh == NULL) luaL_error(L, "not enough memory");
+    B->held = nh;
+    B->sizeheld = newsize;
+  }
+  addbyte(L, B, tag);
+  addlstr(L, B, &r, sizeof(r));
+  B->held[B->nheld++] = r;
+  incref(r);
+}
+
+
+static int writer (lua_State *L, const void *p, size_t sz, void *ud) {
+  addlstr(L, (Buf *)ud, p, sz);
+  return 0;
+}
+
+
+typedef struct Encoder {
+  lua_State *L;
+  Buf *B;
+  int seen;  /* index of table: encoded table -> its number */
+  int nseen;
+} Encoder;
+
+
+static void encode (Encoder *E, int idx) {
+  lua_State *L = E->L;
+  Buf *B = E->B;
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL: addbyte(L, B, T_NIL); break;
+    case LUA_TBOOLEAN:
+      addbyte(L, B, lua_toboolean(L, idx) ? T_TRUE : T_FALSE);
+      break;
+    case LUA_TNUMBER: {
+      if (lua_isinteger(L, idx)) {  /* zigzag, so small negatives stay short */
+        lua_Integer i = lua_tointeger(L, idx);
+        addbyte(L, B, T_INT);
+        addsize(L, B, (i < 0) ? ~((size_t)i << 1) : (size_t)i << 1);
+      }
+      else {
+        lua_Number n = lua_tonumber(L, idx);
+        addbyte(L, B, T_NUM);
+        addlstr(L, B, &n, sizeof(n));
+      }
+      break;
+    }
+    case LUA_TSTRING: {
+      size_t l;
+      const char *s = lua_tolstring(L, idx, &l);
+      addbyte(L, B, T_STR);
+      addsize(L, B, l);
+      addlstr(L, B, s, l);
+      break;
+    }
+    case LUA_TTABLE: {
+      lua_pushvalue(L, idx);
+      lua_rawget(L, E->seen);
+      if (!lua_isnil(L, -1)) {  /* already encoded? */
+        addbyte(L, B, T_REF);
+        addsize(L, B, (size_t)lua_tointeger(L, -1));
+        lua_pop(L, 1);
+        break;
+      }
+      lua_pop(L, 1);
+      luaL_checkstack(L, 3, "table too deep");
+      lua_pushvalue(L, idx);
+      lua_pushinteger(L, ++E->nseen);
+      lua_rawset(L, E->seen);
+      addbyte(L, B, T_TABLE);
+      lua_pushnil(L);
+      while (lua_next(L, idx)) {
+        int top = lua_gettop(L);
+        encode(E, top - 1);
+        encode(E, top);
+        lua_pop(L, 1);
+      }
+      addbyte(L, B, T_END);
+      break;
+    }
+    case LUA_TFUNCTION: {
+      size_t start;
+      unsigned int len;
+      if (lua_iscfunction(L, idx))
+        luaL_error(L, "cannot send a C function");
+      if (lua_getupvalue(L, idx, 1) != NULL)
+        luaL_error(L, "cannot send a function with upvalues");
+      addbyte(L, B, T_FUNC);
+      start = B->n;
+      len = 0;
+      addlstr(L, B, &len, sizeof(len));  /* patched below */
+      lua_pushvalue(L, idx);
+      lua_dump(L, writer, B);
+      lua_pop(L, 1);
+      len = (unsigned int)(B->n - start - sizeof(len));
+      memcpy(B->b + start, &len, sizeof(len));
+      break;
+    }
+    case LUA_TUSERDATA: {
+      Ref *r;
+      if ((r = toref(L, idx, BLOB)) != NULL)
+        addref(L, B, T_BLOB, r);
+      else if ((r = toref(L, idx, CHANNEL)) != NULL)
+        addref(L, B, T_CHAN, r);
+      else
+        luaL_error(L, "cannot send a userdata");
+      break;
+    }
+    default:
+      luaL_error(L, "cannot send a %s", luaL_typename(L, idx));
+  }
+}
+
+
+/* encode the values at `first'..`last' (absolute indices) into `B' */
+static void encodevalues (lua_State *L, Buf *B, int first, int last) {
+  Encoder E;
+  int i;
+  lua_newtable(L);
+  E.L = L;
+  E.B = B;
+  E.seen = lua_gettop(L);
+  E.nseen = 0;
+  for (i = first; i <= last; i++)
+    encode(&E, i);
+  lua_pop(L, 1);
+}
+
+
+/* a message: the number of values followed by the values */
+static void encodeall (lua_State *L, Buf *B, int first, int last) {
+  addsize(L, B, (size_t)(last - first + 1));
+  encodevalues(L, B, first, last);
+}
+
+
+typedef struct Decoder {
+  lua_State *L;
+  const char *p;
+  int tables;  /* index of table: number -> decoded table */
+  int ntables;
+} Decoder;
+
+
+static size_t getsize (Decoder *D) {
+  size_t x = 0;
+  int shift = 0;
+  unsigned char c;
+  do {
+    c = (unsigned char)*D->p++;
+    x |= (size_t)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return x;
+}
+
+
+static void decode (Decoder *D) {
+  lua_State *L = D->L;
+  luaL_checkstack(L, 3, "table too deep");
+  switch (*D->p++) {
+    case T_NIL: lua_pushnil(L); break;
+    case T_FALSE: lua_pushboolean(L, 0); break;
+    case T_TRUE: lua_pushboolean(L, 1); break;
+    case T_INT: {
+      size_t u = getsize(D);
+      lua_pushinteger(L, (lua_Integer)((u & 1) ? ~(u >> 1) : (u >> 1)));
+      break;
+    }
+    case T_NUM: {
+      lua_Number n;
+      memcpy(&n, D->p, sizeof(n));
+      D->p += sizeof(n);
+      lua_pushnumber(L, n);
+      break;
+    }
+    case T_STR: {
+      size_t l = getsize(D);
+      lua_pushlstring(L, D->p, l);
+      D->p += l;
+      break;
+    }
+    case T_TABLE: {
+      lua_newtable(L);
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, D->tables, ++D->ntables);
+      while (*D->p != T_END) {
+        decode(D);  /* key */
+        decode(D);  /* value */
+        lua_rawset(L, -3);
+      }
+      D->p++;  /* skip T_END */
+      break;
+    }
+    case T_REF:
+      lua_rawgeti(L, D->tables, (int)getsize(D));
+      break;
+    case T_FUNC: {
+      unsigned int len;
+      memcpy(&len, D->p, sizeof(len));
+      D->p += sizeof(len);
+      if (luaL_loadbuffer(L, D->p, len, "=(worker)") != 0)
+        lua_error(L);
+      D->p += len;
+      break;
+    }
+    case T_BLOB: case T_CHAN: {
+      const char *name = (D->p[-1] == T_BLOB) ? BLOB : CHANNEL;
+      Ref *r;
+      memcpy(&r, D->p, sizeof(r));
+      D->p += sizeof(r);
+      pushref(L, r, name);  /* the message keeps its own reference */
+      break;
+    }
+    default: luaL_error(L, "corrupted message");
+  }
+}
+
+
+/* decode the values encoded by `encodeall'; returns how many */
+static int decodeall (lua_State *L, const char *s) {
+  Decoder D;
+  int i, n;
+  lua_newtable(L);
+  D.L = L;
+  D.p = s;
+  D.tables = lua_gettop(L);
+  D.ntables = 0;
+  n = (int)getsize(&D);
+  luaL_checkstack(L, n, "too many values");
+  for (i = 0; i < n; i++)
+    decode(&D);
+  lua_remove(L, D.tables);
+  return n;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Channels
+** =======================================================
+*/
+
+/*
+** 通道: 多个状态(可能在不同的线程里)之间的消息队列. 每条消息是编码
+** 后的一组值; 缓冲区和通道按引用传递, 其余的值被复制.
+** `capacity'为0时不限长度, 否则队列满时发送者等待
+*/
+typedef struct Item {
+  struct Item *next;
+  Buf msg;
+} Item;
+
+
+struct luaW_Channel {
+  Ref r;
+  pthread_mutex_t m;
+  pthread_cond_t nonempty;  /* receivers wait for messages */
+  pthread_cond_t nonfull;  /* senders wait for room */
+  Item *first;  /* queue of messages */
+  Item *last;
+  int count;
+  int capacity;
+  int closed;
+};
+
+typedef luaW_Channel Chan;
+
+
+static void destroychan (Ref *r) {
+  Chan *c = (Chan *)r;
+  while (c->first != NULL) {
+    Item *it = c->first;
+    c->first = it->next;
+    freebuf(&it->msg);
+    free(it);
+  }
+  pthread_cond_destroy(&c->nonfull);
+  pthread_cond_destroy(&c->nonempty);
+  pthread_mutex_destroy(&c->m);
+  free(c);
+}
+
+
+LUALIB_API luaW_Channel *luaW_newchannel (int capacity) {
+  Chan *c = (Chan *)malloc(sizeof(Chan));
+  if (c == NULL) return NULL;
+  c->r.refs = 1;
+  c->r.destroy = destroychan;
+  pthread_mutex_init(&c->m, NULL);
+  pthread_cond_init(&c->nonempty, NULL);
+  pthread_cond_init(&c->nonfull, NULL);
+  c->first = c->last = NULL;
+  c->count = 0;
+  c->capacity = (capacity > 0) ? capacity : 0;
+  c->closed = 0;
+  return c;
+}
+
+
+LUALIB_API void luaW_releasechannel (luaW_Channel *c) {
+  unref(&c->r);
+}
+
+
+LUALIB_API void luaW_closechannel (luaW_Channel *c) {
+  pthread_mutex_lock(&c->m);
+  c->closed = 1;
+  pthread_cond_broadcast(&c->nonempty);
+  pthread_cond_broadcast(&c->nonfull);
+  pthread_mutex_unlock(&c->m);
+}
+
+
+LUALIB_API void luaW_pushchannel (lua_State *L, luaW_Channel *c) {
+  pushref(L, &c->r, CHANNEL);
+}
+
+
+LUALIB_API luaW_Channel *luaW_tochannel (lua_State *L, int idx) {
+  return (Chan *)toref(L, idx, CHANNEL);
+}
+
+
+/*
+** 把栈顶的n个值作为一条消息发送并弹出它们. 通道已关闭时返回0
+*/
+LUALIB_API int luaW_send (lua_State *L, luaW_Channel *c, int n) {
+  int first = lua_gettop(L) - n + 1;
+  Buf *B = newbuf(L);
+  Item *it;
+  encodeall(L, B, first, first + n - 1);
+  it = (Item *)malloc(sizeof(Item));
+  if (it == NULL) return luaL_error(L, "not enough memory");
+  it->next = NULL;
+  bufsteal(B, &it->msg);
+  lua_settop(L, first - 1);
+  pthread_mutex_lock(&c->m);
+  while (!c->closed && c->capacity > 0 && c->count >= c->capacity)
+    pthread_cond_wait(&c->nonfull, &c->m);
+  if (c->closed) {
+    pthread_mutex_unlock(&c->m);
+    freebuf(&it->msg);
+    free(it);
+    return 0;
+  }
+  if (c->first == NULL) c->first = it;
+  else c->last->next = it;
+  c->last = it;
+  c->count++;
+  pthread_cond_signal(&c->nonempty);
+  pthread_mutex_unlock(&c->m);
+  return 1;
+}
+
+
+/*
+** 接收一条消息, 压入其中的值并返回值的个数. 没有消息(通道已关闭,
+** 或者`wait'为0)时返回-1
+*/
+LUALIB_API int luaW_receive (lua_State *L, luaW_Channel *c, int wait) {
+  Buf *B = newbuf(L);  /* owns the message while it is decoded */
+  Item *it;
+  int n;
+  pthread_mutex_lock(&c->m);
+  while (c->first == NULL && !c->closed && wait)
+    pthread_cond_wait(&c->nonempty, &c->m);
+  it = c->first;
+  if (it != NULL) {
+    c->first = it->next;
+    c->count--;
+    pthread_cond_signal(&c->nonfull);
+  }
+  pthread_mutex_unlock(&c->m);
+  if (it == NULL) {
+    lua_pop(L, 1);
+    return -1;
+  }
+  bufsteal(&it->msg, B);
+  free(it);
+  n = decodeall(L, B->b);
+  freebuf(B);
+  lua_remove(L, -(n + 1));
+  return n;
+}
+
+
+static Chan *tochan (lua_State *L) {
+  Chan *c = luaW_tochannel(L, 1);
+  if (c == NULL) luaL_typerror(L, 1, "channel");
+  return c;
+}
+
+
+/*
+** worker.channel([capacity])
+*/
+static int w_channel (lua_State *L) {
+  int capacity = luaL_optint(L, 1, 0);
+  Ref **p = newhandle(L, CHANNEL);
+  Chan *c = luaW_newchannel(capacity);
+  if (c == NULL) return luaL_error(L, "not enough memory");
+  *p = &c->r;
+  return 1;
+}
+
+
+/*
+** ch:send(...): 发送一条消息. 通道已关闭时返回nil和"closed"
+*/
+static int ch_send (lua_State *L) {
+  Chan *c = tochan(L);
+  if (!luaW_send(L, c, lua_gettop(L) - 1)) {
+    lua_pushnil(L);
+    lua_pushliteral(L, "closed");
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+/*
+** ch:receive([wait]): 返回下一条消息中的值. 没有消息时返回nil和
+** "closed"(通道已关闭)或者"empty"(wait为false)
+*/
+static int ch_receive (lua_State *L) {
+  Chan *c = tochan(L);
+  int wait = lua_isnoneornil(L, 2) || lua_toboolean(L, 2);
+  int n;
+  lua_settop(L, 1);
+  n = luaW_receive(L, c, wait);
+  if (n < 0) {
+    int closed;
+    pthread_mutex_lock(&c->m);
+    closed = c->closed;
+    pthread_mutex_unlock(&c->m);
+    lua_pushnil(L);
+    lua_pushstring(L, closed ? "closed" : "empty");
+    return 2;
+  }
+  return n;
+}
+
+
+static int ch_close (lua_State *L) {
+  luaW_closechannel(tochan(L));
+  return 0;
+}
+
+
+static int ch_tostring (lua_State *L) {
+  lua_pushfstring(L, "channel (%p)", (void *)tochan(L));
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+
+/*
+** {======================================================
+** Pools
+** =======================================================
+*/
+
+enum { JOB_PENDING, JOB_OK, JOB_ERROR };
+
+typedef struct Job {
+  struct Job *next;  /* in the queue of the pool */
+  Buf req;  /* encoded function and arguments */
+  Buf res;  /* encoded results, or the error message */
+  int status;
+  int refs;  /* the pool while queued or running, and the futures */
+} Job;
+
+
+typedef struct Pool {
+  pthread_mutex_t m;  /* protects everything below and all jobs */
+  pthread_cond_t work;  /* workers wait for jobs */
+  pthread_cond_t done;  /* futures wait for results */
+  Job *first;  /* queue of jobs */
+  Job *last;
+  int closing;
+  int refs;  /* the pool object and its futures */
+  int nthreads;
+  pthread_t *threads;
+  lua_State **states;  /* one per thread */
+} Pool;
+
+
+typedef struct Future {
+  Pool *pool;
+  Job *job;
+} Future;
+
+
+static void freejob (Job *j) {
+  freebuf(&j->req);
+  freebuf(&j->res);
+  free(j);
+}
+
+
+static void freepool (Pool *P) {
+  pthread_cond_destroy(&P->done);
+  pthread_cond_destroy(&P->work);
+  pthread_mutex_destroy(&P->m);
+  free(P->threads);
+  free(P->states);
+  free(P);
+}
+
+
+/* drop a reference to `P'; must hold `P->m' */
+static void unrefpool (Pool *P) {
+  if (--P->refs == 0) {
+    pthread_mutex_unlock(&P->m);
+    freepool(P);
+  }
+  else
+    pthread_mutex_unlock(&P->m);
+}
+
+
+/*
+** 在工作线程的状态中执行一个任务: 解码函数和参数, 调用, 编码结果
+ */
+static int f_run (lua_State *W) {
+  Job *j = (Job *)lua_touserdata(W, 1);
+  Buf *B;
+  int n;
+  lua_settop(W, 0);
+  B = newbuf(W);
+  n = decodeall(W, j->req.b);
+  lua_call(W, n - 1, LUA_MULTRET);
+  encodeall(W, B, 2, lua_gettop(W));
+  bufsteal(B, &j->res);
+  return 0;
+}
+
+
+static int runjob (lua_State *W, Job *j) {
+  if (lua_cpcall(W, f_run, j) != 0) {
+    size_t l;
+    const char *msg = lua_tolstring(W, -1, &l);
+    if (msg == NULL) {
+      msg = "error object is not a string";
+      l = strlen(msg);
+    }
+    j->res.b = (char *)malloc(l);
+    if (j->res.b != NULL) {
+      memcpy(j->res.b, msg, l);
+      j->res.n = j->res.size = l;
+    }
+    lua_settop(W, 0);
+    return JOB_ERROR;
+  }
+  lua_settop(W, 0);
+  return JOB_OK;
+}
+
+
+static void *workerloop (void *ud) {
+  lua_State *W = (lua_State *)ud;
+  Pool *P;
+  lua_getfield(W, LUA_REGISTRYINDEX, OWNER);
+  P = (Pool *)lua_touserdata(W, -1);
+  lua_pop(W, 1);
+  pthread_mutex_lock(&P->m);
+  for (;;) {
+    Job *j;
+    int status;
+    while (P->first == NULL && !P->closing)
+      pthread_cond_wait(&P->work, &P->m);
+    if (P->first == NULL) break;  /* closing and nothing left to do */
+    j = P->first;
+    P->first = j->next;
+    pthread_mutex_unlock(&P->m);
+    status = runjob(W, j);
+    freebuf(&j->req);
+    pthread_mutex_lock(&P->m);
+    j->status = status;
+    if (--j->refs == 0) freejob(j);
+    pthread_cond_broadcast(&P->done);
+  }
+  pthread_mutex_unlock(&P->m);
+  return NULL;
+}
+
+
+static Pool *topool (lua_State *L) {
+  Pool **p = (Pool **)luaL_checkudata(L, 1, POOL);
+  if (*p == NULL) luaL_error(L, "attempt to use a closed pool");
+  return *p;
+}
+
+
+/*
+** 关闭线程池: 已提交的任务全部执行完之后工作线程退出
+ */
+static void closepool (Pool *P) {
+  int i;
+  pthread_mutex_lock(&P->m);
+  P->closing = 1;
+  pthread_cond_broadcast(&P->work);
+  pthread_mutex_unlock(&P->m);
+  for (i = 0; i < P->nthreads; i++) {
+    pthread_join(P->threads[i], NULL);
+    lua_close(P->states[i]);
+  }
+  P->nthreads = 0;
+  pthread_mutex_lock(&P->m);
+  unrefpool(P);
+}
+
+
+static int pool_close (lua_State *L) {
+  Pool **p = (Pool **)luaL_checkudata(L, 1, POOL);
+  if (*p != NULL) {
+    closepool(*p);
+    *p = NULL;
+  }
+  return 0;
+}
+
+
+/*
+** `__clone': 工作线程属于原来的状态, 复制出的句柄是关闭的(同文件句柄)
+ */
+static int pool_clone (lua_State *L) {
+  *(Pool **)luaL_checkudata(L, 1, POOL) = NULL;
+  return 0;
+}
+
+
+static int pool_size (lua_State *L) {
+  lua_pushinteger(L, topool(L)->nthreads);
+  return 1;
+}
+
+
+static int pool_tostring (lua_State *L) {
+  Pool **p = (Pool **)luaL_checkudata(L, 1, POOL);
+  if (*p == NULL)
+    lua_pushliteral(L, "pool (closed)");
+  else
+    lua_pushfstring(L, "pool (%p)", (void *)*p);
+  return 1;
+}
+
+
+/* queue the request encoded in `B' and push its future */
+static void submit (lua_State *L, Pool *P, Buf *B) {
+  Future *f = (Future *)lua_newuserdata(L, sizeof(Future));
+  Job *j = (Job *)malloc(sizeof(Job));
+  f->pool = NULL;
+  f->job = NULL;
+  if (j == NULL) luaL_error(L, "not enough memory");
+  luaL_getmetatable(L, FUTURE);
+  lua_setmetatable(L, -2);
+  j->next = NULL;
+  bufsteal(B, &j->req);
+  memset(&j->res, 0, sizeof(Buf));
+  j->status = JOB_PENDING;
+  j->refs = 2;
+  pthread_mutex_lock(&P->m);
+  P->refs++;
+  if (P->first == NULL) P->first = j;
+  else P->last->next = j;
+  P->last = j;
+  pthread_cond_signal(&P->work);
+  pthread_mutex_unlock(&P->m);
+  f->pool = P;
+  f->job = j;
+}
+
+
+/*
+** pool:submit(f, ...): 在某个工作线程中执行f(...). f不能有upvalue,
+** 参数只能是nil, 布尔值, 数值, 字符串, 表以及这样的函数
+ */
+static int pool_submit (lua_State *L) {
+  Pool *P = topool(L);
+  int top = lua_gettop(L);
+  Buf *B;
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  B = newbuf(L);
+  encodeall(L, B, 2, top);
+  submit(L, P, B);
+  return 1;
+}
+
+
+/*
+** pool:map(f, list): 对list中的每个元素并行执行f, 按顺序返回各自的
+** 第一个结果. 任何一个出错时引发该错误
+ */
+static int pool_map (lua_State *L) {
+  Pool *P = topool(L);
+  int i, n;
+  Buf *F, *B;
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  n = luaL_getn(L, 3);
+  lua_settop(L, 3);
+  lua_createtable(L, n, 0);  /* futures (4) */
+  F = newbuf(L);  /* count and function, encoded once (5) */
+  B = newbuf(L);  /* (6) */
+  addsize(L, F, 2);
+  encodevalues(L, F, 2, 2);
+  for (i = 1; i <= n; i++) {
+    B->n = 0;
+    addlstr(L, B, F->b, F->n);
+    lua_rawgeti(L, 3, i);
+    encodevalues(L, B, 7, 7);
+    lua_pop(L, 1);
+    submit(L, P, B);
+    lua_rawseti(L, 4, i);
+  }
+  lua_createtable(L, n, 0);  /* results */
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, 4, i);
+    lua_getfield(L, -1, "get");
+    lua_insert(L, -2);
+    lua_call(L, 1, 1);
+    lua_rawseti(L, -2, i);
+  }
+  return 1;
+}
+
+
+static Future *tofuture (lua_State *L) {
+  return (Future *)luaL_checkudata(L, 1, FUTURE);
+}
+
+
+static int future_ready (lua_State *L) {
+  Future *f = tofuture(L);
+  int ready;
+  pthread_mutex_lock(&f->pool->m);
+  ready = (f->job->status != JOB_PENDING);
+  pthread_mutex_unlock(&f->pool->m);
+  lua_pushboolean(L, ready);
+  return 1;
+}
+
+
+/*
+** future:get(): 等待任务结束, 返回其结果; 任务出错时引发同样的错误
+ */
+static int future_get (lua_State *L) {
+  Future *f = tofuture(L);
+  Job *j = f->job;
+  pthread_mutex_lock(&f->pool->m);
+  while (j->status == JOB_PENDING)
+    pthread_cond_wait(&f->pool->done, &f->pool->m);
+  pthread_mutex_unlock(&f->pool->m);
+  if (j->status == JOB_ERROR) {
+    if (j->res.b == NULL) lua_pushliteral(L, "not enough memory");
+    else lua_pushlstring(L, j->res.b, j->res.n);
+    return lua_error(L);
+  }
+  if (j->res.b == NULL)
+    return luaL_error(L, "not enough memory");
+  lua_settop(L, 1);  /* keep the future (and so the job) alive */
+  return decodeall(L, j->res.b);
+}
+
+
+static int future_gc (lua_State *L) {
+  Future *f = tofuture(L);
+  Pool *P = f->pool;
+  if (P != NULL) {
+    pthread_mutex_lock(&P->m);
+    if (--f->job->refs == 0) freejob(f->job);
+    f->pool = NULL;
+    unrefpool(P);
+  }
+  return 0;
+}
+
+
+/* `__clone': the copy is one more future of the same job */
+static int future_clone (lua_State *L) {
+  Future *f = tofuture(L);
+  Pool *P = f->pool;
+  if (P != NULL) {
+    pthread_mutex_lock(&P->m);
+    P->refs++;
+    f->job->refs++;
+    pthread_mutex_unlock(&P->m);
+  }
+  return 0;
+}
+
+
+static int future_tostring (lua_State *L) {
+  lua_pushfstring(L, "future (%p)", lua_touserdata(L, 1));
+  return 1;
+}
+
+
+/* create the state of one worker */
+static lua_State *newworker (Pool *P) {
+  lua_State *W = luaL_newstate();
+  if (W == NULL) return NULL;
+  luaL_openlibs(W);
+  lua_pushlightuserdata(W, P);
+  lua_setfield(W, LUA_REGISTRYINDEX, OWNER);
+  return W;
+}
+
+
+/*
+** worker.pool([n]): 创建n个工作线程(默认为处理器个数)
+ */
+static int w_pool (lua_State *L) {
+  int n = luaL_optint(L, 1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+  Pool **p = (Pool **)lua_newuserdata(L, sizeof(Pool *));
+  Pool *P;
+  int i;
+  if (n < 1) n = 1;
+  *p = NULL;
+  luaL_getmetatable(L, POOL);
+  lua_setmetatable(L, -2);
+  P = (Pool *)malloc(sizeof(Pool));
+  if (P == NULL) return luaL_error(L, "not enough memory");
+  P->threads = (pthread_t *)malloc(n * sizeof(pthread_t));
+  P->states = (lua_State **)malloc(n * sizeof(lua_State *));
+  if (P->threads == NULL || P->states == NULL) {
+    free(P->threads);
+    free(P->states);
+    free(P);
+    return luaL_error(L, "not enough memory");
+  }
+  pthread_mutex_init(&P->m, NULL);
+  pthread_cond_init(&P->work, NULL);
+  pthread_cond_init(&P->done, NULL);
+  P->first = P->last = NULL;
+  P->closing = 0;
+  P->refs = 1;
+  P->nthreads = 0;
+  *p = P;  /* from now on `__gc' cleans up */
+  for (i = 0; i < n; i++) {
+    lua_State *W = newworker(P);
+    if (W == NULL) return luaL_error(L, "cannot create worker state");
+    if (pthread_create(&P->threads[i], NULL, workerloop, W) != 0) {
+      lua_close(W);
+      return luaL_error(L, "cannot create worker thread");
+    }
+    P->states[P->nthreads++] = W;
+  }
+  return 1;
+}
+
+
+static int w_cores (lua_State *L) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  lua_pushinteger(L, (n > 0) ? n : 1);
+  return 1;
+}
+
+
+static const luaL_Reg pool_m[] = {
+  {"close", pool_close},
+  {"map", pool_map},
+  {"size", pool_size},
+  {"submit", pool_submit},
+  {"__clone", pool_clone},
+  {"__gc", pool_close},
+  {"__tostring", pool_tostring},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg future_m[] = {
+  {"get", future_get},
+  {"ready", future_ready},
+  {"__clone", future_clone},
+  {"__gc", future_gc},
+  {"__tostring", future_tostring},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg blob_m[] = {
+  {"kind", blob_kind},
+  {"len", blob_len},
+  {"sub", blob_sub},
+  {"unpack", blob_unpack},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg channel_m[] = {
+  {"close", ch_close},
+  {"receive", ch_receive},
+  {"send", ch_send},
+  {"__clone", ref_clone},
+  {"__gc", ref_gc},
+  {"__tostring", ch_tostring},
+  {NULL, NULL}
+};
+
+
+static void createmeta (lua_State *L, const char *name, const luaL_Reg *m) {
+  luaL_newmetatable(L, name);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = metatable */
+  luaL_register(L, NULL, m);
+  lua_pop(L, 1);
+}
+
+
+static void createmetas (lua_State *L) {
+  luaL_newmetatable(L, BUFFER);
+  lua_pushcfunction(L, buf_clone);
+  lua_setfield(L, -2, "__clone");
+  lua_pushcfunction(L, buf_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+  luaL_newmetatable(L, BLOB);
+  lua_newtable(L);
+  luaL_register(L, NULL, blob_m);
+  lua_pushcclosure(L, blob_index, 1);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, blob_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, ref_clone);
+  lua_setfield(L, -2, "__clone");
+  lua_pushcfunction(L, ref_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pushcfunction(L, blob_tostring);
+  lua_setfield(L, -2, "__tostring");
+  lua_pop(L, 1);
+  createmeta(L, CHANNEL, channel_m);
+  createmeta(L, POOL, pool_m);
+  createmeta(L, FUTURE, future_m);
+}
+
+/* }====================================================== */
+
+#else
+
+static int nothreads (lua_State *L) {
+  return luaL_error(L, "the worker library needs POSIX threads");
+}
+
+#define w_array		nothreads
+#define w_buffer	nothreads
+#define w_channel	nothreads
+#define w_pool		nothreads
+
+
+static int w_cores (lua_State *L) {
+  lua_pushinteger(L, 1);
+  return 1;
+}
+
+
+LUALIB_API void luaW_pushbuffer (lua_State *L, void *data, size_t len,
+                                 luaW_Free f, void *ud) {
+  (void)len;
+  if (f) f(ud, data);
+  nothreads(L);
+}
+
+
+LUALIB_API void luaW_pusharray (lua_State *L, lua_Number *data, size_t n,
+                                luaW_Free f, void *ud) {
+  (void)n;
+  if (f) f(ud, data);
+  nothreads(L);
+}
+
+
+LUALIB_API const char *luaW_tobuffer (lua_State *L, int idx, size_t *len) {
+  (void)L; (void)idx; (void)len;
+  return NULL;
+}
+
+
+LUALIB_API const lua_Number *luaW_toarray (lua_State *L, int idx, size_t *n) {
+  (void)L; (void)idx; (void)n;
+  return NULL;
+}
+
+
+LUALIB_API luaW_Channel *luaW_newchannel (int capacity) {
+  (void)capacity;
+  return NULL;  /* so nothing below is ever called */
+}
+
+
+LUALIB_API void luaW_releasechannel (luaW_Channel *c) { (void)c; }
+LUALIB_API void luaW_closechannel (luaW_Channel *c) { (void)c; }
+
+
+LUALIB_API void luaW_pushchannel (lua_State *L, luaW_Channel *c) {
+  (void)c;
+  nothreads(L);
+}
+
+
+LUALIB_API luaW_Channel *luaW_tochannel (lua_State *L, int idx) {
+  (void)L; (void)idx;
+  return NULL;
+}
+
+
+LUALIB_API int luaW_send (lua_State *L, luaW_Channel *c, int n) {
+  (void)c; (void)n;
+  return nothreads(L);
+}
+
+
+LUALIB_API int luaW_receive (lua_State *L, luaW_Channel *c, int wait) {
+  (void)c; (void)wait;
+  return nothreads(L);
+}
+
+#endif
+
+
+
+static const luaL_Reg worker_funcs[] = {
+  {"array", w_array},
+  {"buffer", w_buffer},
+  {"channel", w_channel},
+  {"cores", w_cores},
+  {"pool", w_pool},
+  {NULL, NULL}
+};
+
+
+LUALIB_API int luaopen_worker (lua_State *L) {
+#if defined(LUA_USE_POSIX)
+  createmetas(L);
+#endif
+  luaL_register(L, LUA_WORKERLIBNAME, worker_funcs);
+  return 1;
+}
+
@@ -69,7 +69,10 @@ static void PrintConstant(const Proto* f, int i)
 	printf(bvalue(o) ? "true" : "false");
 	break;
   case LUA_TNUMBER:
-	printf(LUA_NUMBER_FMT,nvalue(o));
+	if (ttisint(o))
+	 printf(LUAI_INTFMT,ivalue(o));
+	else
+	 printf(LUA_NUMBER_FMT,nvalue(o));
 	break;
   case LUA_TSTRING:
 	PrintString(rawtsvalue(o));
@@ -130,7 +133,8 @@ static void PrintCode(const Proto* f)
     break;
   }
   /* 打印分号之后的部分, lua源码对应的常量名, 变量名, 函数名, 包名等 */
-  switch (o)
+  /* 超级指令按其第一条原指令打印 */
+  switch (fusedfirst(o))
   {
    case OP_LOADK:
     printf("\t; "); PrintConstant(f,bx);